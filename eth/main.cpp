@@ -196,6 +196,14 @@ int main(int argc, char** argv)
 			{
 				c.stopMining();
 			}
+			else if (cmd == "pinstats")
+			{
+				c.lock();
+				auto s = c.pinStats();
+				c.resetPinStats();
+				c.unlock();
+				cout << s.hits << " state trie node reads from pinned levels; " << s.loads << " read in to keep them up to date." << endl;
+			}
 			else if (cmd == "transact")
 			{
 				string sechex;
@@ -0,0 +1,123 @@
+/*
+	This file is part of cpp-ethereum.
+
+	cpp-ethereum is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	Foobar is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/** @file Arena.cpp
+ * @date 2014
+ */
+
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+#include "Arena.h"
+using namespace std;
+using namespace eth;
+
+void* Arena::allocate(size_t _size)
+{
+	size_t s = rounded(_size);
+	m_used += s;
+	if (s > c_maxSmall)
+	{
+		Large* l = (Large*)malloc(c_largeHeader + s);
+		if (!l)
+			throw bad_alloc();
+		l->prev = nullptr;
+		l->next = m_large;
+		if (m_large)
+			m_large->prev = l;
+		m_large = l;
+		m_reserved += s;
+		return (char*)l + c_largeHeader;
+	}
+
+	void*& f = m_free[s / c_align];
+	if (f)
+	{
+		void* ret = f;
+		f = *(void**)f;
+		return ret;
+	}
+	if (m_end - m_next < (ptrdiff_t)s)
+	{
+		// What's left of the block is abandoned; it's less than c_maxSmall. Move on to the next, kept by rewind(), or a new one.
+		if (m_current == m_blocks.size())
+		{
+			char* b = (char*)malloc(m_blockSize);
+			if (!b)
+				throw bad_alloc();
+			m_blocks.push_back(b);
+			m_reserved += m_blockSize;
+		}
+		m_next = m_blocks[m_current++];
+		m_end = m_next + m_blockSize;
+	}
+	void* ret = m_next;
+	m_next += s;
+	return ret;
+}
+
+void Arena::release(void* _p, size_t _size)
+{
+	if (!_p)
+		return;
+	size_t s = rounded(_size);
+	m_used -= s;
+	if (s > c_maxSmall)
+	{
+		Large* l = (Large*)((char*)_p - c_largeHeader);
+		(l->prev ? l->prev->next : m_large) = l->next;
+		if (l->next)
+			l->next->prev = l->prev;
+		m_reserved -= s;
+		free(l);
+		return;
+	}
+	void*& f = m_free[s / c_align];
+	*(void**)_p = f;
+	f = _p;
+}
+
+void Arena::clear()
+{
+	for (auto b: m_blocks)
+		free(b);
+	m_blocks.clear();
+	freeLarge();
+	fill(m_free.begin(), m_free.end(), nullptr);
+	m_current = 0;
+	m_next = m_end = nullptr;
+	m_reserved = m_used = 0;
+}
+
+void Arena::rewind()
+{
+	freeLarge();
+	fill(m_free.begin(), m_free.end(), nullptr);
+	m_current = 0;
+	m_next = m_end = nullptr;
+	m_reserved = m_blocks.size() * m_blockSize;
+	m_used = 0;
+}
+
+void Arena::freeLarge()
+{
+	while (m_large)
+	{
+		Large* n = m_large->next;
+		free(m_large);
+		m_large = n;
+	}
+}
@@ -0,0 +1,90 @@
+/*
+	This file is part of cpp-ethereum.
+
+	cpp-ethereum is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	Foobar is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/** @file Arena.h
+ * @date 2014
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <algorithm>
+#include <vector>
+
+namespace eth
+{
+
+/**
+ * @brief Memory carved out of large blocks, all given back at once when the arena is cleared or destroyed.
+ * Pieces released before then are kept by size and reused, so steady churn doesn't grow it.
+ * Nothing is constructed or destructed: it suits plain structs, which then need no freeing one by one.
+ */
+class Arena
+{
+public:
+	/// @a _blockSize is raised to the largest piece served from a block (1KB) if it's less.
+	explicit Arena(size_t _blockSize = c_defaultBlockSize): m_blockSize(_blockSize < c_maxSmall ? c_maxSmall : _blockSize) {}
+	~Arena() { clear(); }
+
+	Arena(Arena const&) = delete;
+	Arena& operator=(Arena const&) = delete;
+
+	/// @returns @a _size bytes, aligned for any built-in type.
+	void* allocate(size_t _size);
+	/// Gives back @a _p, which must have come from allocate(@a _size).
+	void release(void* _p, size_t _size);
+
+	/// Gives back everything, without regard to what was allocated from it.
+	void clear();
+	/// As clear(), but keeps the blocks to serve what's allocated next; suits scratch memory reused again and again.
+	void rewind();
+
+	/// Bytes taken from the system, including those allocated and yet to be.
+	size_t reserved() const { return m_reserved; }
+	/// Bytes allocated and not released.
+	size_t used() const { return m_used; }
+
+	static const size_t c_defaultBlockSize = 1 << 20;
+
+private:
+	static const size_t c_align = alignof(std::max_align_t) < 8 ? 8 : alignof(std::max_align_t);
+	/// Largest size served from the blocks; bigger ones get their own allocation.
+	static const size_t c_maxSmall = 1024;
+
+	static size_t rounded(size_t _size) { return (std::max<size_t>(_size, 1) + c_align - 1) / c_align * c_align; }
+
+	/// Heads each allocation too big for the blocks, linking them all so they can be freed together.
+	struct Large
+	{
+		Large* prev;
+		Large* next;
+	};
+	static const size_t c_largeHeader = (sizeof(Large) + c_align - 1) / c_align * c_align;
+	void freeLarge();
+
+	size_t m_blockSize;
+	std::vector<char*> m_blocks;
+	size_t m_current = 0;					///< Index of the block in use, plus one; 0 if none.
+	char* m_next = nullptr;					///< Start of what's left of the block in use.
+	char* m_end = nullptr;
+	std::vector<void*> m_free = std::vector<void*>(c_maxSmall / c_align + 1);	///< Released pieces by size / c_align, each list threaded through the pieces.
+	Large* m_large = nullptr;				///< The most recent of the large allocations not yet released.
+
+	size_t m_reserved = 0;
+	size_t m_used = 0;
+};
+
+}
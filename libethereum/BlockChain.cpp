@@ -21,7 +21,7 @@
 
 #include <boost/filesystem.hpp>
 #include "Common.h"
-#include "RLP.h"
+#include "RLPSchema.h"
 #include "Exceptions.h"
 #include "Dagger.h"
 #include "BlockInfo.h"
@@ -49,12 +49,18 @@ std::ostream& operator<<(std::ostream& _out, BlockChain const& _bc)
 }
 }
 
+/// number, totalDifficulty, parent, children.
+using BlockDetailsSchema = RLPSchema<RLPInt<eth::uint>, RLPInt<u256>, RLPHash<32>, RLPListOf<RLPHash<32>>>;
+
 BlockDetails::BlockDetails(RLP const& _r)
 {
-	number = _r[0].toInt<uint>();
-	totalDifficulty = _r[1].toInt<u256>();
-	parent = _r[2].toHash<h256>();
-	children = _r[3].toVector<h256>();
+	BlockDetailsSchema::Type d;
+	if (!BlockDetailsSchema::decode(_r.data(), d))
+		throw RLP::BadCast();
+	number = get<0>(d);
+	totalDifficulty = get<1>(d);
+	parent = get<2>(d);
+	children = move(get<3>(d));
 }
 
 bytes BlockDetails::rlp() const
@@ -106,8 +106,8 @@ private:
 	void checkConsistency();
 
 	/// Get fully populated from disk DB.
-	mutable std::map<h256, BlockDetails> m_details;
-	mutable std::map<h256, std::string> m_cache;
+	mutable std::unordered_map<h256, BlockDetails> m_details;
+	mutable std::unordered_map<h256, std::string> m_cache;
 
 	ldb::DB* m_db;
 	ldb::DB* m_detailsDB;
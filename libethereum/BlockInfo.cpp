@@ -22,12 +22,18 @@
 #include "Common.h"
 #include "Dagger.h"
 #include "Exceptions.h"
-#include "RLP.h"
+#include "RLPSchema.h"
 #include "State.h"
 #include "BlockInfo.h"
 using namespace std;
 using namespace eth;
 
+/// parentHash, sha3Uncles, coinbaseAddress, stateRoot, sha3Transactions, difficulty, timestamp, extraData, nonce.
+using BlockHeaderSchema = RLPSchema<RLPHash<32>, RLPHash<32>, RLPHash<20>, RLPHash<32>, RLPHash<32>, RLPInt<u256>, RLPInt<u256>, RLPBytes, RLPInt<u256>>;
+
+/// header, transactions, uncles.
+using BlockSchema = RLPSchema<BlockHeaderSchema, RLPList, RLPList>;
+
 BlockInfo* BlockInfo::s_genesis = nullptr;
 
 BlockInfo::BlockInfo(): timestamp(Invalid256)
@@ -69,13 +75,26 @@ h256 BlockInfo::headerHashWithoutNonce() const
 	return sha3(s.out());
 }
 
-void BlockInfo::fillStream(RLPStream& _s, bool _nonce) const
+template <class _S> void BlockInfo::streamRLP(_S& _s, bool _nonce) const
 {
 	_s.appendList(_nonce ? 9 : 8) << parentHash << sha3Uncles << coinbaseAddress << stateRoot << sha3Transactions << difficulty << timestamp << extraData;
 	if (_nonce)
 		_s << nonce;
 }
 
+void BlockInfo::fillStream(RLPStream& _s, bool _nonce) const
+{
+	streamRLP(_s.measure(), _nonce);
+	streamRLP(_s.prepare(), _nonce);
+}
+
+void BlockInfo::fillMeasure(RLPMeasure& _m, bool _nonce) const
+{
+	uint mark = _m.beginSelfPrepared();
+	streamRLP(_m, _nonce);
+	_m.endSelfPrepared(mark);
+}
+
 void BlockInfo::populateGenesis()
 {
 	bytes genesisBlock = createGenesisBlock();
@@ -84,25 +103,21 @@ void BlockInfo::populateGenesis()
 
 void BlockInfo::populate(bytesConstRef _block)
 {
-	RLP root(_block);
-	try
-	{
-		RLP header = root[0];
-		hash = eth::sha3(_block);
-		parentHash = header[0].toHash<h256>();
-		sha3Uncles = header[1].toHash<h256>();
-		coinbaseAddress = header[2].toHash<Address>();
-		stateRoot = header[3].toHash<h256>();
-		sha3Transactions = header[4].toHash<h256>();
-		difficulty = header[5].toInt<u256>();
-		timestamp = header[6].toInt<u256>();
-		extraData = header[7].toBytes();
-		nonce = header[8].toInt<u256>();
-	}
-	catch (RLP::BadCast)
-	{
+	BlockSchema::Type block;
+	if (!BlockSchema::decode(_block, block))
 		throw InvalidBlockFormat();
-	}
+
+	auto const& header = get<0>(block);
+	hash = eth::sha3(_block);
+	parentHash = get<0>(header);
+	sha3Uncles = get<1>(header);
+	coinbaseAddress = get<2>(header);
+	stateRoot = get<3>(header);
+	sha3Transactions = get<4>(header);
+	difficulty = get<5>(header);
+	timestamp = get<6>(header);
+	extraData = get<7>(header).toBytes();
+	nonce = get<8>(header);
 
 	// check it hashes according to proof of work or that it's the genesis block.
 	if (parentHash && !Dagger::verify(headerHashWithoutNonce(), nonce, difficulty))
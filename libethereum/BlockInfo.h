@@ -70,11 +70,14 @@ public:
 	/// No-nonce sha3 of the header only.
 	h256 headerHashWithoutNonce() const;
 	void fillStream(RLPStream& _s, bool _nonce) const;
+	/// Measures what fillStream() appends, for an outer prepare() to make room for.
+	void fillMeasure(RLPMeasure& _m, bool _nonce) const;
 
 	static bytes createGenesisBlock();
 
 private:
 	void populateGenesis();
+	template <class _S> void streamRLP(_S& _s, bool _nonce) const;
 
 	static BlockInfo* s_genesis;
 };
@@ -28,15 +28,22 @@ Client::Client(std::string const& _clientVersion, Address _us, std::string const
 	m_clientVersion(_clientVersion),
 	m_bc(_dbPath),
 	m_stateDB(State::openDB(_dbPath)),
+	m_stateReads(m_stateDB.db()),
 	m_s(_us, m_stateDB)
 {
 	Defaults::setDBPath(_dbPath);
 
+	// The genesis state reaches the disk only with the first block imported; until then snapshots need their own copy.
+	TrieDB<Address, ConcurrentNodeStore> genesis(&m_stateReads);
+	genesis.init();
+	eth::commit(genesisState(), m_stateReads, genesis);
+
 	// Synchronise the state according to the block chain - i.e. replay all transactions in block chain, in order.
 	// In practise this won't need to be done since the State DB will contain the keys for the tries for most recent (and many old) blocks.
 	// TODO: currently it contains keys for *all* blocks. Make it remove old ones.
 	m_s.sync(m_bc);
 	m_s.sync(m_tq);
+	m_snapshotRoot = m_s.previousRootHash();
 	m_changed = true;
 
 	m_work = new thread([&](){ while (m_workState != Deleting) work(); m_workState = Deleted; });
@@ -121,6 +128,12 @@ void Client::work()
 	if (m_s.sync(m_tq))
 		m_changed = true;
 
+	// Move stateSnapshot() on to the block just synced to; its state is committed to disk by now.
+	{
+		lock_guard<mutex> l(m_snapshotLock);
+		m_snapshotRoot = m_s.previousRootHash();
+	}
+
 	m_lock.unlock();
 	if (m_doMine)
 	{
@@ -145,6 +158,16 @@ void Client::work()
 		usleep(100000);
 }
 
+TrieSnapshot<Address, ConcurrentNodeStore> Client::stateSnapshot() const
+{
+	h256 root;
+	{
+		lock_guard<mutex> l(m_snapshotLock);
+		root = m_snapshotRoot;
+	}
+	return TrieSnapshot<Address, ConcurrentNodeStore>(&m_stateReads, root);
+}
+
 void Client::lock()
 {
 	m_lock.lock();
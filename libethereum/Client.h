@@ -57,6 +57,14 @@ public:
 	BlockChain const& blockChain() const { return m_bc; }
 	TransactionQueue const& transactionQueue() const { return m_tq; }
 
+	/// @returns the state trie's pinned-level reads since the last resetPinStats(); like state(), only within lock().
+	TrieDB<Address, Overlay>::PinStats pinStats() const { return m_s.pinStats(); }
+	void resetPinStats() { m_s.resetPinStats(); }
+
+	/// @returns a read-only view of the accounts as of the end of the latest block. Unlike state(), it needs no lock()
+	/// and may be read from any thread while blocks are imported; it won't change, so take another to see later blocks.
+	TrieSnapshot<Address, ConcurrentNodeStore> stateSnapshot() const;
+
 	std::vector<PeerInfo> peers() { return m_net ? m_net->peers() : std::vector<PeerInfo>(); }
 	unsigned peerCount() const { return m_net ? m_net->peerCount() : 0; }
 
@@ -77,10 +85,13 @@ private:
 	BlockChain m_bc;					///< Maintains block database.
 	TransactionQueue m_tq;				///< Maintains list of incoming transactions not yet on the block chain.
 	Overlay m_stateDB;					///< Acts as the central point for the state database, so multiple States can share it.
+	ConcurrentNodeStore m_stateReads;	///< Reads m_stateDB's nodes on disk for stateSnapshot(), from any thread.
 	State m_s;							///< The present state of the client.
 	PeerServer* m_net = nullptr;		///< Should run in background and send us events when blocks found and allow us to send blocks as required.
 	std::thread* m_work;				///< The work thread.
 	std::mutex m_lock;
+	mutable std::mutex m_snapshotLock;	///< Guards m_snapshotRoot alone, so stateSnapshot() never waits on m_lock.
+	h256 m_snapshotRoot;				///< State root of the latest block synced to, whose nodes are all on disk.
 	enum { Active = 0, Deleting, Deleted } m_workState = Active;
 	bool m_doMine = false;				///< Are we supposed to be mining?
 	MineProgress m_mineProgress;
@@ -25,7 +25,6 @@
 #pragma GCC diagnostic ignored "-Wunused-function"
 #endif
 #include <secp256k1.h>
-#include <sha3.h>
 #if WIN32
 #pragma warning(pop)
 #else
@@ -33,6 +32,7 @@
 #include <random>
 #include "Common.h"
 #include "Exceptions.h"
+#include "Keccak.h"
 using namespace std;
 using namespace eth;
 
@@ -118,7 +118,7 @@ bytes eth::toHex(std::string const& _s)
 {
 	std::vector<uint8_t> ret;
 	ret.reserve(_s.size() * 2);
-	for (auto i: _s)
+	for (byte i: _s)
 	{
 		ret.push_back(i / 16);
 		ret.push_back(i % 16);
@@ -145,10 +145,8 @@ std::string eth::sha3(std::string const& _input, bool _hex)
 
 void eth::sha3(bytesConstRef _input, bytesRef _output)
 {
-	CryptoPP::SHA3_256 ctx;
-	ctx.Update((byte*)_input.data(), _input.size());
 	assert(_output.size() >= 32);
-	ctx.Final(_output.data());
+	keccak256(_input, _output.data());
 }
 
 bytes eth::sha3Bytes(bytesConstRef _input)
@@ -161,7 +159,7 @@ bytes eth::sha3Bytes(bytesConstRef _input)
 h256 eth::sha3(bytesConstRef _input)
 {
 	h256 ret;
-	sha3(_input, bytesRef(&ret[0], 32));
+	keccak256(_input, ret.data());
 	return ret;
 }
 
@@ -31,6 +31,8 @@
 #include <array>
 #include <map>
 #include <set>
+#include <unordered_map>
+#include <unordered_set>
 #include <string>
 #include <cassert>
 #include <sstream>
@@ -79,19 +81,25 @@ public:
 
 	operator Arith() const { return fromBigEndian<Arith>(m_data); }
 
-	operator bool() const { return ((Arith)*this) != 0; }
+	operator bool() const { uint64_t r = 0; for (unsigned i = 0; i < c_words; ++i) r |= word(i); for (unsigned i = c_words * 8; i < N; ++i) r |= m_data[i]; return !!r; }
 
-	bool operator==(FixedHash const& _c) const { return m_data == _c.m_data; }
-	bool operator!=(FixedHash const& _c) const { return m_data != _c.m_data; }
-	bool operator<(FixedHash const& _c) const { return m_data < _c.m_data; }
+	bool operator==(FixedHash const& _c) const { return !memcmp(m_data.data(), _c.m_data.data(), N); }
+	bool operator!=(FixedHash const& _c) const { return !!memcmp(m_data.data(), _c.m_data.data(), N); }
+	bool operator<(FixedHash const& _c) const { return memcmp(m_data.data(), _c.m_data.data(), N) < 0; }
 
-	FixedHash& operator^=(FixedHash const& _c) { for (auto i = 0; i < N; ++i) m_data[i] ^= _c.m_data[i]; return *this; }
+	FixedHash& operator^=(FixedHash const& _c) { for (unsigned i = 0; i < c_words; ++i) setWord(i, word(i) ^ _c.word(i)); for (unsigned i = c_words * 8; i < N; ++i) m_data[i] ^= _c.m_data[i]; return *this; }
 	FixedHash operator^(FixedHash const& _c) const { return FixedHash(*this) ^= _c; }
-	FixedHash& operator|=(FixedHash const& _c) { for (auto i = 0; i < N; ++i) m_data[i] |= _c.m_data[i]; return *this; }
+	FixedHash& operator|=(FixedHash const& _c) { for (unsigned i = 0; i < c_words; ++i) setWord(i, word(i) | _c.word(i)); for (unsigned i = c_words * 8; i < N; ++i) m_data[i] |= _c.m_data[i]; return *this; }
 	FixedHash operator|(FixedHash const& _c) const { return FixedHash(*this) |= _c; }
-	FixedHash& operator&=(FixedHash const& _c) { for (auto i = 0; i < N; ++i) m_data[i] &= _c.m_data[i]; return *this; }
+	FixedHash& operator&=(FixedHash const& _c) { for (unsigned i = 0; i < c_words; ++i) setWord(i, word(i) & _c.word(i)); for (unsigned i = c_words * 8; i < N; ++i) m_data[i] &= _c.m_data[i]; return *this; }
 	FixedHash operator&(FixedHash const& _c) const { return FixedHash(*this) &= _c; }
-	FixedHash& operator~() { for (auto i = 0; i < N; ++i) m_data[i] = ~m_data[i]; return *this; }
+	FixedHash& operator~() { for (unsigned i = 0; i < c_words; ++i) setWord(i, ~word(i)); for (unsigned i = c_words * 8; i < N; ++i) m_data[i] = ~m_data[i]; return *this; }
+
+	/// A hash of the hash: its bytes are uniformly distributed already, so its words are just folded together.
+	struct hash
+	{
+		size_t operator()(FixedHash const& _h) const { uint64_t r = 0; for (unsigned i = 0; i < c_words; ++i) r ^= _h.word(i); for (unsigned i = c_words * 8; i < N; ++i) r = (r << 8) ^ _h.m_data[i]; return (size_t)r; }
+	};
 
 	byte& operator[](unsigned _i) { return m_data[_i]; }
 	byte operator[](unsigned _i) const { return m_data[_i]; }
@@ -107,6 +115,12 @@ public:
 	std::array<byte, N> const& asArray() const { return m_data; }
 
 private:
+	/// Number of whole 64-bit words in the hash; any remaining bytes are dealt with singly.
+	static const unsigned c_words = N / 8;
+
+	uint64_t word(unsigned _i) const { uint64_t ret; memcpy(&ret, m_data.data() + _i * 8, 8); return ret; }
+	void setWord(unsigned _i, uint64_t _w) { memcpy(m_data.data() + _i * 8, &_w, 8); }
+
 	std::array<byte, N> m_data;
 };
 
@@ -126,6 +140,8 @@ using h256s = std::vector<h256>;
 using h160s = std::vector<h160>;
 using h256Set = std::set<h256>;
 using h160Set = std::set<h160>;
+using h256Hash = std::unordered_set<h256>;
+using h160Hash = std::unordered_set<h160>;
 
 using Secret = h256;
 using Address = h160;
@@ -334,6 +350,60 @@ inline std::string toCompactBigEndianString(_T _val)
 	return ret;
 }
 
+/// Writes the big-endian representation of @a _val without leading zeros into the bytes immediately before @a o_end.
+/// At least 8 bytes must be available before @a o_end.
+/// @returns the number of bytes written (0 if @a _val is zero).
+inline uint toCompactBigEndian(uint _val, byte* o_end)
+{
+	uint n = 0;
+	for (; _val; ++n, _val >>= 8)
+		*--o_end = (byte)_val;
+	return n;
+}
+
+/// Writes the big-endian representation of the fixed-width integer @a _val (u160 or u256) without leading zeros into
+/// the bytes immediately before @a o_end, reading its limbs directly. At least 32 bytes must be available before @a o_end.
+/// @returns the number of bytes written (0 if @a _val is zero).
+template <class _T>
+inline uint toCompactBigEndianLimbs(_T const& _val, byte* o_end)
+{
+	using limb = boost::multiprecision::limb_type;
+	byte* p = o_end;
+	auto const& b = _val.backend();
+	for (unsigned i = 0; i < b.size(); ++i)
+		for (limb l = b.limbs()[i], j = 0; j < sizeof(limb); ++j, l >>= 8)
+			*--p = (byte)l;
+	for (; p != o_end && !*p; ++p) {}
+	return o_end - p;
+}
+
+/// Converts a big-endian byte-stream directly into the limbs of a fixed-width integer @a _T (u160 or u256).
+/// Any bytes beyond the width of @a _T are discarded from the front, as with fromBigEndian.
+template <class _T>
+inline _T fromBigEndianLimbs(bytesConstRef _bytes)
+{
+	using limb = boost::multiprecision::limb_type;
+	unsigned const maxBytes = std::numeric_limits<_T>::digits / 8;
+	byte const* b = _bytes.data();
+	byte const* e = b + _bytes.size();
+	if (_bytes.size() > maxBytes)
+		b = e - maxBytes;
+	_T ret;
+	unsigned limbs = (e - b + sizeof(limb) - 1) / sizeof(limb);
+	if (!limbs)
+		return ret;
+	ret.backend().resize(limbs, limbs);
+	for (unsigned i = 0; i < limbs; ++i)
+	{
+		limb l = 0;
+		for (unsigned j = 0; j < sizeof(limb) && e != b; ++j)
+			l |= (limb)*--e << (8 * j);
+		ret.backend().limbs()[i] = l;
+	}
+	ret.backend().normalize();
+	return ret;
+}
+
 /// Determines the length of the common prefix of the two collections given.
 /// @returns the number of elements both @a _t and @a _u share, in order, at the beginning.
 /// @example commonPrefix("Hello world!", "Hello, world!") == 5
@@ -431,3 +501,11 @@ private:
 };
 
 }
+
+namespace std
+{
+
+/// Forward std::hash<eth::FixedHash> to eth::FixedHash::hash.
+template <unsigned N> struct hash<eth::FixedHash<N>>: eth::FixedHash<N>::hash {};
+
+}
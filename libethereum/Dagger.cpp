@@ -14,6 +14,7 @@
 #include <random>
 #include "Common.h"
 #include "Dagger.h"
+#include "Keccak.h"
 using namespace std;
 using namespace std::chrono;
 
@@ -28,23 +29,42 @@ MineInfo Dagger::mine(u256& o_solution, h256 const& _root, u256 const& _difficul
 	static std::mt19937_64 s_eng((time(0)));
 	o_solution = std::uniform_int_distribution<uint>(0, ~(uint)0)(s_eng);
 
-	bigint d = (bigint(1) << 256) / _difficulty;
-	ret.requirement = toLog2((u256)d);
+	UInt256 const b = bound(_difficulty);
+	ret.requirement = b ? toLog2(b) : 256;
+
+	// evaluate a batch of consecutive nonces at a time; each input is (root, nonce) as in eval().
+	unsigned const c_batch = 8;
+	h256 in[c_batch][2];
+	bytesConstRef inputs[c_batch];
+	h256 e[c_batch];
+	for (unsigned i = 0; i < c_batch; ++i)
+	{
+		in[i][0] = _root;
+		inputs[i] = bytesConstRef(in[i][0].data(), 64);
+	}
+	UInt256 n(o_solution);
 
 	// 2^ 0      32      64      128      256
 	//   [--------*-------------------------]
 	//
 	// evaluate until we run out of time
-	for (auto startTime = steady_clock::now(); (steady_clock::now() - startTime) < milliseconds(_msTimeout) && _continue; o_solution += 1)
+	for (auto startTime = steady_clock::now(); (steady_clock::now() - startTime) < milliseconds(_msTimeout) && _continue && !ret.completed;)
 	{
-		auto e = (bigint)(u256)eval(_root, o_solution);
-		ret.best = max(ret.best, toLog2((u256)e));
-		if (e <= d)
+		for (unsigned i = 0; i < c_batch; ++i)
+			in[i][1] = (h256)(n + i);
+		sha3Batch(vector_ref<bytesConstRef const>(inputs, c_batch), vector_ref<h256>(e, c_batch));
+		for (unsigned i = 0; i < c_batch; ++i, ++n)
 		{
-			ret.completed = true;
-			break;
+			UInt256 v(e[i]);
+			ret.best = max(ret.best, toLog2(v));
+			if (within(v, b))
+			{
+				ret.completed = true;
+				break;
+			}
 		}
 	}
+	o_solution = (u256)n;
 
 	if (ret.completed)
 		assert(verify(_root, o_solution, _difficulty));
@@ -52,6 +72,16 @@ MineInfo Dagger::mine(u256& o_solution, h256 const& _root, u256 const& _difficul
 	return ret;
 }
 
+UInt256 Dagger::bound(u256 const& _difficulty)
+{
+	// 2^256 / d is (2^256 - 1) / d, plus one when d divides 2^256 exactly.
+	UInt256 d(_difficulty);
+	UInt256 q;
+	UInt256 r;
+	UInt256::divMod(~UInt256(), d, q, r);
+	return r == d - 1 ? q + 1 : q;
+}
+
 #else
 
 Dagger::Dagger()
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "Common.h"
+#include "UInt256.h"
 
 #define FAKE_DAGGER 1
 
@@ -12,6 +13,14 @@ inline uint toLog2(u256 _d)
 	return (uint)log2((double)_d);
 }
 
+inline uint toLog2(UInt256 const& _d)
+{
+	double d = 0;
+	for (unsigned i = 4; i-- > 0;)
+		d = d * 18446744073709551616.0 + _d.limb(i);
+	return (uint)log2(d);
+}
+
 struct MineInfo
 {
 	uint requirement;
@@ -25,9 +34,15 @@ class Dagger
 {
 public:
 	static h256 eval(h256 const& _root, u256 const& _nonce) { h256 b[2] = { _root, (h256)_nonce }; return sha3(bytesConstRef((byte const*)&b[0], 64)); }
-	static bool verify(h256 const& _root, u256 const& _nonce, u256 const& _difficulty) { return (bigint)(u256)eval(_root, _nonce) <= (bigint(1) << 256) / _difficulty; }
+	static bool verify(h256 const& _root, u256 const& _nonce, u256 const& _difficulty) { return within(UInt256(eval(_root, _nonce)), bound(_difficulty)); }
 
 	MineInfo mine(u256& o_solution, h256 const& _root, u256 const& _difficulty, uint _msTimeout = 100, bool const& _continue = bool(true));
+
+private:
+	/// @returns 2^256 / @a _difficulty, or zero if that is 2^256 itself. Works in 256 bits throughout.
+	static UInt256 bound(u256 const& _difficulty);
+	/// @returns true if @a _e is no greater than the bound @a _bound given by bound().
+	static bool within(UInt256 const& _e, UInt256 const& _bound) { return _e <= _bound || !_bound; }
 };
 
 #else
@@ -0,0 +1,362 @@
+/*
+	This file is part of cpp-ethereum.
+
+	cpp-ethereum is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	Foobar is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/** @file Keccak.cpp
+ * @date 2014
+ */
+
+#include "Keccak.h"
+
+// The four-lane code is only built where the compiler can target AVX2 per function; elsewhere all hashing is scalar.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define ETH_KECCAK_AVX2 1
+#include <immintrin.h>
+#define ETH_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define ETH_KECCAK_AVX2 0
+#endif
+
+using namespace std;
+using namespace eth;
+
+namespace
+{
+
+/// Bytes absorbed per permutation for a 256-bit output: 1600 - 2 * 256 bits.
+static const unsigned c_rate = 136;
+static const unsigned c_rateWords = c_rate / 8;
+
+static const uint64_t c_roundConstants[24] =
+{
+	0x0000000000000001ULL, 0x0000000000008082ULL, 0x800000000000808aULL, 0x8000000080008000ULL,
+	0x000000000000808bULL, 0x0000000080000001ULL, 0x8000000080008081ULL, 0x8000000000008009ULL,
+	0x000000000000008aULL, 0x0000000000000088ULL, 0x0000000080008009ULL, 0x000000008000000aULL,
+	0x000000008000808bULL, 0x800000000000008bULL, 0x8000000000008089ULL, 0x8000000000008003ULL,
+	0x8000000000008002ULL, 0x8000000000000080ULL, 0x000000000000800aULL, 0x800000008000000aULL,
+	0x8000000080008081ULL, 0x8000000000008080ULL, 0x0000000080000001ULL, 0x8000000080008008ULL
+};
+
+/// @a _n must be in [1, 63].
+inline uint64_t rotl(uint64_t _x, unsigned _n) { return (_x << _n) | (_x >> (64 - _n)); }
+
+/// Little-endian load, as Keccak orders the bytes within a lane.
+inline uint64_t load64(byte const* _p)
+{
+	uint64_t ret = 0;
+	for (unsigned i = 8; i--;)
+		ret = (ret << 8) | _p[i];
+	return ret;
+}
+
+inline void store64(byte* o_p, uint64_t _w)
+{
+	for (unsigned i = 0; i < 8; ++i, _w >>= 8)
+		o_p[i] = (byte)_w;
+}
+
+/// @returns the number of blocks absorbed for @a _size bytes of input; the last is always padded.
+inline size_t blockCount(size_t _size) { return _size / c_rate + 1; }
+
+/// @returns the rate-sized block @a _b of @a _in; the last is padded into @a o_buffer.
+byte const* block(bytesConstRef _in, size_t _b, byte* o_buffer)
+{
+	size_t offset = _b * c_rate;
+	if (offset + c_rate <= _in.size())
+		return _in.data() + offset;
+	size_t tail = _in.size() - offset;
+	memcpy(o_buffer, _in.data() + offset, tail);
+	memset(o_buffer + tail, 0, c_rate - tail);
+	o_buffer[tail] ^= 0x01;
+	o_buffer[c_rate - 1] ^= 0x80;
+	return o_buffer;
+}
+
+/// Keccak-f[1600], with each round unrolled.
+void keccakF1600(uint64_t* io_a)
+{
+	// The state lives in locals so that it stays in registers across the unrolled steps of each round.
+	uint64_t a0 = io_a[0], a1 = io_a[1], a2 = io_a[2], a3 = io_a[3], a4 = io_a[4];
+	uint64_t a5 = io_a[5], a6 = io_a[6], a7 = io_a[7], a8 = io_a[8], a9 = io_a[9];
+	uint64_t a10 = io_a[10], a11 = io_a[11], a12 = io_a[12], a13 = io_a[13], a14 = io_a[14];
+	uint64_t a15 = io_a[15], a16 = io_a[16], a17 = io_a[17], a18 = io_a[18], a19 = io_a[19];
+	uint64_t a20 = io_a[20], a21 = io_a[21], a22 = io_a[22], a23 = io_a[23], a24 = io_a[24];
+	for (unsigned round = 0; round < 24; ++round)
+	{
+		// theta
+		uint64_t c0 = a0 ^ a5 ^ a10 ^ a15 ^ a20;
+		uint64_t c1 = a1 ^ a6 ^ a11 ^ a16 ^ a21;
+		uint64_t c2 = a2 ^ a7 ^ a12 ^ a17 ^ a22;
+		uint64_t c3 = a3 ^ a8 ^ a13 ^ a18 ^ a23;
+		uint64_t c4 = a4 ^ a9 ^ a14 ^ a19 ^ a24;
+		uint64_t d0 = c4 ^ rotl(c1, 1);
+		uint64_t d1 = c0 ^ rotl(c2, 1);
+		uint64_t d2 = c1 ^ rotl(c3, 1);
+		uint64_t d3 = c2 ^ rotl(c4, 1);
+		uint64_t d4 = c3 ^ rotl(c0, 1);
+		// rho and pi
+		uint64_t b0 = a0 ^ d0;
+		uint64_t b1 = rotl(a6 ^ d1, 44);
+		uint64_t b2 = rotl(a12 ^ d2, 43);
+		uint64_t b3 = rotl(a18 ^ d3, 21);
+		uint64_t b4 = rotl(a24 ^ d4, 14);
+		uint64_t b5 = rotl(a3 ^ d3, 28);
+		uint64_t b6 = rotl(a9 ^ d4, 20);
+		uint64_t b7 = rotl(a10 ^ d0, 3);
+		uint64_t b8 = rotl(a16 ^ d1, 45);
+		uint64_t b9 = rotl(a22 ^ d2, 61);
+		uint64_t b10 = rotl(a1 ^ d1, 1);
+		uint64_t b11 = rotl(a7 ^ d2, 6);
+		uint64_t b12 = rotl(a13 ^ d3, 25);
+		uint64_t b13 = rotl(a19 ^ d4, 8);
+		uint64_t b14 = rotl(a20 ^ d0, 18);
+		uint64_t b15 = rotl(a4 ^ d4, 27);
+		uint64_t b16 = rotl(a5 ^ d0, 36);
+		uint64_t b17 = rotl(a11 ^ d1, 10);
+		uint64_t b18 = rotl(a17 ^ d2, 15);
+		uint64_t b19 = rotl(a23 ^ d3, 56);
+		uint64_t b20 = rotl(a2 ^ d2, 62);
+		uint64_t b21 = rotl(a8 ^ d3, 55);
+		uint64_t b22 = rotl(a14 ^ d4, 39);
+		uint64_t b23 = rotl(a15 ^ d0, 41);
+		uint64_t b24 = rotl(a21 ^ d1, 2);
+		// chi and iota
+		a0 = b0 ^ (~b1 & b2) ^ c_roundConstants[round];
+		a1 = b1 ^ (~b2 & b3);
+		a2 = b2 ^ (~b3 & b4);
+		a3 = b3 ^ (~b4 & b0);
+		a4 = b4 ^ (~b0 & b1);
+		a5 = b5 ^ (~b6 & b7);
+		a6 = b6 ^ (~b7 & b8);
+		a7 = b7 ^ (~b8 & b9);
+		a8 = b8 ^ (~b9 & b5);
+		a9 = b9 ^ (~b5 & b6);
+		a10 = b10 ^ (~b11 & b12);
+		a11 = b11 ^ (~b12 & b13);
+		a12 = b12 ^ (~b13 & b14);
+		a13 = b13 ^ (~b14 & b10);
+		a14 = b14 ^ (~b10 & b11);
+		a15 = b15 ^ (~b16 & b17);
+		a16 = b16 ^ (~b17 & b18);
+		a17 = b17 ^ (~b18 & b19);
+		a18 = b18 ^ (~b19 & b15);
+		a19 = b19 ^ (~b15 & b16);
+		a20 = b20 ^ (~b21 & b22);
+		a21 = b21 ^ (~b22 & b23);
+		a22 = b22 ^ (~b23 & b24);
+		a23 = b23 ^ (~b24 & b20);
+		a24 = b24 ^ (~b20 & b21);
+	}
+	io_a[0] = a0; io_a[1] = a1; io_a[2] = a2; io_a[3] = a3; io_a[4] = a4;
+	io_a[5] = a5; io_a[6] = a6; io_a[7] = a7; io_a[8] = a8; io_a[9] = a9;
+	io_a[10] = a10; io_a[11] = a11; io_a[12] = a12; io_a[13] = a13; io_a[14] = a14;
+	io_a[15] = a15; io_a[16] = a16; io_a[17] = a17; io_a[18] = a18; io_a[19] = a19;
+	io_a[20] = a20; io_a[21] = a21; io_a[22] = a22; io_a[23] = a23; io_a[24] = a24;
+}
+
+/// Pads and absorbs the final @a _size (< c_rate) bytes of input at @a _in into @a io_a, then writes the hash to @a o_out.
+/// Inlined into callers with a constant @a _size, the copy and padding reduce to a few word operations.
+inline void absorbLast(uint64_t* io_a, byte const* _in, size_t _size, byte* o_out)
+{
+	byte buffer[c_rate] = {};
+	memcpy(buffer, _in, _size);
+	buffer[_size] ^= 0x01;
+	buffer[c_rate - 1] ^= 0x80;
+	for (unsigned w = 0; w < c_rateWords; ++w)
+		io_a[w] ^= load64(buffer + w * 8);
+	keccakF1600(io_a);
+	for (unsigned w = 0; w < 4; ++w)
+		store64(o_out + w * 8, io_a[w]);
+}
+
+#if ETH_KECCAK_AVX2
+
+/// @a _n must be in [1, 63].
+ETH_TARGET_AVX2 inline __m256i rotl4(__m256i _x, int _n)
+{
+	return _mm256_or_si256(_mm256_slli_epi64(_x, _n), _mm256_srli_epi64(_x, 64 - _n));
+}
+
+/// Keccak-f[1600] on four states at once, unrolled as keccakF1600(); lane i of each vector belongs to state i.
+ETH_TARGET_AVX2 void keccakF1600x4(__m256i* io_a)
+{
+	__m256i a0 = io_a[0], a1 = io_a[1], a2 = io_a[2], a3 = io_a[3], a4 = io_a[4];
+	__m256i a5 = io_a[5], a6 = io_a[6], a7 = io_a[7], a8 = io_a[8], a9 = io_a[9];
+	__m256i a10 = io_a[10], a11 = io_a[11], a12 = io_a[12], a13 = io_a[13], a14 = io_a[14];
+	__m256i a15 = io_a[15], a16 = io_a[16], a17 = io_a[17], a18 = io_a[18], a19 = io_a[19];
+	__m256i a20 = io_a[20], a21 = io_a[21], a22 = io_a[22], a23 = io_a[23], a24 = io_a[24];
+	for (unsigned round = 0; round < 24; ++round)
+	{
+		// theta
+		__m256i c0 = _mm256_xor_si256(_mm256_xor_si256(_mm256_xor_si256(a0, a5), _mm256_xor_si256(a10, a15)), a20);
+		__m256i c1 = _mm256_xor_si256(_mm256_xor_si256(_mm256_xor_si256(a1, a6), _mm256_xor_si256(a11, a16)), a21);
+		__m256i c2 = _mm256_xor_si256(_mm256_xor_si256(_mm256_xor_si256(a2, a7), _mm256_xor_si256(a12, a17)), a22);
+		__m256i c3 = _mm256_xor_si256(_mm256_xor_si256(_mm256_xor_si256(a3, a8), _mm256_xor_si256(a13, a18)), a23);
+		__m256i c4 = _mm256_xor_si256(_mm256_xor_si256(_mm256_xor_si256(a4, a9), _mm256_xor_si256(a14, a19)), a24);
+		__m256i d0 = _mm256_xor_si256(c4, rotl4(c1, 1));
+		__m256i d1 = _mm256_xor_si256(c0, rotl4(c2, 1));
+		__m256i d2 = _mm256_xor_si256(c1, rotl4(c3, 1));
+		__m256i d3 = _mm256_xor_si256(c2, rotl4(c4, 1));
+		__m256i d4 = _mm256_xor_si256(c3, rotl4(c0, 1));
+		// rho and pi
+		__m256i b0 = _mm256_xor_si256(a0, d0);
+		__m256i b1 = rotl4(_mm256_xor_si256(a6, d1), 44);
+		__m256i b2 = rotl4(_mm256_xor_si256(a12, d2), 43);
+		__m256i b3 = rotl4(_mm256_xor_si256(a18, d3), 21);
+		__m256i b4 = rotl4(_mm256_xor_si256(a24, d4), 14);
+		__m256i b5 = rotl4(_mm256_xor_si256(a3, d3), 28);
+		__m256i b6 = rotl4(_mm256_xor_si256(a9, d4), 20);
+		__m256i b7 = rotl4(_mm256_xor_si256(a10, d0), 3);
+		__m256i b8 = rotl4(_mm256_xor_si256(a16, d1), 45);
+		__m256i b9 = rotl4(_mm256_xor_si256(a22, d2), 61);
+		__m256i b10 = rotl4(_mm256_xor_si256(a1, d1), 1);
+		__m256i b11 = rotl4(_mm256_xor_si256(a7, d2), 6);
+		__m256i b12 = rotl4(_mm256_xor_si256(a13, d3), 25);
+		__m256i b13 = rotl4(_mm256_xor_si256(a19, d4), 8);
+		__m256i b14 = rotl4(_mm256_xor_si256(a20, d0), 18);
+		__m256i b15 = rotl4(_mm256_xor_si256(a4, d4), 27);
+		__m256i b16 = rotl4(_mm256_xor_si256(a5, d0), 36);
+		__m256i b17 = rotl4(_mm256_xor_si256(a11, d1), 10);
+		__m256i b18 = rotl4(_mm256_xor_si256(a17, d2), 15);
+		__m256i b19 = rotl4(_mm256_xor_si256(a23, d3), 56);
+		__m256i b20 = rotl4(_mm256_xor_si256(a2, d2), 62);
+		__m256i b21 = rotl4(_mm256_xor_si256(a8, d3), 55);
+		__m256i b22 = rotl4(_mm256_xor_si256(a14, d4), 39);
+		__m256i b23 = rotl4(_mm256_xor_si256(a15, d0), 41);
+		__m256i b24 = rotl4(_mm256_xor_si256(a21, d1), 2);
+		// chi and iota
+		a0 = _mm256_xor_si256(_mm256_xor_si256(b0, _mm256_andnot_si256(b1, b2)), _mm256_set1_epi64x((long long)c_roundConstants[round]));
+		a1 = _mm256_xor_si256(b1, _mm256_andnot_si256(b2, b3));
+		a2 = _mm256_xor_si256(b2, _mm256_andnot_si256(b3, b4));
+		a3 = _mm256_xor_si256(b3, _mm256_andnot_si256(b4, b0));
+		a4 = _mm256_xor_si256(b4, _mm256_andnot_si256(b0, b1));
+		a5 = _mm256_xor_si256(b5, _mm256_andnot_si256(b6, b7));
+		a6 = _mm256_xor_si256(b6, _mm256_andnot_si256(b7, b8));
+		a7 = _mm256_xor_si256(b7, _mm256_andnot_si256(b8, b9));
+		a8 = _mm256_xor_si256(b8, _mm256_andnot_si256(b9, b5));
+		a9 = _mm256_xor_si256(b9, _mm256_andnot_si256(b5, b6));
+		a10 = _mm256_xor_si256(b10, _mm256_andnot_si256(b11, b12));
+		a11 = _mm256_xor_si256(b11, _mm256_andnot_si256(b12, b13));
+		a12 = _mm256_xor_si256(b12, _mm256_andnot_si256(b13, b14));
+		a13 = _mm256_xor_si256(b13, _mm256_andnot_si256(b14, b10));
+		a14 = _mm256_xor_si256(b14, _mm256_andnot_si256(b10, b11));
+		a15 = _mm256_xor_si256(b15, _mm256_andnot_si256(b16, b17));
+		a16 = _mm256_xor_si256(b16, _mm256_andnot_si256(b17, b18));
+		a17 = _mm256_xor_si256(b17, _mm256_andnot_si256(b18, b19));
+		a18 = _mm256_xor_si256(b18, _mm256_andnot_si256(b19, b15));
+		a19 = _mm256_xor_si256(b19, _mm256_andnot_si256(b15, b16));
+		a20 = _mm256_xor_si256(b20, _mm256_andnot_si256(b21, b22));
+		a21 = _mm256_xor_si256(b21, _mm256_andnot_si256(b22, b23));
+		a22 = _mm256_xor_si256(b22, _mm256_andnot_si256(b23, b24));
+		a23 = _mm256_xor_si256(b23, _mm256_andnot_si256(b24, b20));
+		a24 = _mm256_xor_si256(b24, _mm256_andnot_si256(b20, b21));
+	}
+	io_a[0] = a0; io_a[1] = a1; io_a[2] = a2; io_a[3] = a3; io_a[4] = a4;
+	io_a[5] = a5; io_a[6] = a6; io_a[7] = a7; io_a[8] = a8; io_a[9] = a9;
+	io_a[10] = a10; io_a[11] = a11; io_a[12] = a12; io_a[13] = a13; io_a[14] = a14;
+	io_a[15] = a15; io_a[16] = a16; io_a[17] = a17; io_a[18] = a18; io_a[19] = a19;
+	io_a[20] = a20; io_a[21] = a21; io_a[22] = a22; io_a[23] = a23; io_a[24] = a24;
+}
+
+/// Hashes four inputs side by side. Lanes whose input has run out keep permuting, unread, until the longest is done.
+ETH_TARGET_AVX2 void keccak256x4(bytesConstRef const* _in, h256* o_out)
+{
+	__m256i a[25];
+	for (auto& i: a)
+		i = _mm256_setzero_si256();
+	size_t n[4];
+	size_t most = 0;
+	for (unsigned l = 0; l < 4; ++l)
+		most = max(most, n[l] = blockCount(_in[l].size()));
+
+	byte buffers[4][c_rate];
+	static byte const c_unused[c_rate] = {};
+	for (size_t b = 0; b < most; ++b)
+	{
+		byte const* p[4];
+		for (unsigned l = 0; l < 4; ++l)
+			p[l] = b < n[l] ? block(_in[l], b, buffers[l]) : c_unused;
+		for (unsigned w = 0; w < c_rateWords; ++w)
+			a[w] = _mm256_xor_si256(a[w], _mm256_set_epi64x((long long)load64(p[3] + w * 8), (long long)load64(p[2] + w * 8), (long long)load64(p[1] + w * 8), (long long)load64(p[0] + w * 8)));
+		keccakF1600x4(a);
+
+		for (unsigned l = 0; l < 4; ++l)
+			if (b + 1 == n[l])
+			{
+				uint64_t lanes[4][4];
+				for (unsigned w = 0; w < 4; ++w)
+					_mm256_storeu_si256((__m256i*)lanes[w], a[w]);
+				for (unsigned w = 0; w < 4; ++w)
+					store64(o_out[l].data() + w * 8, lanes[w][l]);
+			}
+	}
+}
+
+bool haveAVX2()
+{
+	static bool const s_have = __builtin_cpu_supports("avx2");
+	return s_have;
+}
+
+#endif
+
+}
+
+unsigned eth::sha3BatchLanes()
+{
+#if ETH_KECCAK_AVX2
+	if (haveAVX2())
+		return 4;
+#endif
+	return 1;
+}
+
+void eth::sha3Batch(vector_ref<bytesConstRef const> _inputs, vector_ref<h256> o_outputs, bool _simd)
+{
+	assert(o_outputs.size() >= _inputs.size());
+	size_t i = 0;
+#if ETH_KECCAK_AVX2
+	if (_simd && haveAVX2())
+		for (; i + 4 <= _inputs.size(); i += 4)
+			keccak256x4(_inputs.data() + i, o_outputs.data() + i);
+#else
+	(void)_simd;
+#endif
+	for (; i < _inputs.size(); ++i)
+		keccak256(_inputs[i], o_outputs[i].data());
+}
+
+void eth::keccak256(bytesConstRef _input, byte* o_output)
+{
+	uint64_t a[25] = {};
+	byte const* p = _input.data();
+	size_t n = _input.size();
+
+	// Keys, hashes and Dagger's (root, nonce) pairs.
+	switch (n)
+	{
+	case 20: return absorbLast(a, p, 20, o_output);
+	case 32: return absorbLast(a, p, 32, o_output);
+	case 64: return absorbLast(a, p, 64, o_output);
+	}
+
+	for (; n >= c_rate; p += c_rate, n -= c_rate)
+	{
+		for (unsigned w = 0; w < c_rateWords; ++w)
+			a[w] ^= load64(p + w * 8);
+		keccakF1600(a);
+	}
+	absorbLast(a, p, n, o_output);
+}
@@ -0,0 +1,42 @@
+/*
+	This file is part of cpp-ethereum.
+
+	cpp-ethereum is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	Foobar is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/** @file Keccak.h
+ * @date 2014
+ *
+ * In-tree Keccak-256 (as used by sha3()), including a batched form that hashes several inputs side by side.
+ */
+
+#pragma once
+
+#include "Common.h"
+
+namespace eth
+{
+
+/// Computes the Keccak-256 hash of @a _input into the 32 bytes at @a o_output, without allocating. sha3() is implemented with this.
+void keccak256(bytesConstRef _input, byte* o_output);
+
+/// Computes the Keccak-256 hash of each of @a _inputs into the corresponding element of @a o_outputs (which must be no shorter).
+/// Same results as sha3(), but where the CPU supports AVX2 four inputs are absorbed at once, each in its own 64-bit lane.
+/// Inputs need not be of equal length, though runs of similar lengths make best use of the lanes.
+/// @param _simd If false, always use the portable scalar code.
+void sha3Batch(vector_ref<bytesConstRef const> _inputs, vector_ref<h256> o_outputs, bool _simd = true);
+
+/// @returns the number of inputs that sha3Batch() hashes at once on this machine.
+unsigned sha3BatchLanes();
+
+}
@@ -22,6 +22,7 @@
 #include "Common.h"
 #include "TrieCommon.h"
 #include "MemTrie.h"
+#include "WorkerPool.h"
 using namespace std;
 using namespace eth;
 
@@ -36,443 +37,458 @@ namespace eth
 #define APPEND_CHILD appendRaw
 /**/
 
-class MemTrieNode
-{
-public:
-	MemTrieNode() {}
-	virtual ~MemTrieNode() {}
-
-	virtual std::string const& at(bytesConstRef _key) const = 0;
-	virtual MemTrieNode* insert(bytesConstRef _key, std::string const& _value) = 0;
-	virtual MemTrieNode* remove(bytesConstRef _key) = 0;
-	void putRLP(RLPStream& _parentStream) const;
-
-#if ENABLE_DEBUG_PRINT
-	void debugPrint(std::string const& _indent = "") const { std::cerr << std::hex << hash256() << ":" << std::dec << std::endl; debugPrintBody(_indent); }
-#endif
-
-	/// 256-bit hash of the node - this is a SHA-3/256 hash of the RLP of the node.
-	h256 hash256() const { RLPStream s; makeRLP(s); return eth::sha3(s.out()); }
-	bytes rlp() const { RLPStream s; makeRLP(s); return s.out(); }
-	void mark() { m_hash256 = h256(); }
-
-protected:
-	virtual void makeRLP(RLPStream& _intoStream) const = 0;
-
-#if ENABLE_DEBUG_PRINT
-	virtual void debugPrintBody(std::string const& _indent = "") const = 0;
-#endif
-
-	static MemTrieNode* newBranch(bytesConstRef _k1, std::string const& _v1, bytesConstRef _k2, std::string const& _v2);
+enum class MemTrieKind: byte { Leaf, Infix, Branch };
 
-private:
-	mutable h256 m_hash256;
-};
-
-static const std::string c_nullString;
-
-class TrieExtNode: public MemTrieNode
+struct MemTrieNode
 {
-public:
-	TrieExtNode(bytesConstRef _bytes): m_ext(_bytes.begin(), _bytes.end()) {}
+	MemTrieKind kind;
+	/// Size of ref, or 0 if the node has changed since it was last encoded.
+	byte refSize;
+	/// What the parent holds for this node: its RLP if shorter than 32 bytes, otherwise its hash.
+	byte ref[32];
 
-	bytes m_ext;
+	bytesConstRef cached() const { return bytesConstRef(ref, refSize); }
 };
 
-class TrieBranchNode: public MemTrieNode
+/// Followed in memory by its key fragment, hex-prefix encoded (flagged as a leaf), and then its value.
+struct TrieLeafNode: MemTrieNode
 {
-public:
-	TrieBranchNode(std::string const& _value): m_value(_value)
-	{
-		memset(m_nodes.data(), 0, sizeof(MemTrieNode*) * 16);
-	}
-
-	TrieBranchNode(byte _i1, MemTrieNode* _n1, std::string const& _value = std::string()): m_value(_value)
-	{
-		memset(m_nodes.data(), 0, sizeof(MemTrieNode*) * 16);
-		m_nodes[_i1] = _n1;
-	}
-
-	TrieBranchNode(byte _i1, MemTrieNode* _n1, byte _i2, MemTrieNode* _n2)
-	{
-		memset(m_nodes.data(), 0, sizeof(MemTrieNode*) * 16);
-		m_nodes[_i1] = _n1;
-		m_nodes[_i2] = _n2;
-	}
-
-	virtual ~TrieBranchNode()
-	{
-		for (auto i: m_nodes)
-			delete i;
-	}
-
-#if ENABLE_DEBUG_PRINT
-	virtual void debugPrintBody(std::string const& _indent) const
-	{
-
-		if (m_value.size())
-			std::cerr << _indent << "@: " << m_value << std::endl;
-		for (auto i = 0; i < 16; ++i)
-			if (m_nodes[i])
-			{
-				std::cerr << _indent << std::hex << i << ": " << std::dec;
-				m_nodes[i]->debugPrint(_indent + "  ");
-			}
-	}
-#endif
-
-	virtual std::string const& at(bytesConstRef _key) const override;
-	virtual MemTrieNode* insert(bytesConstRef _key, std::string const& _value) override;
-	virtual MemTrieNode* remove(bytesConstRef _key) override;
-	virtual void makeRLP(RLPStream& _parentStream) const override;
-
-private:
-	/// @returns (byte)-1 when no active branches, 16 when multiple active and the index of the active branch otherwise.
-	byte activeBranch() const;
-
-	MemTrieNode* rejig();
-
-	std::array<MemTrieNode*, 16> m_nodes;
-	std::string m_value;
+	uint32_t hpSize;
+	uint32_t valueSize;
+
+	byte* hp() { return (byte*)(this + 1); }
+	bytesConstRef hpRef() const { return bytesConstRef((byte const*)(this + 1), hpSize); }
+	NibbleSlice ext() const { return keyOf(hpRef()); }
+	bytesConstRef value() const { return bytesConstRef((byte const*)(this + 1) + hpSize, valueSize); }
+	size_t size() const { return sizeof(TrieLeafNode) + hpSize + valueSize; }
 };
 
-class TrieLeafNode: public TrieExtNode
+/// Followed in memory by its key fragment, hex-prefix encoded.
+struct TrieInfixNode: MemTrieNode
 {
-public:
-	TrieLeafNode(bytesConstRef _key, std::string const& _value): TrieExtNode(_key), m_value(_value) {}
+	uint32_t hpSize;
+	MemTrieNode* next;
 
-#if ENABLE_DEBUG_PRINT
-	virtual void debugPrintBody(std::string const& _indent) const
-	{
-		assert(m_value.size());
-		std::cerr << _indent;
-		if (m_ext.size())
-			std::cerr << asHex(m_ext, 1) << ": ";
-		else
-			std::cerr << "@: ";
-		std::cerr << m_value << std::endl;
-	}
-#endif
-
-	virtual std::string const& at(bytesConstRef _key) const override { return contains(_key) ? m_value : c_nullString; }
-	virtual MemTrieNode* insert(bytesConstRef _key, std::string const& _value) override;
-	virtual MemTrieNode* remove(bytesConstRef _key) override;
-	virtual void makeRLP(RLPStream& _parentStream) const override;
-
-private:
-	bool contains(bytesConstRef _key) const { return _key.size() == m_ext.size() && !memcmp(_key.data(), m_ext.data(), _key.size()); }
-
-	std::string m_value;
+	byte* hp() { return (byte*)(this + 1); }
+	bytesConstRef hpRef() const { return bytesConstRef((byte const*)(this + 1), hpSize); }
+	NibbleSlice ext() const { return keyOf(hpRef()); }
+	size_t size() const { return sizeof(TrieInfixNode) + hpSize; }
 };
 
-class TrieInfixNode: public TrieExtNode
+struct TrieBranchNode: MemTrieNode
 {
-public:
-	TrieInfixNode(bytesConstRef _key, MemTrieNode* _next): TrieExtNode(_key), m_next(_next) {}
-	virtual ~TrieInfixNode() { delete m_next; }
-
-#if ENABLE_DEBUG_PRINT
-	virtual void debugPrintBody(std::string const& _indent) const
-	{
-		std::cerr << _indent << asHex(m_ext, 1) << ": ";
-		m_next->debugPrint(_indent + "  ");
-	}
-#endif
-
-	virtual std::string const& at(bytesConstRef _key) const override { assert(m_next); return contains(_key) ? m_next->at(_key.cropped(m_ext.size())) : c_nullString; }
-	virtual MemTrieNode* insert(bytesConstRef _key, std::string const& _value) override;
-	virtual MemTrieNode* remove(bytesConstRef _key) override;
-	virtual void makeRLP(RLPStream& _parentStream) const override;
-
-private:
-	bool contains(bytesConstRef _key) const { return _key.size() >= m_ext.size() && !memcmp(_key.data(), m_ext.data(), m_ext.size()); }
+	uint32_t valueSize;
+	byte* value;						///< Allocated separately; null if there's no value.
+	MemTrieNode* nodes[16];
 
-	MemTrieNode* m_next;
+	bytesConstRef valueRef() const { return bytesConstRef(value, valueSize); }
 };
 
-void MemTrieNode::putRLP(RLPStream& _parentStream) const
+namespace
 {
-	RLPStream s;
-	makeRLP(s);
-	if (s.out().size() < 32)
-		_parentStream.APPEND_CHILD(s.out());
-	else
-		_parentStream << eth::sha3(s.out());
-}
 
-void TrieBranchNode::makeRLP(RLPStream& _intoStream) const
+TrieLeafNode* newLeaf(Arena& _a, bytesConstRef _value, NibbleSlice _k1, unsigned _n1, NibbleSlice _k2 = NibbleSlice(), unsigned _n2 = 0)
 {
-	_intoStream.appendList(17);
-	for (auto i: m_nodes)
-		if (i)
-			i->putRLP(_intoStream);
-		else
-			_intoStream << "";
-	_intoStream << m_value;
+	uint32_t hs = hexPrefixSize(_n1 + _n2);
+	auto ret = (TrieLeafNode*)_a.allocate(sizeof(TrieLeafNode) + hs + _value.size());
+	ret->kind = MemTrieKind::Leaf;
+	ret->refSize = 0;
+	ret->hpSize = hs;
+	ret->valueSize = _value.size();
+	hexPrefixWrite(_k1, _n1, _k2, _n2, true, ret->hp());
+	memcpy(ret->hp() + hs, _value.data(), _value.size());
+	return ret;
 }
 
-void TrieLeafNode::makeRLP(RLPStream& _intoStream) const
+TrieInfixNode* newInfix(Arena& _a, MemTrieNode* _next, NibbleSlice _k1, unsigned _n1, NibbleSlice _k2 = NibbleSlice(), unsigned _n2 = 0)
 {
-	_intoStream.appendList(2) << hexPrefixEncode(m_ext, true) << m_value;
+	uint32_t hs = hexPrefixSize(_n1 + _n2);
+	auto ret = (TrieInfixNode*)_a.allocate(sizeof(TrieInfixNode) + hs);
+	ret->kind = MemTrieKind::Infix;
+	ret->refSize = 0;
+	ret->hpSize = hs;
+	ret->next = _next;
+	hexPrefixWrite(_k1, _n1, _k2, _n2, false, ret->hp());
+	return ret;
 }
 
-void TrieInfixNode::makeRLP(RLPStream& _intoStream) const
+TrieBranchNode* newBranch(Arena& _a)
 {
-	assert(m_next);
-	_intoStream.appendList(2);
-	_intoStream << hexPrefixEncode(m_ext, false);
-	m_next->putRLP(_intoStream);
+	auto ret = (TrieBranchNode*)_a.allocate(sizeof(TrieBranchNode));
+	memset(ret, 0, sizeof(TrieBranchNode));
+	ret->kind = MemTrieKind::Branch;
+	return ret;
 }
 
-MemTrieNode* MemTrieNode::newBranch(bytesConstRef _k1, std::string const& _v1, bytesConstRef _k2, std::string const& _v2)
+void setValue(Arena& _a, TrieBranchNode* _b, bytesConstRef _value)
 {
-	uint prefix = commonPrefix(_k1, _k2);
-
-	MemTrieNode* ret;
-	if (_k1.size() == prefix)
-		ret = new TrieBranchNode(_k2[prefix], new TrieLeafNode(_k2.cropped(prefix + 1), _v2), _v1);
-	else if (_k2.size() == prefix)
-		ret = new TrieBranchNode(_k1[prefix], new TrieLeafNode(_k1.cropped(prefix + 1), _v1), _v2);
-	else // both continue after split
-		ret = new TrieBranchNode(_k1[prefix], new TrieLeafNode(_k1.cropped(prefix + 1), _v1), _k2[prefix], new TrieLeafNode(_k2.cropped(prefix + 1), _v2));
-
-	if (prefix)
-		// have shared prefix - split.
-		ret = new TrieInfixNode(_k1.cropped(0, prefix), ret);
-
-	return ret;
+	_a.release(_b->value, _b->valueSize);
+	_b->value = _value.size() ? (byte*)_a.allocate(_value.size()) : nullptr;
+	_b->valueSize = _value.size();
+	if (_value.size())
+		memcpy(_b->value, _value.data(), _value.size());
 }
 
-std::string const& TrieBranchNode::at(bytesConstRef _key) const
+/// Gives back the memory of @a _n alone, not of its children.
+void release(Arena& _a, MemTrieNode* _n)
 {
-	if (_key.empty())
-		return m_value;
-	else if (m_nodes[_key[0]] != nullptr)
-		return m_nodes[_key[0]]->at(_key.cropped(1));
-	return c_nullString;
+	switch (_n->kind)
+	{
+	case MemTrieKind::Leaf: _a.release(_n, ((TrieLeafNode*)_n)->size()); break;
+	case MemTrieKind::Infix: _a.release(_n, ((TrieInfixNode*)_n)->size()); break;
+	case MemTrieKind::Branch:
+		setValue(_a, (TrieBranchNode*)_n, bytesConstRef());
+		_a.release(_n, sizeof(TrieBranchNode));
+		break;
+	}
 }
 
-MemTrieNode* TrieBranchNode::insert(bytesConstRef _key, std::string const& _value)
+/// @returns the node for two distinct keys and their values.
+MemTrieNode* newPair(Arena& _a, NibbleSlice _k1, bytesConstRef _v1, NibbleSlice _k2, bytesConstRef _v2)
 {
-	assert(_value.size());
-	mark();
-	if (_key.empty())
-		m_value = _value;
-	else
-		if (!m_nodes[_key[0]])
-			m_nodes[_key[0]] = new TrieLeafNode(_key.cropped(1), _value);
+	unsigned prefix = _k1.shared(_k2);
+	auto b = newBranch(_a);
+	for (auto const& i: { make_pair(_k1, _v1), make_pair(_k2, _v2) })
+		if (i.first.size() == prefix)
+			setValue(_a, b, i.second);
 		else
-			m_nodes[_key[0]] = m_nodes[_key[0]]->insert(_key.cropped(1), _value);
-	return this;
+			b->nodes[i.first[prefix]] = newLeaf(_a, i.second, i.first.mid(prefix + 1), i.first.size() - prefix - 1);
+	return prefix ? (MemTrieNode*)newInfix(_a, b, _k1, prefix) : b;
 }
 
-MemTrieNode* TrieBranchNode::remove(bytesConstRef _key)
+MemTrieNode* insert(Arena& _a, MemTrieNode* _n, NibbleSlice _k, bytesConstRef _v)
 {
-	if (_key.empty())
-		if (m_value.size())
+	if (!_n)
+		return newLeaf(_a, _v, _k, _k.size());
+	_n->refSize = 0;
+	switch (_n->kind)
+	{
+	case MemTrieKind::Leaf:
+	{
+		auto l = (TrieLeafNode*)_n;
+		MemTrieNode* ret;
+		if (l->ext() != _k)
+			ret = newPair(_a, _k, _v, l->ext(), l->value());
+		else if (l->valueSize == _v.size())
+		{
+			memcpy(l->hp() + l->hpSize, _v.data(), _v.size());
+			return l;
+		}
+		else
+			ret = newLeaf(_a, _v, _k, _k.size());
+		release(_a, l);
+		return ret;
+	}
+	case MemTrieKind::Infix:
+	{
+		auto x = (TrieInfixNode*)_n;
+		NibbleSlice e = x->ext();
+		unsigned prefix = e.shared(_k);
+		if (prefix == e.size())
 		{
-			m_value.clear();
-			return rejig();
+			x->next = insert(_a, x->next, _k.mid(prefix), _v);
+			return x;
 		}
-		else {}
-	else if (m_nodes[_key[0]] != nullptr)
+		// split with a branch where the keys part.
+		auto b = newBranch(_a);
+		b->nodes[e[prefix]] = prefix + 1 < e.size() ? newInfix(_a, x->next, e.mid(prefix + 1), e.size() - prefix - 1) : x->next;
+		MemTrieNode* ret = insert(_a, b, _k.mid(prefix), _v);
+		if (prefix)
+			ret = newInfix(_a, ret, e, prefix);
+		release(_a, x);
+		return ret;
+	}
+	case MemTrieKind::Branch:
 	{
-		m_nodes[_key[0]] = m_nodes[_key[0]]->remove(_key.cropped(1));
-		return rejig();
+		auto b = (TrieBranchNode*)_n;
+		if (!_k.size())
+			setValue(_a, b, _v);
+		else
+			b->nodes[_k[0]] = insert(_a, b->nodes[_k[0]], _k.mid(1), _v);
+		return b;
 	}
-	return this;
+	}
+	return _n;
 }
 
-MemTrieNode* TrieBranchNode::rejig()
+/// @returns the node with the nibbles @a _k1 followed by the key fragment of @a _n, which is not a branch.
+MemTrieNode* prefixed(Arena& _a, NibbleSlice _k1, MemTrieNode* _n)
 {
-	mark();
-	byte n = activeBranch();
-
-	if (n == (byte)-1 && m_value.size())
+	MemTrieNode* ret;
+	if (_n->kind == MemTrieKind::Leaf)
 	{
-		// switch to leaf
-		auto r = new TrieLeafNode(bytesConstRef(), m_value);
-		delete this;
-		return r;
+		auto l = (TrieLeafNode*)_n;
+		ret = newLeaf(_a, l->value(), _k1, _k1.size(), l->ext(), l->ext().size());
 	}
-	else if (n < 16 && m_value.empty())
+	else
 	{
-		// only branching to n...
-		if (auto b = dynamic_cast<TrieBranchNode*>(m_nodes[n]))
-		{
-			// switch to infix
-			m_nodes[n] = nullptr;
-			delete this;
-			return new TrieInfixNode(bytesConstRef(&n, 1), b);
-		}
-		else
-		{
-			auto x = dynamic_cast<TrieExtNode*>(m_nodes[n]);
-			assert(x);
-			// include in child
-			pushFront(x->m_ext, n);
-			m_nodes[n] = nullptr;
-			delete this;
-			return x;
-		}
+		auto x = (TrieInfixNode*)_n;
+		ret = newInfix(_a, x->next, _k1, _k1.size(), x->ext(), x->ext().size());
 	}
-
-	return this;
+	release(_a, _n);
+	return ret;
 }
 
-byte TrieBranchNode::activeBranch() const
+/// Restores the trie's invariants at a branch after a removal beneath it.
+MemTrieNode* rejig(Arena& _a, TrieBranchNode* _b)
 {
-	byte n = (byte)-1;
-	for (int i = 0; i < 16; ++i)
-		if (m_nodes[i] != nullptr)
+	unsigned active = 0;
+	byte n = 0;
+	for (byte i = 0; i < 16; ++i)
+		if (_b->nodes[i])
 		{
-			if (n == (byte)-1)
-				n = (byte)i;
-			else
-				return 16;
+			++active;
+			n = i;
 		}
-	return n;
+
+	MemTrieNode* ret = _b;
+	if (!active)
+		// switch to leaf (or nothing)
+		ret = _b->value ? newLeaf(_a, _b->valueRef(), NibbleSlice(), 0) : nullptr;
+	else if (active == 1 && !_b->value)
+	{
+		// only branching to n...
+		NibbleSlice ns(bytesConstRef(&n, 1), 1);
+		MemTrieNode* c = _b->nodes[n];
+		ret = c->kind == MemTrieKind::Branch ? newInfix(_a, c, ns, 1) : prefixed(_a, ns, c);
+	}
+	if (ret != _b)
+		release(_a, _b);
+	return ret;
 }
 
-MemTrieNode* TrieInfixNode::insert(bytesConstRef _key, std::string const& _value)
+MemTrieNode* remove(Arena& _a, MemTrieNode* _n, NibbleSlice _k);
+
+/// Removes @a _k from beneath @a io_child, a child of @a _parent, marking @a _parent changed if it might be.
+/// @returns false if nothing changed. A node is only encoded once its children are, so a child which
+/// is unmoved and still encoded has not changed.
+bool removeFrom(Arena& _a, MemTrieNode* _parent, MemTrieNode*& io_child, NibbleSlice _k)
 {
-	assert(_value.size());
-	mark();
-	if (contains(_key))
+	MemTrieNode* c = remove(_a, io_child, _k);
+	if (c == io_child && c && c->refSize)
+		return false;
+	io_child = c;
+	_parent->refSize = 0;
+	return true;
+}
+
+MemTrieNode* remove(Arena& _a, MemTrieNode* _n, NibbleSlice _k)
+{
+	if (!_n)
+		return nullptr;
+	switch (_n->kind)
 	{
-		m_next = m_next->insert(_key.cropped(m_ext.size()), _value);
-		return this;
-	}
-	else
+	case MemTrieKind::Leaf:
+		if (((TrieLeafNode*)_n)->ext() != _k)
+			return _n;
+		release(_a, _n);
+		return nullptr;
+	case MemTrieKind::Infix:
 	{
-		uint prefix = commonPrefix(_key, m_ext);
-		if (prefix)
+		auto x = (TrieInfixNode*)_n;
+		NibbleSlice e = x->ext();
+		if (!_k.contains(e))
+			return x;
+		if (!removeFrom(_a, x, x->next, _k.mid(e.size())))
+			return x;
+		if (!x->next)
 		{
-			// one infix becomes two infixes, then insert into the second
-			// instead of pop_front()...
-			trimFront(m_ext, prefix);
-
-			return new TrieInfixNode(_key.cropped(0, prefix), insert(_key.cropped(prefix), _value));
+			release(_a, x);
+			return nullptr;
 		}
-		else
+		if (x->next->kind == MemTrieKind::Branch)
+			return x;
+		// merge with child...
+		MemTrieNode* ret = prefixed(_a, e, x->next);
+		release(_a, x);
+		return ret;
+	}
+	case MemTrieKind::Branch:
+	{
+		auto b = (TrieBranchNode*)_n;
+		if (!_k.size())
 		{
-			// split here.
-			auto f = m_ext[0];
-			trimFront(m_ext, 1);
-			MemTrieNode* n = m_ext.empty() ? m_next : this;
-			if (n != this)
-			{
-				m_next = nullptr;
-				delete this;
-			}
-			TrieBranchNode* ret = new TrieBranchNode(f, n);
-			ret->insert(_key, _value);
-			return ret;
+			if (!b->value)
+				return b;
+			setValue(_a, b, bytesConstRef());
+			b->refSize = 0;
 		}
+		else if (!b->nodes[_k[0]] || !removeFrom(_a, b, b->nodes[_k[0]], _k.mid(1)))
+			return b;
+		return rejig(_a, b);
+	}
 	}
+	return _n;
 }
 
-MemTrieNode* TrieInfixNode::remove(bytesConstRef _key)
+void makeRLP(MemTrieNode* _n, RLPStream& _intoStream, WorkerPool* _pool);
+
+/// Brings @a _n's ref up to date, encoding whatever beneath it has changed.
+void encode(MemTrieNode* _n, WorkerPool* _pool = nullptr)
 {
-	if (contains(_key))
+	if (_n->refSize)
+		return;
+	RLPStream s;
+	makeRLP(_n, s, _pool);
+	if (s.out().size() < 32)
+		memcpy(_n->ref, s.out().data(), _n->refSize = s.out().size());
+	else
 	{
-		mark();
-		m_next = m_next->remove(_key.cropped(m_ext.size()));
-		if (auto p = dynamic_cast<TrieExtNode*>(m_next))
-		{
-			// merge with child...
-			m_ext.reserve(m_ext.size() + p->m_ext.size());
-			for (auto i: p->m_ext)
-				m_ext.push_back(i);
-			p->m_ext = m_ext;
-			p->mark();
-			m_next = nullptr;
-			delete this;
-			return p;
-		}
-		if (!m_next)
-		{
-			delete this;
-			return nullptr;
-		}
+		eth::sha3(&s.out(), bytesRef(_n->ref, 32));
+		_n->refSize = 32;
 	}
-	return this;
 }
 
-MemTrieNode* TrieLeafNode::insert(bytesConstRef _key, std::string const& _value)
+void putRLP(MemTrieNode* _n, RLPStream& _parentStream, WorkerPool* _pool = nullptr)
+{
+	encode(_n, _pool);
+	if (_n->refSize < 32)
+		_parentStream.APPEND_CHILD(_n->cached());
+	else
+		_parentStream << _n->cached();
+}
+
+/// If @a _pool is given, the changed subtrees of the topmost branch are encoded across it.
+void makeRLP(MemTrieNode* _n, RLPStream& _intoStream, WorkerPool* _pool)
 {
-	assert(_value.size());
-	mark();
-	if (contains(_key))
+	switch (_n->kind)
+	{
+	case MemTrieKind::Leaf:
 	{
-		m_value = _value;
-		return this;
+		auto l = (TrieLeafNode const*)_n;
+		_intoStream.appendList(2) << l->hpRef() << l->value();
+		break;
 	}
-	else
+	case MemTrieKind::Infix:
+	{
+		auto x = (TrieInfixNode const*)_n;
+		_intoStream.appendList(2) << x->hpRef();
+		putRLP(x->next, _intoStream, _pool);
+		break;
+	}
+	case MemTrieKind::Branch:
 	{
-		// create new trie.
-		auto n = MemTrieNode::newBranch(_key, _value, bytesConstRef(&m_ext), m_value);
-		delete this;
-		return n;
+		auto b = (TrieBranchNode const*)_n;
+		_intoStream.appendList(17);
+		if (_pool)
+		{
+			// the subtrees are independent: bring each up to date on its own.
+			unsigned changed = 0;
+			for (auto i: b->nodes)
+				changed += i && !i->refSize;
+			if (changed > 1)
+				_pool->run(16, [&](unsigned i)
+				{
+					if (b->nodes[i])
+						encode(b->nodes[i]);
+				});
+		}
+		for (auto i: b->nodes)
+			if (i)
+				putRLP(i, _intoStream);
+			else
+				_intoStream << "";
+		_intoStream << b->valueRef();
+		break;
+	}
 	}
 }
 
-MemTrieNode* TrieLeafNode::remove(bytesConstRef _key)
+#if ENABLE_DEBUG_PRINT
+void debugPrint(MemTrieNode* _n, std::string const& _indent)
 {
-	if (contains(_key))
+	encode(_n);
+	std::cerr << asHex(_n->cached().toBytes()) << ":" << std::endl;
+	switch (_n->kind)
 	{
-		delete this;
-		return nullptr;
+	case MemTrieKind::Leaf:
+		std::cerr << _indent << ((TrieLeafNode const*)_n)->ext() << ": " << ((TrieLeafNode const*)_n)->value().toString() << std::endl;
+		break;
+	case MemTrieKind::Infix:
+		std::cerr << _indent << ((TrieInfixNode const*)_n)->ext() << ": ";
+		debugPrint(((TrieInfixNode const*)_n)->next, _indent + "  ");
+		break;
+	case MemTrieKind::Branch:
+		if (((TrieBranchNode const*)_n)->value)
+			std::cerr << _indent << "@: " << ((TrieBranchNode const*)_n)->valueRef().toString() << std::endl;
+		for (auto i = 0; i < 16; ++i)
+			if (auto c = ((TrieBranchNode const*)_n)->nodes[i])
+			{
+				std::cerr << _indent << std::hex << i << ": " << std::dec;
+				debugPrint(c, _indent + "  ");
+			}
+		break;
 	}
-	return this;
 }
+#endif
 
-MemTrie::~MemTrie()
-{
-	delete m_root;
 }
 
-h256 MemTrie::hash256() const
+h256 MemTrie::hash256(WorkerPool* _pool) const
 {
-	return m_root ? m_root->hash256() : h256();
+	if (!m_root)
+		return h256();
+	encode(m_root, _pool);
+	return m_root->refSize < 32 ? eth::sha3(m_root->cached()) : h256(m_root->ref);
 }
 
 bytes MemTrie::rlp() const
 {
-	return m_root ? m_root->rlp() : bytes();
+	if (!m_root)
+		return bytes();
+	RLPStream s;
+	makeRLP(m_root, s, nullptr);
+	return s.out();
 }
 
 void MemTrie::debugPrint()
 {
 #if ENABLE_DEBUG_PRINT
 	if (m_root)
-		m_root->debugPrint();
+		eth::debugPrint(m_root, "");
 #endif
 }
 
-std::string const& MemTrie::at(std::string const& _key) const
+std::string MemTrie::at(std::string const& _key) const
 {
-	if (!m_root)
-		return c_nullString;
-	auto h = toHex(_key);
-	return m_root->at(bytesConstRef(&h));
+	NibbleSlice k{bytesConstRef(_key)};
+	for (MemTrieNode const* n = m_root; n;)
+		switch (n->kind)
+		{
+		case MemTrieKind::Leaf:
+			return ((TrieLeafNode const*)n)->ext() == k ? ((TrieLeafNode const*)n)->value().toString() : std::string();
+		case MemTrieKind::Infix:
+		{
+			auto x = (TrieInfixNode const*)n;
+			if (!k.contains(x->ext()))
+				return std::string();
+			k = k.mid(x->ext().size());
+			n = x->next;
+			break;
+		}
+		case MemTrieKind::Branch:
+		{
+			auto b = (TrieBranchNode const*)n;
+			if (!k.size())
+				return b->valueRef().toString();
+			n = b->nodes[k[0]];
+			k = k.mid(1);
+			break;
+		}
+		}
+	return std::string();
 }
 
 void MemTrie::insert(std::string const& _key, std::string const& _value)
 {
 	if (_value.empty())
-		remove(_key);
-	auto h = toHex(_key);
-	m_root = m_root ? m_root->insert(&h, _value) : new TrieLeafNode(bytesConstRef(&h), _value);
+		return remove(_key);
+	m_root = eth::insert(m_arena, m_root, NibbleSlice(bytesConstRef(_key)), bytesConstRef(_value));
 }
 
 void MemTrie::remove(std::string const& _key)
 {
-	if (m_root)
-	{
-		auto h = toHex(_key);
-		m_root = m_root->remove(&h);
-	}
+	m_root = eth::remove(m_arena, m_root, NibbleSlice(bytesConstRef(_key)));
 }
 
 }
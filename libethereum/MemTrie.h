@@ -22,32 +22,49 @@
 #pragma once
 
 #include "Common.h"
+#include "Arena.h"
 
 namespace eth
 {
 
-class MemTrieNode;
+struct MemTrieNode;
+class WorkerPool;
 
 /**
  * @brief Merkle Patricia Tree "Trie": a modifed base-16 Radix tree.
+ * Nodes are plain structs packed with their (hex-prefix encoded) key fragments and values, allocated from an arena
+ * owned by the trie; it's all freed in one go.
+ * Each node keeps its encoding (or hash) until a change beneath it, so rehashing after a few edits costs
+ * only the paths they touched.
  */
 class MemTrie
 {
 public:
-	MemTrie(): m_root(nullptr) {}
-	~MemTrie();
+	MemTrie() {}
+	~MemTrie() {}
 
-	h256 hash256() const;
+	MemTrie(MemTrie const&) = delete;
+	MemTrie& operator=(MemTrie const&) = delete;
+
+	/// If @a _pool is given, the subtrees of the topmost branch are hashed across it.
+	h256 hash256(WorkerPool* _pool = nullptr) const;
 	bytes rlp() const;
 
 	void debugPrint();
 
-	std::string const& at(std::string const& _key) const;
+	std::string at(std::string const& _key) const;
 	void insert(std::string const& _key, std::string const& _value);
 	void remove(std::string const& _key);
 
+	/// Removes everything, without visiting the nodes.
+	void clear() { m_arena.clear(); m_root = nullptr; }
+
+	/// Bytes taken from the system for the nodes.
+	size_t memoryUsed() const { return m_arena.reserved(); }
+
 private:
-	MemTrieNode* m_root;
+	Arena m_arena;
+	MemTrieNode* m_root = nullptr;
 };
 
 }
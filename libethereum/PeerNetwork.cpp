@@ -78,15 +78,16 @@ bool PeerSession::interpret(RLP const& _r)
 {
 	if (m_server->m_verbosity >= 8)
 		cout << ">>> " << _r << endl;
-	switch (_r[0].toInt<unsigned>())
+	RLPIndex r = _r.index();
+	switch (r[0].toInt<unsigned>())
 	{
 	case Hello:
 	{
-		m_protocolVersion = _r[1].toInt<uint>();
-		m_networkId = _r[2].toInt<uint>();
-		auto clientVersion = _r[3].toString();
-		m_caps = _r.itemCount() > 4 ? _r[4].toInt<uint>() : 0x07;
-		m_listenPort = _r.itemCount() > 5 ? _r[5].toInt<short>() : 0;
+		m_protocolVersion = r[1].toInt<uint>();
+		m_networkId = r[2].toInt<uint>();
+		auto clientVersion = r[3].toString();
+		m_caps = r.itemCount() > 4 ? r[4].toInt<uint>() : 0x07;
+		m_listenPort = r.itemCount() > 5 ? r[5].toInt<short>() : 0;
 
 		if (m_server->m_verbosity >= 2)
 			cout << std::setw(2) << m_socket.native_handle() << " | Hello: " << clientVersion << " " << showbase << hex << m_caps << dec << " " << m_listenPort << endl;
@@ -164,10 +165,10 @@ bool PeerSession::interpret(RLP const& _r)
 	}
 	case Peers:
 		if (m_server->m_verbosity >= 2)
-			cout << std::setw(2) << m_socket.native_handle() << " | Peers (" << dec << (_r.itemCount() - 1) << " entries)" << endl;
-		for (unsigned i = 1; i < _r.itemCount(); ++i)
+			cout << std::setw(2) << m_socket.native_handle() << " | Peers (" << dec << (r.itemCount() - 1) << " entries)" << endl;
+		for (unsigned i = 1; i < r.itemCount(); ++i)
 		{
-			auto ep = bi::tcp::endpoint(bi::address_v4(_r[i][0].toArray<byte, 4>()), _r[i][1].toInt<short>());
+			auto ep = bi::tcp::endpoint(bi::address_v4(r[i][0].toArray<byte, 4>()), r[i][1].toInt<short>());
 			if (m_server->m_verbosity >= 6)
 				cout << "Checking: " << ep << endl;
 			// check that we're not already connected to addr:
@@ -197,44 +198,19 @@ bool PeerSession::interpret(RLP const& _r)
 		if (m_server->m_mode == NodeMode::PeerServer)
 			break;
 		if (m_server->m_verbosity >= 2)
-			cout << std::setw(2) << m_socket.native_handle() << " | Transactions (" << dec << (_r.itemCount() - 1) << " entries)" << endl;
-		m_rating += _r.itemCount() - 1;
-		for (unsigned i = 1; i < _r.itemCount(); ++i)
+			cout << std::setw(2) << m_socket.native_handle() << " | Transactions (" << dec << (r.itemCount() - 1) << " entries)" << endl;
+		m_rating += r.itemCount() - 1;
+		for (unsigned i = 1; i < r.itemCount(); ++i)
 		{
-			m_server->m_incomingTransactions.push_back(_r[i].data().toBytes());
-			m_knownTransactions.insert(sha3(_r[i].data()));
+			m_server->m_incomingTransactions.push_back(r[i].data().toBytes());
+			m_knownTransactions.insert(sha3(r[i].data()));
 		}
 		break;
 	case Blocks:
-		if (m_server->m_mode == NodeMode::PeerServer)
-			break;
-		if (m_server->m_verbosity >= 2)
-			cout << std::setw(2) << m_socket.native_handle() << " | Blocks (" << dec << (_r.itemCount() - 1) << " entries)" << endl;
-		m_rating += _r.itemCount() - 1;
-		for (unsigned i = 1; i < _r.itemCount(); ++i)
-		{
-			m_server->m_incomingBlocks.push_back(_r[i].data().toBytes());
-			m_knownBlocks.insert(sha3(_r[i].data()));
-		}
-		if (m_server->m_verbosity >= 3)
-			for (unsigned i = 1; i < _r.itemCount(); ++i)
-			{
-				auto h = sha3(_r[i].data());
-				BlockInfo bi(_r[i].data());
-				if (!m_server->m_chain->details(bi.parentHash) && !m_knownBlocks.count(bi.parentHash))
-					cerr << "*** Unknown parent " << bi.parentHash << " of block " << h << endl;
-				else
-					cerr << "--- Known parent " << bi.parentHash << " of block " << h << endl;
-			}
-		if (_r.itemCount() > 1)	// we received some - check if there's any more
-		{
-			RLPStream s;
-			prep(s).appendList(3);
-			s << (uint)GetChain;
-			s << sha3(_r[1].data());
-			s << c_maxBlocksAsk;
-			sealAndSend(s);
-		}
+		// Large Blocks packets come to noteBlock() a block at a time as they arrive (see doRead()); this is the rest.
+		for (unsigned i = 1; i < r.itemCount(); ++i)
+			noteBlock(r[i]);
+		noteBlocksEnd();
 		break;
 	case GetChain:
 	{
@@ -243,15 +219,15 @@ bool PeerSession::interpret(RLP const& _r)
 		// ********************************************************************
 		// NEEDS FULL REWRITE!
 		h256s parents;
-		parents.reserve(_r.itemCount() - 2);
-		for (unsigned i = 1; i < _r.itemCount() - 1; ++i)
-			parents.push_back(_r[i].toHash<h256>());
+		parents.reserve(r.itemCount() - 2);
+		for (unsigned i = 1; i < r.itemCount() - 1; ++i)
+			parents.push_back(r[i].toHash<h256>());
 		if (m_server->m_verbosity >= 2)
-			cout << std::setw(2) << m_socket.native_handle() << " | GetChain (" << (_r.itemCount() - 2) << " hashes, " << (_r[_r.itemCount() - 1].toInt<bigint>()) << ")" << endl;
-		if (_r.itemCount() == 2)
+			cout << std::setw(2) << m_socket.native_handle() << " | GetChain (" << (r.itemCount() - 2) << " hashes, " << (r[r.itemCount() - 1].toInt<bigint>()) << ")" << endl;
+		if (r.itemCount() == 2)
 			break;
 		// return 2048 block max.
-		uint baseCount = (uint)min<bigint>(_r[_r.itemCount() - 1].toInt<bigint>(), c_maxBlocks);
+		uint baseCount = (uint)min<bigint>(r[r.itemCount() - 1].toInt<bigint>(), c_maxBlocks);
 		if (m_server->m_verbosity >= 2)
 			cout << std::setw(2) << m_socket.native_handle() << " | GetChain (" << baseCount << " max, from " << parents.front() << " to " << parents.back() << ")" << endl;
 		for (auto parent: parents)
@@ -319,7 +295,7 @@ bool PeerSession::interpret(RLP const& _r)
 	{
 		if (m_server->m_mode == NodeMode::PeerServer)
 			break;
-		h256 noGood = _r[1].toHash<h256>();
+		h256 noGood = r[1].toHash<h256>();
 		if (m_server->m_verbosity >= 2)
 			cout << std::setw(2) << m_socket.native_handle() << " | NotInChain (" << noGood << ")" << endl;
 		if (noGood == m_server->m_chain->genesisHash())
@@ -355,6 +331,44 @@ bool PeerSession::interpret(RLP const& _r)
 	return true;
 }
 
+void PeerSession::noteBlock(RLP const& _block)
+{
+	if (m_server->m_mode == NodeMode::PeerServer)
+		return;
+	auto h = sha3(_block.data());
+	if (!m_blocksIn++)
+		m_firstBlockIn = h;
+	++m_rating;
+	m_server->m_incomingBlocks.push_back(_block.data().toBytes());
+	m_knownBlocks.insert(h);
+	if (m_server->m_verbosity >= 3)
+	{
+		BlockInfo bi(_block.data());
+		if (!m_server->m_chain->details(bi.parentHash) && !m_knownBlocks.count(bi.parentHash))
+			cerr << "*** Unknown parent " << bi.parentHash << " of block " << h << endl;
+		else
+			cerr << "--- Known parent " << bi.parentHash << " of block " << h << endl;
+	}
+}
+
+void PeerSession::noteBlocksEnd()
+{
+	if (m_server->m_mode == NodeMode::PeerServer)
+		return;
+	if (m_server->m_verbosity >= 2)
+		cout << std::setw(2) << m_socket.native_handle() << " | Blocks (" << dec << m_blocksIn << " entries)" << endl;
+	if (m_blocksIn)	// we received some - check if there's any more
+	{
+		RLPStream s;
+		prep(s).appendList(3);
+		s << (uint)GetChain;
+		s << m_firstBlockIn;
+		s << c_maxBlocksAsk;
+		sealAndSend(s);
+	}
+	m_blocksIn = 0;
+}
+
 void PeerSession::ping()
 {
 	RLPStream s;
@@ -367,53 +381,56 @@ RLPStream& PeerSession::prep(RLPStream& _s)
 	return _s.appendRaw(bytes(8, 0));
 }
 
-void PeerServer::seal(bytes& _b)
+SealedPacket PeerServer::seal(RLPStream& _s)
 {
+	auto ret = std::make_shared<bytes>();
+	bytes& b = *ret;
+	_s.swapOut(b);
 	if (m_verbosity >= 9)
-		cout << "<<< " << RLP(bytesConstRef(&_b).cropped(8)) << endl;
-	_b[0] = 0x22;
-	_b[1] = 0x40;
-	_b[2] = 0x08;
-	_b[3] = 0x91;
-	uint32_t len = _b.size() - 8;
-	_b[4] = (len >> 24) & 0xff;
-	_b[5] = (len >> 16) & 0xff;
-	_b[6] = (len >> 8) & 0xff;
-	_b[7] = len & 0xff;
+		cout << "<<< " << RLP(bytesConstRef(&b).cropped(8)) << endl;
+	b[0] = 0x22;
+	b[1] = 0x40;
+	b[2] = 0x08;
+	b[3] = 0x91;
+	uint32_t len = b.size() - 8;
+	b[4] = (len >> 24) & 0xff;
+	b[5] = (len >> 16) & 0xff;
+	b[6] = (len >> 8) & 0xff;
+	b[7] = len & 0xff;
+	return ret;
 }
 
 void PeerSession::sealAndSend(RLPStream& _s)
 {
-	bytes b;
-	_s.swapOut(b);
-	m_server->seal(b);
-	sendDestroy(b);
+	send(m_server->seal(_s));
 }
 
-void PeerSession::sendDestroy(bytes& _msg)
+void PeerSession::send(SealedPacket const& _p)
 {
-	std::shared_ptr<bytes> buffer = std::make_shared<bytes>();
-	swap(*buffer, _msg);
-	assert((*buffer)[0] == 0x22);
-//	cout << "Sending " << (buffer->size() - 8) << endl;
-//	cout << "Sending " << RLP(bytesConstRef(buffer.get()).cropped(8)) << endl;
-	ba::async_write(m_socket, ba::buffer(*buffer), [=](boost::system::error_code ec, std::size_t length)
-	{
-		if (ec)
-			dropped();
-//		cout << length << " bytes written (EC: " << ec << ")" << endl;
-	});
+	assert((*_p)[0] == 0x22);
+//	cout << "Sending " << (_p->size() - 8) << endl;
+//	cout << "Sending " << RLP(bytesConstRef(_p.get()).cropped(8)) << endl;
+	m_writeQueue.push_back(_p);
+	if (m_writing.empty())
+		doWrite();
 }
 
-void PeerSession::send(bytesConstRef _msg)
+void PeerSession::doWrite()
 {
-	std::shared_ptr<bytes> buffer = std::make_shared<bytes>(_msg.toBytes());
-	assert((*buffer)[0] == 0x22);
-//	cout << "Sending " << (_msg.size() - 8) << endl;// RLP(bytesConstRef(buffer.get()).cropped(8)) << endl;
-	ba::async_write(m_socket, ba::buffer(*buffer), [=](boost::system::error_code ec, std::size_t length)
+	// Gather everything queued into one write; the packets stay alive in m_writing until it completes.
+	swap(m_writing, m_writeQueue);
+	vector<ba::const_buffer> buffers;
+	buffers.reserve(m_writing.size());
+	for (auto const& p: m_writing)
+		buffers.push_back(ba::buffer(*p));
+	auto self(shared_from_this());
+	ba::async_write(m_socket, buffers, [this, self](boost::system::error_code ec, std::size_t length)
 	{
+		m_writing.clear();
 		if (ec)
 			dropped();
+		else if (m_writeQueue.size())
+			doWrite();
 //		cout << length << " bytes written (EC: " << ec << ")" << endl;
 	});
 }
@@ -481,7 +498,8 @@ void PeerSession::start()
 void PeerSession::doRead()
 {
 	auto self(shared_from_this());
-	m_socket.async_read_some(boost::asio::buffer(m_data), [this, self](boost::system::error_code ec, std::size_t length)
+	bytesRef w = m_framer.writable();
+	m_socket.async_read_some(boost::asio::buffer(w.data(), w.size()), [this, self](boost::system::error_code ec, std::size_t length)
 	{
 		if (ec)
 			dropped();
@@ -489,32 +507,22 @@ void PeerSession::doRead()
 		{
 			try
 			{
-				m_incoming.resize(m_incoming.size() + length);
-				memcpy(m_incoming.data() + m_incoming.size() - length, m_data.data(), length);
-				while (m_incoming.size() > 8)
+				m_framer.received(length);
+				size_t skipped = m_framer.skipped();
+				PacketFramer::Piece piece;
+				for (bytesConstRef payload; m_framer.next(payload, piece);)
 				{
-					if (m_incoming[0] != 0x22 || m_incoming[1] != 0x40 || m_incoming[2] != 0x08 || m_incoming[3] != 0x91)
-					{
-						if (m_server->m_verbosity)
-							cerr << std::setw(2) << m_socket.native_handle() << " | Out of alignment. Skipping: " << hex << showbase << (int)m_incoming[0] << dec << endl;
-						memmove(m_incoming.data(), m_incoming.data() + 1, m_incoming.size() - 1);
-						m_incoming.resize(m_incoming.size() - 1);
-					}
-					else
-					{
-						uint32_t len = fromBigEndian<uint32_t>(bytesConstRef(m_incoming.data() + 4, 4));
-	//					cout << "Received packet of " << len << " bytes" << endl;
-						if (m_incoming.size() - 8 < len)
-							break;
-
-						// enough has come in.
-						RLP r(bytesConstRef(m_incoming.data() + 8, len));
-						if (!interpret(r))
-							// error
-							break;
-						memmove(m_incoming.data(), m_incoming.data() + len + 8, m_incoming.size() - (len + 8));
-						m_incoming.resize(m_incoming.size() - (len + 8));
-					}
+					if (m_framer.skipped() != skipped && m_server->m_verbosity)
+						cerr << std::setw(2) << m_socket.native_handle() << " | Out of alignment. Skipped " << (m_framer.skipped() - skipped) << " bytes." << endl;
+					skipped = m_framer.skipped();
+	//				cout << "Received packet of " << payload.size() << " bytes" << endl;
+					if (piece == PacketFramer::Item)
+						noteBlock(RLP(payload));
+					else if (piece == PacketFramer::End)
+						noteBlocksEnd();
+					else if (!interpret(RLP(payload)))
+						// error
+						break;
 				}
 				doRead();
 			}
@@ -528,6 +536,151 @@ void PeerSession::doRead()
 	});
 }
 
+const size_t PacketFramer::c_minReadSize;
+const size_t PacketFramer::c_maxReadAhead;
+const size_t PacketFramer::c_streamSize;
+
+/// @returns the size of the RLP item at the start of @a _b, or 0 if too little of its header is there to tell.
+static size_t rlpItemSize(bytesConstRef _b)
+{
+	if (!_b.size())
+		return 0;
+	byte n = _b[0];
+	if (n < c_rlpDataImmLenStart)
+		return 1;
+	if (n <= c_rlpDataIndLenZero)
+		return 1 + n - c_rlpDataImmLenStart;
+	if (n >= c_rlpListStart && n <= c_rlpListIndLenZero)
+		return 1 + n - c_rlpListStart;
+	size_t lengthSize = n - (n < c_rlpListStart ? c_rlpDataIndLenZero : c_rlpListIndLenZero);
+	if (_b.size() < 1 + lengthSize)
+		return 0;
+	size_t ret = 0;
+	for (size_t i = 0; i < lengthSize; ++i)
+		ret = (ret << 8) | _b[1 + i];
+	return 1 + lengthSize + ret;
+}
+
+bytesRef PacketFramer::writable()
+{
+	if (m_begin == m_end)
+	{
+		m_begin = m_end = 0;
+		if (m_buffer.size() > 4 * c_minReadSize && !m_streaming)
+			bytes().swap(m_buffer);	// don't hang on to the memory of a huge packet (but keep it for a stream's next block).
+	}
+
+	// Room for the whole of a packet whose header is in (but not trusting its length too far ahead of the data), plus a normal read.
+	size_t want = min(max(m_need, pending()), pending() + c_maxReadAhead) + c_minReadSize;
+	if (m_buffer.size() - m_begin < want)
+	{
+		if (m_begin)
+		{
+			memmove(m_buffer.data(), m_buffer.data() + m_begin, pending());
+			m_end -= m_begin;
+			m_begin = 0;
+		}
+		if (m_buffer.size() < want)
+			m_buffer.resize(max(want, m_buffer.size() * 2));
+	}
+	return bytesRef(m_buffer.data() + m_end, m_buffer.size() - m_end);
+}
+
+void PacketFramer::feed(bytesConstRef _b)
+{
+	for (size_t n; _b.size(); _b = bytesConstRef(_b.data() + n, _b.size() - n))
+	{
+		bytesRef w = writable();
+		n = min(w.size(), _b.size());
+		memcpy(w.data(), _b.data(), n);
+		received(n);
+	}
+}
+
+bool PacketFramer::startStream()
+{
+	if (m_need - 8 <= c_streamSize)
+		return false;
+	// The payload must be a list exactly filling the packet, whose first item says Blocks.
+	bytesConstRef payload(m_buffer.data() + m_begin + 8, pending() - 8);
+	size_t listSize = rlpItemSize(payload);
+	if (!listSize || listSize != m_need - 8 || !RLP(payload.cropped(0, 1)).isList())
+		return false;
+	size_t listHeader = RLP(payload).payload().data() - payload.data();
+	size_t typeSize = rlpItemSize(payload.cropped(listHeader));
+	if (!typeSize || payload.size() < listHeader + typeSize || RLP(payload.cropped(listHeader, typeSize)).toInt<unsigned>() != Blocks)
+		return false;
+
+	m_begin += 8 + listHeader + typeSize;
+	m_streamLeft = m_need - 8 - listHeader - typeSize;
+	m_need = 0;
+	m_streaming = true;
+	return true;
+}
+
+bool PacketFramer::next(bytesConstRef& o_payload, Piece& o_piece)
+{
+	static const byte c_syncToken[4] = { 0x22, 0x40, 0x08, 0x91 };
+
+	if (m_streaming)
+	{
+		if (!m_streamLeft)
+		{
+			m_streaming = false;
+			o_payload = bytesConstRef();
+			o_piece = End;
+			return true;
+		}
+		if (!m_need)
+		{
+			m_need = rlpItemSize(bytesConstRef(m_buffer.data() + m_begin, pending()));
+			if (m_need > m_streamLeft)
+				throw BadPacket();
+			if (!m_need)
+				return false;
+		}
+		if (pending() < m_need)
+			return false;
+		o_payload = bytesConstRef(m_buffer.data() + m_begin, m_need);
+		o_piece = Item;
+		m_begin += m_need;
+		m_streamLeft -= m_need;
+		m_need = 0;
+		return true;
+	}
+
+	if (!m_need)
+	{
+		// Skip to the next (possibly partial) sync token; memchr passes over garbage many bytes at a time.
+		byte const* b = m_buffer.data() + m_begin;
+		byte const* e = m_buffer.data() + m_end;
+		byte const* p = b;
+		while (p != e && memcmp(p, c_syncToken, min<size_t>(e - p, 4)))
+		{
+			p = (byte const*)memchr(p + 1, c_syncToken[0], e - p - 1);
+			if (!p)
+				p = e;
+		}
+		m_skipped += p - b;
+		m_begin += p - b;
+
+		if (pending() < 8)
+			return false;
+		m_need = 8 + fromBigEndian<uint32_t>(bytesConstRef(p + 4, 4));
+	}
+
+	if (startStream())
+		return next(o_payload, o_piece);
+	if (pending() < m_need)
+		return false;
+
+	o_payload = bytesConstRef(m_buffer.data() + m_begin + 8, m_need - 8);
+	o_piece = Packet;
+	m_begin += m_need;
+	m_need = 0;
+	return true;
+}
+
 #include <stdio.h>
 #include <string.h>
 
@@ -713,8 +866,6 @@ PeerServer::PeerServer(std::string const& _clientVersion, uint _networkId):
 {
 	// populate addresses.
 	populateAddresses();
-	if (m_verbosity)
-		cout << "Genesis: " << m_chain->genesisHash() << endl;
 }
 
 PeerServer::~PeerServer()
@@ -956,9 +1107,8 @@ bool PeerServer::process(BlockChain& _bc, TransactionQueue& _tq, Overlay& _o)
 						RLPStream ts;
 						PeerSession::prep(ts);
 						ts.appendList(n + 1) << Transactions;
-						ts.appendRaw(b).swapOut(b);
-						seal(b);
-						p->send(&b);
+						ts.appendRaw(b);
+						p->send(seal(ts));
 					}
 					p->m_knownTransactions.clear();
 					p->m_requireTransactions = false;
@@ -969,17 +1119,17 @@ bool PeerServer::process(BlockChain& _bc, TransactionQueue& _tq, Overlay& _o)
 			if (h != m_latestBlockSent)
 			{
 				// TODO: find where they diverge and send complete new branch.
+				// Serialised and sealed once; every peer's write queue shares the one buffer.
 				RLPStream ts;
 				PeerSession::prep(ts);
 				ts.appendList(2) << Blocks;
-				bytes b;
-				ts.appendRaw(_bc.block(_bc.currentHash())).swapOut(b);
-				seal(b);
+				ts.appendRaw(_bc.block(_bc.currentHash()));
+				SealedPacket b = seal(ts);
 				for (auto j: m_peers)
 					if (auto p = j.lock())
 					{
 						if (!p->m_knownBlocks.count(_bc.currentHash()))
-							p->send(&b);
+							p->send(b);
 						p->m_knownBlocks.clear();
 					}
 			}
@@ -1021,12 +1171,11 @@ bool PeerServer::process(BlockChain& _bc, TransactionQueue& _tq, Overlay& _o)
 					if (chrono::steady_clock::now() > m_lastPeersRequest + chrono::seconds(10))
 					{
 						RLPStream s;
-						bytes b;
-						(PeerSession::prep(s).appendList(1) << GetPeers).swapOut(b);
-						seal(b);
+						PeerSession::prep(s).appendList(1) << GetPeers;
+						SealedPacket b = seal(s);
 						for (auto const& i: m_peers)
 							if (auto p = i.lock())
-								p->send(&b);
+								p->send(b);
 						m_lastPeersRequest = chrono::steady_clock::now();
 					}
 
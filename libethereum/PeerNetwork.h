@@ -52,6 +52,71 @@ enum PacketType
 	GetTransactions
 };
 
+class BadPacket: public std::exception {};
+
+/**
+ * @brief Splits an incoming byte stream into sealed packets (sync token, 32-bit big-endian length, payload).
+ * Bytes are received straight into a single buffer; complete packets are handed out in place and consumed by
+ * advancing a read offset, so nothing is moved per packet. The unconsumed tail is moved to the front only when
+ * the buffer runs out of room. A packet whose header has arrived gets its length reserved up front, so it
+ * arrives directly into place and each arrival costs only its own bytes.
+ *
+ * Blocks packets larger than c_streamSize are not held whole: each block is handed out as soon as it has
+ * arrived, and its space is reused once the next is asked for. Such a packet then needs only as much buffer as
+ * its largest block, and only a partly-arrived block is ever moved.
+ */
+class PacketFramer
+{
+public:
+	/// What next() hands out.
+	enum Piece
+	{
+		Packet,		///< The payload of a whole packet.
+		Item,		///< The next block of a Blocks packet being handed out as it arrives.
+		End			///< The end of a Blocks packet handed out as it arrived; the payload is empty.
+	};
+
+	/// @returns a region into which bytes may be received; follow with received().
+	bytesRef writable();
+	/// Notes that @a _n bytes were written to the start of the last writable() region.
+	void received(size_t _n) { m_end += _n; }
+	/// Copies @a _b into the stream.
+	void feed(bytesConstRef _b);
+
+	/// Extracts the next complete packet, or block of a large Blocks packet, into @a o_payload and says which
+	/// in @a o_piece. @returns false if none is yet complete. The payload is valid until the next call to
+	/// writable() or feed(). Throws BadPacket if a block overruns its packet.
+	bool next(bytesConstRef& o_payload, Piece& o_piece);
+
+	/// @returns the number of bytes skipped so far while looking for a sync token.
+	size_t skipped() const { return m_skipped; }
+	/// @returns the number of bytes received but not yet handed out as packets.
+	size_t pending() const { return m_end - m_begin; }
+
+private:
+	/// Smallest region writable() will offer.
+	static const size_t c_minReadSize = 65536;
+	/// Furthest beyond the received data that a packet's stated length will make us reserve.
+	static const size_t c_maxReadAhead = 16 * 1024 * 1024;
+	/// Blocks packets with payloads larger than this are handed out block by block.
+	static const size_t c_streamSize = c_minReadSize;
+
+	/// Starts handing out the packet at m_begin block by block if it is a large enough Blocks packet.
+	/// @returns false if it isn't, or if not enough of it is in to tell yet.
+	bool startStream();
+
+	bytes m_buffer;
+	size_t m_begin = 0;		///< Start of the unconsumed data.
+	size_t m_end = 0;		///< End of the received data.
+	size_t m_need = 0;		///< Total size (with header) of the packet, or streamed block, at m_begin, once its header is in.
+	size_t m_skipped = 0;
+	bool m_streaming = false;	///< Are we handing out a Blocks packet block by block?
+	size_t m_streamLeft = 0;	///< Bytes of the streamed packet's blocks not yet handed out.
+};
+
+/// A sealed packet. Immutable, so one may be shared between all the sessions it is sent to.
+using SealedPacket = std::shared_ptr<bytes const>;
+
 class PeerServer;
 
 struct PeerInfo
@@ -65,6 +130,7 @@ struct PeerInfo
 class PeerSession: public std::enable_shared_from_this<PeerSession>
 {
 	friend class PeerServer;
+	friend struct PeerSessionTest;
 
 public:
 	PeerSession(PeerServer* _server, bi::tcp::socket _socket, uint _rNId);
@@ -80,20 +146,26 @@ public:
 private:
 	void dropped();
 	void doRead();
-	void doWrite(std::size_t length);
+	void doWrite();
 	bool interpret(RLP const& _r);
+	/// Takes in one block of a Blocks packet.
+	void noteBlock(RLP const& _block);
+	/// Notes the end of a Blocks packet, asking for more if it held any blocks.
+	void noteBlocksEnd();
 
 	static RLPStream& prep(RLPStream& _s);
 	void sealAndSend(RLPStream& _s);
-	void sendDestroy(bytes& _msg);
-	void send(bytesConstRef _msg);
+	void send(SealedPacket const& _p);
 
 	PeerServer* m_server;
 	bi::tcp::socket m_socket;
-	std::array<byte, 65536> m_data;
 	PeerInfo m_info;
 
-	bytes m_incoming;
+	PacketFramer m_framer;
+	unsigned m_blocksIn = 0;		///< Blocks taken in so far from the Blocks packet being received.
+	h256 m_firstBlockIn;			///< Hash of the first of them.
+	std::vector<SealedPacket> m_writeQueue;		///< Packets waiting to be written.
+	std::vector<SealedPacket> m_writing;		///< Packets being written by the outstanding async_write, if any.
 	uint m_protocolVersion;
 	uint m_networkId;
 	uint m_reqNetworkId;
@@ -107,8 +179,8 @@ private:
 	unsigned m_rating;
 	bool m_requireTransactions;
 
-	std::set<h256> m_knownBlocks;
-	std::set<h256> m_knownTransactions;
+	h256Hash m_knownBlocks;
+	h256Hash m_knownTransactions;
 };
 
 enum class NodeMode
@@ -159,7 +231,7 @@ public:
 	short listenPort() const { return m_public.port(); }
 
 private:
-	void seal(bytes& _b);
+	SealedPacket seal(RLPStream& _s);
 	void populateAddresses();
 	void determinePublic(std::string const& _publicAddress, bool _upnp);
 	void ensureAccepting();
@@ -197,7 +269,7 @@ private:
 	std::vector<bi::tcp::endpoint> m_incomingPeers;
 
 	h256 m_latestBlockSent;
-	std::set<h256> m_transactionsSent;
+	h256Hash m_transactionsSent;
 
 	std::chrono::steady_clock::time_point m_lastPeersRequest;
 	unsigned m_idealPeerCount = 5;
@@ -26,6 +26,8 @@ using namespace eth;
 bytes eth::RLPNull = rlp("");
 bytes eth::RLPEmptyList = rlpList();
 
+const eth::uint RLPStream::c_preparedList;
+
 RLP::iterator& RLP::iterator::operator++()
 {
 	if (m_remaining)
@@ -81,6 +83,32 @@ RLPs RLP::toList() const
 	return ret;
 }
 
+RLPIndex::RLPIndex(RLP const& _list)
+{
+	if (!_list.isList())
+		return;
+	m_payload = _list.payload().cropped(0, _list.length());
+	unsigned o = 0;
+	for (bytesConstRef d = m_payload; d.size(); ++m_count)
+	{
+		if (m_count < c_inlineItems)
+			m_inline[m_count] = o;
+		else
+		{
+			if (m_spill.empty())
+				m_spill.assign(m_inline.begin(), m_inline.begin() + c_inlineItems);
+			m_spill.push_back(o);
+		}
+		uint s = std::min<uint>(RLP(d).actualSize(), d.size());
+		o += s;
+		d = d.cropped(s);
+	}
+	if (m_spill.empty())
+		m_inline[m_count] = o;
+	else
+		m_spill.push_back(o);
+}
+
 eth::uint RLP::actualSize() const
 {
 	if (isNull())
@@ -160,6 +188,9 @@ void RLPStream::noteAppended(uint _itemCount)
 		m_listStack.back().first -= _itemCount;
 		if (m_listStack.back().first)
 			break;
+		else if (m_listStack.back().second == c_preparedList)
+			// header already written by appendList().
+			m_listStack.pop_back();
 		else
 		{
 			auto p = m_listStack.back().second;
@@ -188,13 +219,50 @@ void RLPStream::noteAppended(uint _itemCount)
 RLPStream& RLPStream::appendList(unsigned _items)
 {
 //	cdebug << "appendList(" << _items << ")";
-	if (_items)
+	if (_items && m_nextListSize < m_listSizes.size())
+	{
+		// prepared - we know the payload size already so can write the header now.
+		uint s = m_listSizes[m_nextListSize++];
+		if (s < c_rlpListImmLenCount)
+			m_out.push_back((byte)(s + c_rlpListStart));
+		else
+			pushCount(s, c_rlpListIndLenZero);
+		m_listStack.push_back(std::make_pair(_items, c_preparedList));
+	}
+	else if (_items)
 		m_listStack.push_back(std::make_pair(_items, m_out.size()));
 	else
 		appendList(bytes());
 	return *this;
 }
 
+RLPStream& RLPStream::prepare()
+{
+	uint need = m_out.size() + m_measure.size();
+	if (m_out.capacity() < need)
+		m_out.reserve(std::max<uint>(need, m_out.capacity() * 2));
+	// the measure's (now empty) stack has room for as many lists as it saw open at once.
+	uint depth = m_listStack.size() + m_measure.m_listStack.capacity();
+	if (m_listStack.capacity() < depth)
+		m_listStack.reserve(depth);
+	if (m_nextListSize == m_listSizes.size())
+	{
+		// nothing else prepared for; take a copy of the measure's sizes. Both keep their buffers, which are
+		// soon big enough that a stream kept for more of the same needn't grow either again.
+		m_listSizes.assign(m_measure.m_listSizes.begin(), m_measure.m_listSizes.end());
+		m_nextListSize = 0;
+	}
+	else
+	{
+		// within appends prepared for earlier: ours come first, then the rest of theirs. Drop those used up
+		// already, so that a run of nested prepare()s doesn't keep growing the buffer.
+		m_listSizes.erase(m_listSizes.begin(), m_listSizes.begin() + m_nextListSize);
+		m_nextListSize = 0;
+		m_listSizes.insert(m_listSizes.begin(), m_measure.m_listSizes.begin(), m_measure.m_listSizes.end());
+	}
+	return *this;
+}
+
 RLPStream& RLPStream::appendList(bytesConstRef _rlp)
 {
 	if (_rlp.size() < c_rlpListImmLenCount)
@@ -249,6 +317,67 @@ RLPStream& RLPStream::append(bigint _i)
 	return *this;
 }
 
+RLPMeasure& RLPMeasure::appendList(unsigned _items)
+{
+	if (_items)
+	{
+		m_listStack.push_back(std::make_pair(_items, m_listSizes.size()));
+		m_listSizes.push_back(m_size);	// start of payload, for now.
+	}
+	else
+	{
+		m_size += 1;
+		noteAppended();
+	}
+	return *this;
+}
+
+void RLPMeasure::noteAppended(uint _itemCount)
+{
+	if (!_itemCount)
+		return;
+	while (m_listStack.size())
+	{
+		assert(m_listStack.back().first >= _itemCount);
+		m_listStack.back().first -= _itemCount;
+		if (m_listStack.back().first)
+			break;
+		uint& s = m_listSizes[m_listStack.back().second];
+		m_listStack.pop_back();
+		s = m_size - s;
+		m_size += headerSize(s);
+		_itemCount = 1;	// a completed list is a single item of its parent.
+	}
+}
+
+RLPMeasure& RLPMeasure::append(bytesConstRef _s, bool _compact)
+{
+	uint s = _s.size();
+	byte const* d = _s.data();
+	if (_compact)
+		for (unsigned i = 0; i < _s.size() && !*d; ++i, --s, ++d) {}
+
+	if (s == 1 && *d < c_rlpDataImmLenStart)
+		m_size += 1;
+	else
+		m_size += (s < c_rlpDataImmLenCount ? 1 : (1 + bytesRequired(s))) + s;
+	noteAppended();
+	return *this;
+}
+
+RLPMeasure& RLPMeasure::append(bigint _i)
+{
+	if (_i < c_rlpDataImmLenStart)
+		m_size += 1;
+	else
+	{
+		uint br = bytesRequired(_i);
+		m_size += (br < c_rlpDataImmLenCount ? 1 : (1 + bytesRequired(br))) + br;
+	}
+	noteAppended();
+	return *this;
+}
+
 void RLPStream::pushCount(uint _count, byte _base)
 {
 	auto br = bytesRequired(_count);
@@ -35,12 +35,14 @@ namespace eth
 {
 
 class RLP;
+class RLPIndex;
+class RLPMeasure;
 typedef std::vector<RLP> RLPs;
 
-template <class _T> struct intTraits { static const uint maxSize = sizeof(_T); };
-template <> struct intTraits<u160> { static const uint maxSize = 20; };
-template <> struct intTraits<u256> { static const uint maxSize = 32; };
-template <> struct intTraits<bigint> { static const uint maxSize = ~(uint)0; };
+template <class _T> struct intTraits { static const uint maxSize = sizeof(_T); static _T fromBigEndian(bytesConstRef _b) { return eth::fromBigEndian<_T>(_b); } };
+template <> struct intTraits<u160> { static const uint maxSize = 20; static u160 fromBigEndian(bytesConstRef _b) { return fromBigEndianLimbs<u160>(_b); } };
+template <> struct intTraits<u256> { static const uint maxSize = 32; static u256 fromBigEndian(bytesConstRef _b) { return fromBigEndianLimbs<u256>(_b); } };
+template <> struct intTraits<bigint> { static const uint maxSize = ~(uint)0; static bigint fromBigEndian(bytesConstRef _b) { return eth::fromBigEndian<bigint>(_b); } };
 
 static const byte c_rlpMaxLengthBytes = 8;
 static const byte c_rlpDataImmLenStart = 0x80;
@@ -205,7 +207,7 @@ public:
 				return 0;
 		else {}
 
-		return fromBigEndian<_T>(p);
+		return intTraits<_T>::fromBigEndian(p);
 	}
 
 	template <class _N> _N toHash(int _flags = Strict) const
@@ -226,10 +228,15 @@ public:
 	/// Converts to RLPs collection object. Useful if you need random access to sub items or will iterate over multiple times.
 	RLPs toList() const;
 
+	/// @returns an index of the list's items, giving O(1) random access and item count. Empty if not a list.
+	RLPIndex index() const;
+
 	/// @returns the data payload. Valid for all types.
 	bytesConstRef payload() const { return isSingleByte() ? m_data.cropped(0, 1) : m_data.cropped(1 + lengthSize()); }
 
 private:
+	friend class RLPIndex;
+
 	/// Single-byte data payload.
 	bool isSingleByte() const { return !isNull() && m_data[0] < c_rlpDataImmLenStart; }
 
@@ -255,6 +262,124 @@ private:
 	mutable bytesConstRef m_lastItem;
 };
 
+/**
+ * @brief Random-access view over the items of an RLP list.
+ *
+ * The payload is walked once on construction and each item's offset recorded; thereafter
+ * operator[] and itemCount() are O(1). Lists of up to c_inlineItems items (which covers block
+ * headers, transactions and trie nodes) are indexed without touching the heap.
+ */
+class RLPIndex
+{
+public:
+	/// Construct an empty index.
+	RLPIndex() {}
+
+	/// Index the items of @a _list. If it isn't a list, the index is empty.
+	explicit RLPIndex(RLP const& _list);
+
+	/// @returns the number of items in the list.
+	uint itemCount() const { return m_count; }
+
+	/// @returns the list item @a _i if @a _i < itemCount(), or RLP() otherwise.
+	RLP operator[](uint _i) const { return _i < m_count ? RLP(m_payload.data() + offset(_i), offset(_i + 1) - offset(_i)) : RLP(); }
+
+private:
+	static const uint c_inlineItems = 17;
+
+	unsigned offset(uint _i) const { return m_spill.empty() ? m_inline[_i] : m_spill[_i]; }
+
+	bytesConstRef m_payload;
+	uint m_count = 0;
+	std::array<unsigned, c_inlineItems + 1> m_inline;	///< Offsets of items (and end) into m_payload, when m_count <= c_inlineItems.
+	std::vector<unsigned> m_spill;						///< Offsets of items (and end) into m_payload, otherwise.
+};
+
+inline RLPIndex RLP::index() const { return RLPIndex(*this); }
+
+/**
+ * @brief Class for measuring an RLP bytestream without writing it.
+ *
+ * Has the same append interface as RLPStream. Feed RLPStream::measure() the same sequence of
+ * appends that will next go to the stream and call RLPStream::prepare(); the stream can then be
+ * written with a single allocation and each list header put in place up front.
+ */
+class RLPMeasure
+{
+public:
+	/// Initializes empty RLPMeasure.
+	RLPMeasure() {}
+
+	/// Initializes the RLPMeasure as a list of @a _listItems items.
+	explicit RLPMeasure(uint _listItems) { appendList(_listItems); }
+
+	/// Append given datum to the measurement.
+	RLPMeasure& append(uint _s) { return appendInt(_s < c_rlpDataImmLenStart ? 0 : bytesRequired(_s)); }
+	RLPMeasure& append(u160 const& _s) { return appendInt(_s < c_rlpDataImmLenStart ? 0 : boost::multiprecision::msb(_s) / 8 + 1); }
+	RLPMeasure& append(u256 const& _s) { return appendInt(_s < c_rlpDataImmLenStart ? 0 : boost::multiprecision::msb(_s) / 8 + 1); }
+	RLPMeasure& append(bigint _s);
+	RLPMeasure& append(bytesConstRef _s, bool _compact = false);
+	RLPMeasure& append(bytes const& _s) { return append(bytesConstRef(&_s)); }
+	RLPMeasure& append(std::string const& _s) { return append(bytesConstRef(_s)); }
+	RLPMeasure& append(char const* _s) { return append(bytesConstRef((byte const*)_s, strlen(_s))); }
+	RLPMeasure& append(h160 const& _s, bool _compact = false) { return append(_s.ref(), _compact); }
+	RLPMeasure& append(h256 const& _s, bool _compact = false) { return append(_s.ref(), _compact); }
+	RLPMeasure& append(RLP const& _rlp, uint _itemCount = 1) { return appendRaw(_rlp.data(), _itemCount); }
+	template <class _T> RLPMeasure& append(std::vector<_T> const& _s) { appendList(_s.size()); for (auto const& i: _s) append(i); return *this; }
+	template <class _T, size_t S> RLPMeasure& append(std::array<_T, S> const& _s) { appendList(_s.size()); for (auto const& i: _s) append(i); return *this; }
+
+	/// Appends a list.
+	RLPMeasure& appendList(unsigned _items);
+	RLPMeasure& appendList(bytesConstRef _rlp) { m_size += headerSize(_rlp.size()); return appendRaw(_rlp, 1); }
+	RLPMeasure& appendList(bytes const& _rlp) { return appendList(&_rlp); }
+
+	/// Appends raw (pre-serialised) RLP data.
+	RLPMeasure& appendRaw(bytesConstRef _rlp, uint _itemCount = 1) { m_size += _rlp.size(); noteAppended(_itemCount); return *this; }
+	RLPMeasure& appendRaw(bytes const& _rlp, uint _itemCount = 1) { return appendRaw(&_rlp, _itemCount); }
+
+	/// Shift operators for appending data items.
+	template <class T> RLPMeasure& operator<<(T const& _data) { return append(_data); }
+
+	/// @returns the mark to give endSelfPrepared() once the appends that follow, which will prepare() themselves
+	/// (as fillStream()s do), are measured.
+	uint beginSelfPrepared() const { return m_listSizes.size(); }
+	/// Ends the appends begun at @a _mark, which must all be complete. They still count towards size(), but the
+	/// sizes of their lists are dropped: the appends give those to the stream themselves.
+	void endSelfPrepared(uint _mark) { assert(m_listStack.empty() || m_listStack.back().second < _mark); m_listSizes.resize(_mark); }
+
+	/// Forget everything measured so far.
+	void clear() { m_size = 0; m_listSizes.clear(); m_listStack.clear(); }
+
+	/// @returns the number of bytes the measured appends will write.
+	uint size() const { assert(m_listStack.empty()); return m_size; }
+
+	/// @returns the payload size of each non-empty list appended, in the order they were begun.
+	std::vector<uint> const& listSizes() const { assert(m_listStack.empty()); return m_listSizes; }
+
+	/// @returns the number of bytes taken by the header of a list (or indirect-length string) with @a _payload bytes.
+	static uint headerSize(uint _payload) { return _payload < c_rlpListImmLenCount ? 1 : (1 + bytesRequired(_payload)); }
+
+	/// Determine bytes required to encode the given integer value. @returns 0 if @a _i is zero.
+	template <class _T> static uint bytesRequired(_T _i)
+	{
+		uint i = 0;
+		for (; _i != 0; ++i, _i >>= 8) {}
+		return i;
+	}
+
+private:
+	friend class RLPStream;
+
+	void noteAppended(uint _itemCount = 1);
+
+	/// Measures an integer whose big-endian form needs @a _br bytes; @a _br is 0 if it encodes as a single byte.
+	RLPMeasure& appendInt(uint _br) { m_size += _br ? (_br < c_rlpDataImmLenCount ? 1 : (1 + bytesRequired(_br))) + _br : 1; noteAppended(); return *this; }
+
+	uint m_size = 0;
+	std::vector<uint> m_listSizes;
+	std::vector<std::pair<uint, uint>> m_listStack;	///< (items remaining, index into m_listSizes) for each open list.
+};
+
 /**
  * @brief Class for writing to an RLP bytestream.
  */
@@ -270,9 +395,9 @@ public:
 	~RLPStream() {}
 
 	/// Append given datum to the byte stream.
-	RLPStream& append(uint _s) { return append(bigint(_s)); }
-	RLPStream& append(u160 _s) { return append(bigint(_s)); }
-	RLPStream& append(u256 _s) { return append(bigint(_s)); }
+	RLPStream& append(uint _s) { byte b[8]; uint n = toCompactBigEndian(_s, b + 8); return append(bytesConstRef(b + 8 - n, n)); }
+	RLPStream& append(u160 const& _s) { byte b[32]; uint n = toCompactBigEndianLimbs(_s, b + 32); return append(bytesConstRef(b + 32 - n, n)); }
+	RLPStream& append(u256 const& _s) { byte b[32]; uint n = toCompactBigEndianLimbs(_s, b + 32); return append(bytesConstRef(b + 32 - n, n)); }
 	RLPStream& append(bigint _s);
 	RLPStream& append(bytesConstRef _s, bool _compact = false);
 	RLPStream& append(bytes const& _s) { return append(bytesConstRef(&_s)); }
@@ -299,10 +424,20 @@ public:
 	RLPStream& appendRaw(bytes const& _rlp, uint _itemCount = 1) { return appendRaw(&_rlp, _itemCount); }
 
 	/// Shift operators for appending data items.
-	template <class T> RLPStream& operator<<(T _data) { return append(_data); }
+	template <class T> RLPStream& operator<<(T const& _data) { return append(_data); }
+
+	/// @returns our (emptied) measure. Give it the appends that are to be made next, then call prepare().
+	RLPMeasure& measure() { m_measure.clear(); return m_measure; }
+
+	/// Prepares for exactly the appends given to measure(), which must follow next and in the same order.
+	/// Space for them is reserved in one go and each of their lists' headers is written as the list
+	/// is begun, rather than being inserted (and the payload shifted along) once it is complete.
+	/// Lists already open are unaffected, and so is an earlier prepare() not yet used up: its lists
+	/// still to come take their sizes once these are done.
+	RLPStream& prepare();
 
 	/// Clear the output stream so far.
-	void clear() { m_out.clear(); m_listStack.clear(); }
+	void clear() { m_out.clear(); m_listStack.clear(); m_measure.clear(); m_listSizes.clear(); m_nextListSize = 0; }
 
 	/// Read the byte stream.
 	bytes const& out() const { assert(m_listStack.empty()); return m_out; }
@@ -327,32 +462,47 @@ private:
 	}
 
 	/// Determine bytes required to encode the given integer value. @returns 0 if @a _i is zero.
-	template <class _T> static uint bytesRequired(_T _i)
-	{
-		uint i = 0;
-		for (; _i != 0; ++i, _i >>= 8) {}
-		return i;
-	}
+	template <class _T> static uint bytesRequired(_T _i) { return RLPMeasure::bytesRequired(_i); }
 
 	/// Our output byte stream.
 	bytes m_out;
 
+	/// (items remaining, start of payload) for each open list; the start is c_preparedList if the header is already written.
 	std::vector<std::pair<uint, uint>> m_listStack;
+
+	/// Measure of the appends to come.
+	RLPMeasure m_measure;
+	/// Payload sizes of the lists prepare()d for; m_nextListSize indexes the next unused one.
+	std::vector<uint> m_listSizes;
+	uint m_nextListSize = 0;
+
+	static const uint c_preparedList = (uint)-1;
 };
 
-template <class _T> void rlpListAux(RLPStream& _out, _T _t) { _out << _t; }
-template <class _T, class ... _Ts> void rlpListAux(RLPStream& _out, _T _t, _Ts ... _ts) { rlpListAux(_out << _t, _ts...); }
+template <class _S, class _T> void rlpListAux(_S& _out, _T _t) { _out << _t; }
+template <class _S, class _T, class ... _Ts> void rlpListAux(_S& _out, _T _t, _Ts ... _ts) { rlpListAux(_out << _t, _ts...); }
 
 /// Export a single item in RLP format, returning a byte array.
-template <class _T> bytes rlp(_T _t) { return (RLPStream() << _t).out(); }
+template <class _T> bytes rlp(_T _t)
+{
+	RLPStream out;
+	out.measure() << _t;
+	out.prepare() << _t;
+	bytes ret;
+	out.swapOut(ret);
+	return ret;
+}
 
 /// Export a list of items in RLP format, returning a byte array.
 inline bytes rlpList() { return RLPStream(0).out(); }
 template <class ... _Ts> bytes rlpList(_Ts ... _ts)
 {
-	RLPStream out(sizeof ...(_Ts));
-	rlpListAux(out, _ts...);
-	return out.out();
+	RLPStream out;
+	rlpListAux(out.measure().appendList(sizeof ...(_Ts)), _ts...);
+	rlpListAux(out.prepare().appendList(sizeof ...(_Ts)), _ts...);
+	bytes ret;
+	out.swapOut(ret);
+	return ret;
 }
 
 /// The empty string in RLP format.
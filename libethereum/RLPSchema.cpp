@@ -0,0 +1,60 @@
+/*
+	This file is part of cpp-ethereum.
+
+	cpp-ethereum is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	Foobar is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/** @file RLPSchema.cpp
+ * @date 2014
+ */
+
+#include "RLPSchema.h"
+using namespace std;
+using namespace eth;
+
+bool eth::splitRLPItem(bytesConstRef& io_data, RLP& o_item)
+{
+	uint s = io_data.size();
+	if (!s)
+		return false;
+
+	byte n = io_data[0];
+	uint header = 1;
+	uint length;
+	if (n < c_rlpDataImmLenStart)
+		header = length = 0;	// the single byte is the whole item.
+	else if (n <= c_rlpDataIndLenZero)
+		length = n - c_rlpDataImmLenStart;
+	else if (n < c_rlpListStart)
+		header += n - c_rlpDataIndLenZero;
+	else if (n <= c_rlpListIndLenZero)
+		length = n - c_rlpListStart;
+	else
+		header += n - c_rlpListIndLenZero;
+
+	if (header > 1)
+	{
+		if (header > s)
+			return false;
+		length = 0;
+		for (uint i = 1; i < header; ++i)
+			length = (length << 8) | io_data[i];
+	}
+
+	uint total = header ? header + length : 1;
+	if (length > s - header || total > s)
+		return false;
+	o_item = RLP(io_data.cropped(0, total));
+	io_data = bytesConstRef(io_data.data() + total, s - total);
+	return true;
+}
@@ -0,0 +1,138 @@
+/*
+	This file is part of cpp-ethereum.
+
+	cpp-ethereum is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	Foobar is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/** @file RLPSchema.h
+ * @date 2014
+ *
+ * Compile-time typed RLP schemas for single-pass, non-throwing decoding.
+ */
+
+#pragma once
+
+#include <tuple>
+#include "RLP.h"
+
+namespace eth
+{
+
+/// Splits the first RLP item off @a io_data into @a o_item, checking that its header and payload lie within the data.
+/// @returns false (leaving @a io_data untouched) if the data is empty or truncated.
+bool splitRLPItem(bytesConstRef& io_data, RLP& o_item);
+
+/// Schema field: a canonical (no leading zeroes) integer no wider than @a _T.
+template <class _T> struct RLPInt
+{
+	using Type = _T;
+	static bool decode(RLP const& _item, _T& o_value)
+	{
+		if (!_item.isData())
+			return false;
+		bytesConstRef p = _item.toBytesConstRef();
+		if (p.size() > intTraits<_T>::maxSize || (p.size() && !p[0]))
+			return false;
+		o_value = intTraits<_T>::fromBigEndian(p);
+		return true;
+	}
+};
+
+/// Schema field: a hash of up to @a _N bytes, right-aligned as RLP::toHash does.
+template <unsigned _N> struct RLPHash
+{
+	using Type = FixedHash<_N>;
+	static bool decode(RLP const& _item, Type& o_value)
+	{
+		if (!_item.isData() || _item.size() > _N)
+			return false;
+		o_value = Type();
+		memcpy(o_value.data() + _N - _item.size(), _item.toBytesConstRef().data(), _item.size());
+		return true;
+	}
+};
+
+/// Schema field: a byte string, referenced in place.
+struct RLPBytes
+{
+	using Type = bytesConstRef;
+	static bool decode(RLP const& _item, Type& o_value) { if (!_item.isData()) return false; o_value = _item.toBytesConstRef(); return true; }
+};
+
+/// Schema field: a list whose items are not decoded, referenced in place.
+struct RLPList
+{
+	using Type = RLP;
+	static bool decode(RLP const& _item, Type& o_value) { if (!_item.isList()) return false; o_value = _item; return true; }
+};
+
+/// Schema field: a list of any number of items, each of schema field @a _F.
+template <class _F> struct RLPListOf
+{
+	using Type = std::vector<typename _F::Type>;
+	static bool decode(RLP const& _item, Type& o_value)
+	{
+		if (!_item.isList())
+			return false;
+		o_value.clear();
+		RLP i;
+		for (bytesConstRef d = _item.payload(); d.size();)
+		{
+			o_value.emplace_back();
+			if (!splitRLPItem(d, i) || !_F::decode(i, o_value.back()))
+				return false;
+		}
+		return true;
+	}
+};
+
+/**
+ * @brief A list of exactly the given fields, decoded in one linear pass.
+ * Decoding produces a tuple of the fields' types; byte strings and lists refer into the original data.
+ * Malformed input is reported by return value; nothing throws. A schema is itself a field, so schemas may nest.
+ * @example RLPSchema<RLPInt<uint>, RLPBytes>::Type v; if (RLPSchema<RLPInt<uint>, RLPBytes>::decode(&data, v)) ...
+ */
+template <class... _Fields>
+class RLPSchema
+{
+public:
+	using Type = std::tuple<typename _Fields::Type...>;
+
+	/// Decodes @a _rlp, which must be exactly one item. @returns false if it doesn't match the schema; @a o_value is then unspecified.
+	static bool decode(bytesConstRef _rlp, Type& o_value)
+	{
+		RLP item;
+		return splitRLPItem(_rlp, item) && !_rlp.size() && decode(item, o_value);
+	}
+
+	/// Decodes the item @a _item, which must span exactly its own data (as given by splitRLPItem).
+	/// @returns false if it doesn't match the schema; @a o_value is then unspecified.
+	static bool decode(RLP const& _item, Type& o_value)
+	{
+		if (!_item.isList())
+			return false;
+		bytesConstRef d = _item.payload();
+		return decodeFields<0, _Fields...>(d, o_value) && !d.size();
+	}
+
+private:
+	template <unsigned _I> static bool decodeFields(bytesConstRef&, Type&) { return true; }
+
+	template <unsigned _I, class _F, class... _Rest> static bool decodeFields(bytesConstRef& io_data, Type& o_value)
+	{
+		RLP item;
+		return splitRLPItem(io_data, item) && _F::decode(item, std::get<_I>(o_value)) && decodeFields<_I + 1, _Rest...>(io_data, o_value);
+	}
+};
+
+}
@@ -89,6 +89,10 @@ Overlay State::openDB(std::string _path, bool _killExisting)
 State::State(Address _coinbaseAddress, Overlay const& _db): m_db(_db), m_state(&m_db), m_ourAddress(_coinbaseAddress)
 {
 	secp256k1_start();
+	// Hash the state's subtrees across all cores when committing a block's worth of changes.
+	m_state.setWorkerPool(&WorkerPool::shared());
+	// Every account read and write passes through the same few top levels; keep them in memory.
+	m_state.setPinnedLevels(3);
 
 	// Initialise to the state entailed by the genesis block; this guarantees the trie is built correctly.
 	m_state.init();
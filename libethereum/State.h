@@ -22,6 +22,7 @@
 #pragma once
 
 #include <array>
+#include <algorithm>
 #include <map>
 #include <unordered_map>
 #include "Common.h"
@@ -137,6 +138,13 @@ public:
 	/// The hash of the root of our state tree.
 	h256 rootHash() const { return m_state.root(); }
 
+	/// Reads of the state trie served by, and made to bring up to date, its pinned levels since the last resetPinStats().
+	TrieDB<Address, Overlay>::PinStats const& pinStats() const { return m_state.pinStats(); }
+	void resetPinStats() { m_state.resetPinStats(); }
+
+	/// The root of the state tree as of the end of the previous block; unlike rootHash(), always in the DB on disk.
+	h256 previousRootHash() const { return m_previousBlock.stateRoot; }
+
 	/// Finalise the block, applying the earned rewards.
 	void applyRewards(Addresses const& _uncleAddresses);
 
@@ -186,7 +194,7 @@ private:
 	TrieDB<Address, Overlay> m_state;			///< Our state tree, as an Overlay DB.
 	std::map<h256, Transaction> m_transactions;	///< The current list of transactions that we've included in the state.
 
-	mutable std::map<Address, AddressState> m_cache;	///< Our address cache. This stores the states of each address that has (or at least might have) been changed.
+	mutable std::unordered_map<Address, AddressState> m_cache;	///< Our address cache. This stores the states of each address that has (or at least might have) been changed.
 
 	BlockInfo m_previousBlock;					///< The previous block's information.
 	BlockInfo m_currentBlock;					///< The current block's information.
@@ -238,34 +246,38 @@ inline std::ostream& operator<<(std::ostream& _out, State const& _s)
 	return _out;
 }
 
-template <class DB>
-void commit(std::map<Address, AddressState> const& _cache, DB& _db, TrieDB<Address, DB>& _state)
+template <class _Cache, class DB>
+void commit(_Cache const& _cache, DB& _db, TrieDB<Address, DB>& _state)
 {
+	std::vector<std::pair<Address, bytes>> batch;
+	batch.reserve(_cache.size());
 	for (auto const& i: _cache)
 		if (i.second.type() == AddressType::Dead)
-			_state.remove(i.first);
-		else
+			batch.push_back(std::make_pair(i.first, bytes()));
+		else if (i.second.type() == AddressType::Contract)
 		{
-			RLPStream s(i.second.type() == AddressType::Contract ? 3 : 2);
-			s << i.second.balance() << i.second.nonce();
-			if (i.second.type() == AddressType::Contract)
+			h256 memoryRoot;
+			if (i.second.haveMemory())
 			{
-				if (i.second.haveMemory())
-				{
-					TrieDB<u256, DB> memdb(&_db);
-					memdb.init();
-					for (auto const& j: i.second.memory())
-						if (j.second)
-							memdb.insert(j.first, rlp(j.second));
-					s << memdb.root();
-				}
-				else
-					s << i.second.oldRoot();
+				TrieDB<u256, DB> memdb(&_db);
+				memdb.init();
+				std::vector<std::pair<u256, bytes>> memory;
+				for (auto const& j: i.second.memory())
+					if (j.second)
+						memory.push_back(std::make_pair(j.first, rlp(j.second)));
+				memdb.applyBatch(memory);
+				memoryRoot = memdb.root();
 			}
-			_state.insert(i.first, &s.out());
+			else
+				memoryRoot = i.second.oldRoot();
+			batch.push_back(std::make_pair(i.first, rlpList(i.second.balance(), i.second.nonce(), memoryRoot)));
 		}
-}
+		else
+			batch.push_back(std::make_pair(i.first, rlpList(i.second.balance(), i.second.nonce())));
 
+	// in key order, so that neighbouring accounts' shared nodes are visited together.
+	std::sort(batch.begin(), batch.end(), [](std::pair<Address, bytes> const& _a, std::pair<Address, bytes> const& _b) { return _a.first < _b.first; });
+	_state.applyBatch(batch);
 }
 
-
+}
@@ -22,21 +22,25 @@
 #include <secp256k1.h>
 #include "vector_ref.h"
 #include "Exceptions.h"
+#include "RLPSchema.h"
 #include "Transaction.h"
 using namespace std;
 using namespace eth;
 
+/// nonce, receiveAddress, value, fee, data, v, r, s.
+using TransactionSchema = RLPSchema<RLPInt<u256>, RLPHash<20>, RLPInt<u256>, RLPInt<u256>, RLPListOf<RLPInt<u256>>, RLPInt<byte>, RLPInt<u256>, RLPInt<u256>>;
+
 Transaction::Transaction(bytesConstRef _rlpData)
 {
-	RLP rlp(_rlpData);
-	nonce = rlp[0].toInt<u256>();
-	receiveAddress = rlp[1].toHash<Address>();
-	value = rlp[2].toInt<u256>();
-	fee = rlp[3].toInt<u256>();
-	data.reserve(rlp[4].itemCountStrict());
-	for (auto const& i: rlp[4])
-		data.push_back(i.toInt<u256>());
-	vrs = Signature{ rlp[5].toInt<byte>(), rlp[6].toInt<u256>(), rlp[7].toInt<u256>() };
+	TransactionSchema::Type t;
+	if (!TransactionSchema::decode(_rlpData, t))
+		throw InvalidTransactionFormat();
+	nonce = get<0>(t);
+	receiveAddress = get<1>(t);
+	value = get<2>(t);
+	fee = get<3>(t);
+	data = move(get<4>(t));
+	vrs = Signature{ get<5>(t), get<6>(t), get<7>(t) };
 }
 
 Address Transaction::sender() const
@@ -89,7 +93,7 @@ void Transaction::sign(Secret _priv)
 	vrs.s = (u256)sig[1];
 }
 
-void Transaction::fillStream(RLPStream& _s, bool _sig) const
+template <class _S> void Transaction::streamRLP(_S& _s, bool _sig) const
 {
 	_s.appendList(_sig ? 8 : 5);
 	_s << nonce << receiveAddress << value << fee << data;
@@ -97,6 +101,19 @@ void Transaction::fillStream(RLPStream& _s, bool _sig) const
 		_s << vrs.v << vrs.r << vrs.s;
 }
 
+void Transaction::fillStream(RLPStream& _s, bool _sig) const
+{
+	streamRLP(_s.measure(), _sig);
+	streamRLP(_s.prepare(), _sig);
+}
+
+void Transaction::fillMeasure(RLPMeasure& _m, bool _sig) const
+{
+	uint mark = _m.beginSelfPrepared();
+	streamRLP(_m, _sig);
+	_m.endSelfPrepared(mark);
+}
+
 // If the h256 return is an integer, store it in bigendian (i.e. u256 ret; ... return (h256)ret; )
 h256 Transaction::kFromMessage(h256 _msg, h256 _priv)
 {
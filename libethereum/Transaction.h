@@ -54,10 +54,15 @@ struct Transaction
 	static h256 kFromMessage(h256 _msg, h256 _priv);
 
 	void fillStream(RLPStream& _s, bool _sig = true) const;
+	/// Measures what fillStream() appends, for an outer prepare() to make room for.
+	void fillMeasure(RLPMeasure& _m, bool _sig = true) const;
 	bytes rlp(bool _sig = true) const { RLPStream s; fillStream(s, _sig); return s.out(); }
 	std::string rlpString(bool _sig = true) const { return asString(rlp(_sig)); }
 	h256 sha3(bool _sig = true) const { RLPStream s; fillStream(s, _sig); return eth::sha3(s.out()); }
 	bytes sha3Bytes(bool _sig = true) const { RLPStream s; fillStream(s, _sig); return eth::sha3Bytes(s.out()); }
+
+private:
+	template <class _S> void streamRLP(_S& _s, bool _sig) const;
 };
 
 }
@@ -40,10 +40,10 @@ public:
 
 	void drop(h256 _txHash) { m_data.erase(_txHash); }
 
-	std::map<h256, bytes> const& transactions() const { return m_data; }
+	std::unordered_map<h256, bytes> const& transactions() const { return m_data; }
 
 private:
-	std::map<h256, bytes> m_data;	///< the queue.
+	std::unordered_map<h256, bytes> m_data;	///< the queue.
 };
 
 }
@@ -19,6 +19,7 @@
  * @date 2014
  */
 
+#include "Exceptions.h"
 #include "TrieCommon.h"
 
 namespace eth
@@ -61,53 +62,47 @@ std::string hexPrefixEncode(bytesConstRef _data, bool _leaf, int _beginNibble, i
 {
 	uint begin = _beginNibble + _offset;
 	uint end = (_endNibble < 0 ? (_data.size() * 2 - _offset) + 1 + _endNibble : _endNibble) + _offset;
-	bool odd = (end - begin) & 1;
-
-	std::string ret(1, ((_leaf ? 2 : 0) | (odd ? 1 : 0)) * 16);
-	ret.reserve((end - begin) / 2 + 1);
-
-	uint d = odd ? 1 : 2;
-	for (auto i = begin; i < end; ++i, ++d)
-	{
-		byte n = nibble(_data, i);
-		if (d & 1)	// odd
-			ret.back() |= n;		// or the nibble onto the back
-		else
-			ret.push_back(n << 4);	// push the nibble on to the back << 4
-	}
+	std::string ret(hexPrefixSize(end - begin), 0);
+	hexPrefixWrite(NibbleSlice(_data, begin), end - begin, NibbleSlice(), 0, _leaf, (byte*)&ret[0]);
 	return ret;
 }
 
 std::string hexPrefixEncode(bytesConstRef _d1, uint _o1, bytesConstRef _d2, uint _o2, bool _leaf)
 {
-	uint begin1 = _o1;
-	uint end1 = _d1.size() * 2;
-	uint begin2 = _o2;
-	uint end2 = _d2.size() * 2;
-
-	bool odd = (end1 - begin1 + end2 - begin2) & 1;
+	NibbleSlice s1(_d1, _o1);
+	NibbleSlice s2(_d2, _o2);
+	std::string ret(hexPrefixSize(s1.size() + s2.size()), 0);
+	hexPrefixWrite(s1, s1.size(), s2, s2.size(), _leaf, (byte*)&ret[0]);
+	return ret;
+}
 
-	std::string ret(1, ((_leaf ? 2 : 0) | (odd ? 1 : 0)) * 16);
-	ret.reserve((end1 - begin1 + end2 - begin2) / 2 + 1);
+void hexPrefixWrite(NibbleSlice _s1, uint _n1, NibbleSlice _s2, uint _n2, bool _leaf, byte* o_out)
+{
+	bool odd = (_n1 + _n2) & 1;
+	o_out[0] = ((_leaf ? 2 : 0) | (odd ? 1 : 0)) * 16;
 
+	// Nibble d of the output goes in the high half of byte d / 2 if d is even, or the low half if odd.
 	uint d = odd ? 1 : 2;
-	for (auto i = begin1; i < end1; ++i, ++d)
-	{
-		byte n = nibble(_d1, i);
-		if (d & 1)	// odd
-			ret.back() |= n;		// or the nibble onto the back
-		else
-			ret.push_back(n << 4);	// push the nibble on to the back << 4
-	}
-	for (auto i = begin2; i < end2; ++i, ++d)
+	auto put = [&](byte _n)
 	{
-		byte n = nibble(_d2, i);
-		if (d & 1)	// odd
-			ret.back() |= n;		// or the nibble onto the back
+		if (d & 1)
+			o_out[d / 2] |= _n;
 		else
-			ret.push_back(n << 4);	// push the nibble on to the back << 4
-	}
-	return ret;
+			o_out[d / 2] = _n << 4;
+		++d;
+	};
+	for (uint i = 0; i < _n1; ++i)
+		put(_s1[i]);
+	for (uint i = 0; i < _n2; ++i)
+		put(_s2[i]);
+}
+
+void hexPrefixWrite(bytes const& _hexVector, bool _leaf, byte* o_out)
+{
+	bool odd = _hexVector.size() & 1;
+	o_out[0] = ((_leaf ? 2 : 0) | (odd ? 1 : 0)) * 16 | (odd ? _hexVector[0] : 0);
+	for (uint i = odd ? 1 : 0, d = 1; i < _hexVector.size(); i += 2, ++d)
+		o_out[d] = _hexVector[i] * 16 + _hexVector[i + 1];
 }
 
 byte uniqueInUse(RLP const& _orig, byte _except)
@@ -124,4 +119,62 @@ byte uniqueInUse(RLP const& _orig, byte _except)
 	return used;
 }
 
+std::string verifyProof(h256 _root, bytesConstRef _key, std::vector<bytes> const& _proof)
+{
+	auto p = _proof.begin();
+	auto fetch = [&](h256 _h)
+	{
+		if (p == _proof.end() || sha3(*p) != _h)
+			throw InvalidTrieProof();
+		return RLP(*p++);
+	};
+
+	// An empty trie's root node is stored as the null RLP, though it's referred to as h256().
+	RLP n = fetch(_root ? _root : sha3(RLPNull));
+	NibbleSlice k(_key);
+	std::string ret;
+	while (!n.isEmpty())
+	{
+		if (!n.isList() || (n.itemCount() != 2 && n.itemCount() != 17))
+			throw InvalidTrieProof();
+		RLP next;
+		if (n.itemCount() == 2)
+		{
+			NibbleSlice nk = keyOf(n);
+			if (isLeaf(n))
+			{
+				if (nk == k)
+					ret = n[1].toString();
+				break;
+			}
+			if (!k.contains(nk))
+				break;
+			k = k.mid(nk.size());
+			next = n[1];
+		}
+		else
+		{
+			if (!k.size())
+			{
+				ret = n[16].toString();
+				break;
+			}
+			next = n[k[0]];
+			k = k.mid(1);
+		}
+
+		if (next.isList())
+			n = next;
+		else if (next.isData() && next.size() == 32)
+			n = fetch(next.toHash<h256>());
+		else if (next.isEmpty())
+			break;
+		else
+			throw InvalidTrieProof();
+	}
+	if (p != _proof.end())
+		throw InvalidTrieProof();
+	return ret;
+}
+
 }
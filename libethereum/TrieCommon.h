@@ -21,9 +21,23 @@
 
 #pragma once
 
+#include <algorithm>
+#include <cstring>
 #include "Common.h"
 #include "RLP.h"
 
+// Nibbles are compared a 64-bit word at a time where the compiler offers byte swaps and leading-zero counts;
+// elsewhere, one at a time.
+#if defined(__GNUC__)
+#define ETH_NIBBLE_WORDS 1
+#elif defined(_MSC_VER) && defined(_M_X64)
+#define ETH_NIBBLE_WORDS 1
+#include <cstdlib>
+#include <intrin.h>
+#else
+#define ETH_NIBBLE_WORDS 0
+#endif
+
 namespace eth
 {
 
@@ -32,11 +46,60 @@ inline byte nibble(bytesConstRef _data, uint _i)
 	return (_i & 1) ? (_data[_i / 2] & 15) : (_data[_i / 2] >> 4);
 }
 
+#if ETH_NIBBLE_WORDS
+
+/// @returns the 16 nibbles of @a _data from nibble @a _i on as a big-endian word, with zeros for any past its end.
+inline uint64_t nibbleWord(bytesConstRef _data, uint _i)
+{
+	byte const* p = _data.data() + _i / 2;
+	size_t left = _data.size() - _i / 2;
+	byte buf[9];
+	if (left < 9)
+	{
+		// Near the end: copy what there is into a zeroed buffer, so the loads below stay in bounds.
+		memset(buf, 0, 9);
+		memcpy(buf, p, left);
+		p = buf;
+	}
+	uint64_t w;
+	memcpy(&w, p, 8);
+#if defined(_MSC_VER)
+	w = _byteswap_uint64(w);
+#elif !defined(__BYTE_ORDER__) || __BYTE_ORDER__ != __ORDER_BIG_ENDIAN__
+	w = __builtin_bswap64(w);
+#endif
+	return (_i & 1) ? (w << 4) | (p[8] >> 4) : w;
+}
+
+/// @returns the number of leading zero bits of @a _w, which must be non-zero.
+inline unsigned leadingZeros(uint64_t _w)
+{
+#if defined(_MSC_VER)
+	unsigned long i;
+	_BitScanReverse64(&i, _w);
+	return 63 - i;
+#else
+	return __builtin_clzll(_w);
+#endif
+}
+
+#endif
+
+/// @returns how many nibbles of @a _a from @a _ab to @a _ae match those of @a _b from @a _bb to @a _be before the first
+/// difference. Compares 16 nibbles at a time where it can: the leading zero bits of the words' xor give the place they part.
 inline uint sharedNibbles(bytesConstRef _a, uint _ab, uint _ae, bytesConstRef _b, uint _bb, uint _be)
 {
+	uint n = std::min(_ae - _ab, _be - _bb);
+#if ETH_NIBBLE_WORDS
+	for (uint ret = 0; ret < n; ret += 16)
+		if (uint64_t x = nibbleWord(_a, _ab + ret) ^ nibbleWord(_b, _bb + ret))
+			return std::min<uint>(n, ret + leadingZeros(x) / 4);
+	return n;
+#else
 	uint ret = 0;
-	for (uint ai = _ab, bi = _bb; ai < _ae && bi < _be && nibble(_a, ai) == nibble(_b, bi); ++ai, ++bi, ++ret) {}
+	for (; ret < n && nibble(_a, _ab + ret) == nibble(_b, _bb + ret); ++ret) {}
 	return ret;
+#endif
 }
 
 struct NibbleSlice
@@ -49,7 +112,7 @@ struct NibbleSlice
 	uint size() const { return data.size() * 2 - offset; }
 	NibbleSlice mid(uint _index) const { return NibbleSlice(data, offset + _index); }
 
-	bool contains(NibbleSlice _k) const { return shared(_k) == _k.size(); }
+	bool contains(NibbleSlice _k) const { return _k.size() <= size() && shared(_k) == _k.size(); }
 	uint shared(NibbleSlice _k) const { return sharedNibbles(data, offset, offset + size(), _k.data, _k.offset, _k.offset + _k.size()); }
 	bool operator==(NibbleSlice _k) const { return _k.size() == size() && shared(_k) == _k.size(); }
 	bool operator!=(NibbleSlice _s) const { return !operator==(_s); }
@@ -85,6 +148,15 @@ inline NibbleSlice keyOf(RLP const& _twoItem)
 }
 
 byte uniqueInUse(RLP const& _orig, byte _except);
+
+/// @returns the bytes taken by the hex-prefix encoding of @a _nibbles nibbles.
+inline uint hexPrefixSize(uint _nibbles) { return _nibbles / 2 + 1; }
+/// Writes the hex-prefix encoding of the first @a _n1 nibbles of @a _s1 followed by the first @a _n2 of @a _s2 to
+/// @a o_out, which must have room for hexPrefixSize(@a _n1 + @a _n2) bytes.
+void hexPrefixWrite(NibbleSlice _s1, uint _n1, NibbleSlice _s2, uint _n2, bool _leaf, byte* o_out);
+/// As above, for the nibbles of @a _hexVector, one to a byte.
+void hexPrefixWrite(bytes const& _hexVector, bool _leaf, byte* o_out);
+
 std::string hexPrefixEncode(bytes const& _hexVector, bool _leaf = false, int _begin = 0, int _end = -1);
 std::string hexPrefixEncode(bytesConstRef _data, bool _leaf, int _beginNibble, int _endNibble, uint _offset);
 std::string hexPrefixEncode(bytesConstRef _d1, uint _o1, bytesConstRef _d2, uint _o2, bool _leaf);
@@ -99,4 +171,10 @@ inline std::string hexPrefixEncode(NibbleSlice _s1, NibbleSlice _s2, bool _leaf)
 	return hexPrefixEncode(_s1.data, _s1.offset, _s2.data, _s2.offset, _leaf);
 }
 
+/// Checks @a _proof, the RLP of the nodes from the root down along @a _key as given by GenericTrieDB::prove(),
+/// against @a _root, which is h256() for the empty trie. Needs no DB.
+/// @returns the value of @a _key in the trie, or an empty string if the proof shows there is none.
+/// @throws InvalidTrieProof if @a _proof is not exactly the nodes of that path in a trie with root @a _root.
+std::string verifyProof(h256 _root, bytesConstRef _key, std::vector<bytes> const& _proof);
+
 }
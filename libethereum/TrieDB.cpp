@@ -29,4 +29,45 @@ namespace eth
 
 const h256 c_shaNull = sha3(rlp(""));
 
+const bytes c_emptyBranch = []()
+{
+	RLPStream s(17);
+	for (unsigned i = 0; i < 17; ++i)
+		s << "";
+	return s.out();
+}();
+
+std::string ConcurrentNodeStore::lookup(h256 _h) const
+{
+	{
+		Shard& s = shard(_h);
+		std::lock_guard<std::mutex> l(s.lock);
+		auto it = s.nodes.find(_h);
+		if (it != s.nodes.end())
+			return it->second;
+	}
+	std::string ret;
+	if (m_db)
+		m_db->Get(m_readOptions, ldb::Slice((char const*)_h.data(), 32), &ret);
+	return ret;
+}
+
+void ConcurrentNodeStore::insert(h256 _h, bytesConstRef _v)
+{
+	Shard& s = shard(_h);
+	std::lock_guard<std::mutex> l(s.lock);
+	s.nodes.insert(std::make_pair(_h, _v.toString()));
+}
+
+size_t ConcurrentNodeStore::size() const
+{
+	size_t ret = 0;
+	for (auto const& s: m_shards)
+	{
+		std::lock_guard<std::mutex> l(s.lock);
+		ret += s.nodes.size();
+	}
+	return ret;
+}
+
 }
@@ -22,9 +22,14 @@
 #pragma once
 
 #include <map>
+#include <list>
 #include <memory>
+#include <mutex>
+#include <array>
 #include <leveldb/db.h>
+#include "Arena.h"
 #include "TrieCommon.h"
+#include "WorkerPool.h"
 namespace ldb = leveldb;
 
 namespace eth
@@ -38,21 +43,110 @@ public:
 	virtual void killNode(h256 _h) = 0;
 };
 
+/// A trie node's RLP, shared immutably between the node cache and its readers.
+using NodeRef = std::shared_ptr<std::string const>;
+
+/**
+ * @brief Least-recently-used cache of trie nodes by hash, kept within a memory budget.
+ * Nodes are content-addressed so an entry never goes stale; entries leave only to keep within the budget.
+ * Copying gives an empty cache with the same budget.
+ */
+class NodeCache
+{
+public:
+	static const size_t c_defaultBudget = 16 * 1024 * 1024;
+
+	NodeCache(size_t _budget = c_defaultBudget): m_budget(_budget) {}
+	NodeCache(NodeCache const& _c): m_budget(_c.m_budget) {}
+	NodeCache& operator=(NodeCache const& _c) { clear(); m_budget = _c.m_budget; return *this; }
+
+	/// @returns the node @a _h, from the cache if there or else from @a _fetch (a function returning the RLP as a std::string).
+	/// @returns an empty string if there is no such node.
+	template <class _F> NodeRef lookup(h256 const& _h, _F const& _fetch)
+	{
+		auto it = m_entries.find(_h);
+		if (it != m_entries.end())
+		{
+			++m_hits;
+			m_ages.splice(m_ages.begin(), m_ages, it->second.age);
+			return it->second.node;
+		}
+		++m_misses;
+		std::string s = _fetch();
+		if (s.empty())
+			return empty();
+		NodeRef ret = std::make_shared<std::string const>(std::move(s));
+		m_ages.push_front(_h);
+		m_entries.insert(std::make_pair(_h, Entry{ret, m_ages.begin()}));
+		m_used += cost(*ret);
+		evict();
+		return ret;
+	}
+
+	void clear() { m_entries.clear(); m_ages.clear(); m_used = 0; }
+	void setBudget(size_t _bytes) { m_budget = _bytes; evict(); }
+
+	size_t budget() const { return m_budget; }
+	size_t used() const { return m_used; }			///< Approximate bytes held, including bookkeeping.
+	size_t count() const { return m_entries.size(); }
+
+	uint hits() const { return m_hits; }
+	uint misses() const { return m_misses; }
+	void resetCounters() { m_hits = m_misses = 0; }
+
+	/// @returns the shared empty node.
+	static NodeRef const& empty() { static NodeRef const s_empty = std::make_shared<std::string const>(); return s_empty; }
+
+private:
+	/// Rough cost of an entry's bookkeeping: map and list nodes, the shared string's control block and header.
+	static const size_t c_entryOverhead = 160;
+
+	static size_t cost(std::string const& _node) { return _node.size() + c_entryOverhead; }
+
+	void evict()
+	{
+		while (m_used > m_budget && !m_ages.empty())
+		{
+			auto it = m_entries.find(m_ages.back());
+			m_used -= cost(*it->second.node);
+			m_entries.erase(it);
+			m_ages.pop_back();
+		}
+	}
+
+	struct Entry
+	{
+		NodeRef node;
+		std::list<h256>::iterator age;
+	};
+
+	std::unordered_map<h256, Entry> m_entries;
+	std::list<h256> m_ages;			///< Keys of m_entries, most recently used first.
+	size_t m_budget;
+	size_t m_used = 0;
+	uint m_hits = 0;
+	uint m_misses = 0;
+};
+
 class BasicMap
 {
 public:
 	BasicMap() {}
 
 	void clear() { m_over.clear(); }
-	std::map<h256, std::string> const& get() const { return m_over; }
+	std::unordered_map<h256, std::string> const& get() const { return m_over; }
 
 	std::string lookup(h256 _h) const { auto it = m_over.find(_h); if (it != m_over.end()) return it->second; return std::string(); }
 	void insert(h256 _h, bytesConstRef _v) { m_over[_h] = _v.toString(); m_refCount[_h]++; }
 	void kill(h256 _h) { if (!--m_refCount[_h]) m_over.erase(_h); }
 
+	/// The decoded-node cache shared by all tries opened on this map.
+	NodeCache& nodeCache() const { return m_nodeCache; }
+
 protected:
-	std::map<h256, std::string> m_over;
-	std::map<h256, uint> m_refCount;
+	std::unordered_map<h256, std::string> m_over;
+	std::unordered_map<h256, uint> m_refCount;
+	mutable NodeCache m_nodeCache;
 };
 
 inline std::ostream& operator<<(std::ostream& _out, BasicMap const& _m)
@@ -89,12 +183,100 @@ private:
 	ldb::WriteOptions m_writeOptions;
 };
 
+/**
+ * @brief NodeCache split by hash into independently locked shards, so that any number of threads may look up at once.
+ * The budget is spread evenly between the shards.
+ */
+class ConcurrentNodeCache
+{
+public:
+	ConcurrentNodeCache(size_t _budget = NodeCache::c_defaultBudget) { setBudget(_budget); }
+
+	/// As NodeCache::lookup(); @a _fetch is called with the shard locked, so must not itself use this cache.
+	template <class _F> NodeRef lookup(h256 const& _h, _F const& _fetch)
+	{
+		Shard& s = shard(_h);
+		std::lock_guard<std::mutex> l(s.lock);
+		return s.cache.lookup(_h, _fetch);
+	}
+
+	void clear() { for (auto& s: m_shards) { std::lock_guard<std::mutex> l(s.lock); s.cache.clear(); } }
+	void setBudget(size_t _bytes) { for (auto& s: m_shards) { std::lock_guard<std::mutex> l(s.lock); s.cache.setBudget(_bytes / c_shards); } }
+
+	size_t used() const { size_t ret = 0; for (auto& s: m_shards) { std::lock_guard<std::mutex> l(s.lock); ret += s.cache.used(); } return ret; }
+	uint hits() const { uint ret = 0; for (auto& s: m_shards) { std::lock_guard<std::mutex> l(s.lock); ret += s.cache.hits(); } return ret; }
+	uint misses() const { uint ret = 0; for (auto& s: m_shards) { std::lock_guard<std::mutex> l(s.lock); ret += s.cache.misses(); } return ret; }
+
+private:
+	static const unsigned c_shards = 16;
+
+	struct Shard
+	{
+		mutable std::mutex lock;
+		NodeCache cache;
+	};
+
+	/// Hashes are uniform, so the first byte spreads nodes evenly.
+	Shard& shard(h256 const& _h) { return m_shards[_h[0] % c_shards]; }
+
+	std::array<Shard, c_shards> m_shards;
+};
+
+/**
+ * @brief A trie node store that any number of threads may read while one writes: the nodes inserted, else those
+ * already in a LevelDB.
+ * Nodes are content-addressed and never change, so a reader at any root it has seen may walk the trie without taking
+ * a lock beyond that of the shard it reads from. Nodes are never removed (kill() does nothing), since a reader may
+ * still be at an older root that needs them; like Overlay over LevelDB, space is traded for simplicity.
+ */
+class ConcurrentNodeStore
+{
+public:
+	/// Reads through to @a _db (which is not owned and may be shared; LevelDB reads are thread-safe) for nodes not inserted.
+	explicit ConcurrentNodeStore(ldb::DB* _db = nullptr): m_db(_db) {}
+
+	std::string lookup(h256 _h) const;
+	void insert(h256 _h, bytesConstRef _v);
+	void kill(h256) {}
+
+	/// Nodes inserted (not counting those in the LevelDB).
+	size_t size() const;
+
+	/// The decoded-node cache shared by all tries opened on this store, whichever thread they are used from.
+	ConcurrentNodeCache& nodeCache() const { return m_nodeCache; }
+
+private:
+	static const unsigned c_shards = 16;
+
+	struct Shard
+	{
+		mutable std::mutex lock;
+		std::unordered_map<h256, std::string> nodes;
+	};
+
+	Shard& shard(h256 const& _h) const { return m_shards[_h[0] % c_shards]; }
+
+	mutable std::array<Shard, c_shards> m_shards;
+	ldb::DB* m_db;
+	ldb::ReadOptions m_readOptions;
+	mutable ConcurrentNodeCache m_nodeCache;
+};
+
 #if WIN32
 #pragma warning(push)
 #pragma warning(disable:4100) // disable warnings so it compiles
 #endif
 
 extern const h256 c_shaNull;
+extern const bytes c_emptyBranch;	///< A branch node with all seventeen items empty.
+
+/// A run of a trie's keys, from an iterator that stops by itself (see GenericTrieDB::iterator::stopAt()).
+template <class _It> struct TrieRange
+{
+	_It first;
+	_It begin() const { return first; }
+	_It end() const { return _It(); }
+};
 
 /**
  * @brief Merkle Patricia Tree "Trie": a modifed base-16 Radix tree.
@@ -106,21 +288,93 @@ class GenericTrieDB
 public:
 	GenericTrieDB(DB* _db): m_db(_db) {}
 	GenericTrieDB(DB* _db, h256 _root) { open(_db, _root); }
+	/// @a _t mustn't have deferred changes not yet flushed.
+	GenericTrieDB(GenericTrieDB const& _t): m_root(_t.m_root), m_db(_t.m_db), m_pool(_t.m_pool), m_deferred(_t.m_deferred), m_pinLevels(_t.m_pinLevels), m_pinBudget(_t.m_pinBudget) { assert(!_t.m_dirty); }
+	/// @a _t mustn't have deferred changes not yet flushed; any of ours are dropped.
+	GenericTrieDB& operator=(GenericTrieDB const& _t) { assert(!_t.m_dirty); dropDeferred(); m_root = _t.m_root; m_db = _t.m_db; m_pool = _t.m_pool; m_deferred = _t.m_deferred; setPinnedLevels(_t.m_pinLevels, _t.m_pinBudget); return *this; }
+	/// Any deferred changes not yet flushed are dropped, leaving the DB as it was before them.
 	~GenericTrieDB() {}
 
-	void open(DB* _db, h256 _root) { setRoot(_root); m_db = _db; assert(node(m_root).size()); }
+	void open(DB* _db, h256 _root) { flush(); m_db = _db; setRoot(_root); }
 
 	void init();
-	void setRoot(h256 _root) { m_root = _root == h256() ? c_shaNull : _root; /*std::cout << "Setting root to " << _root << " (patched to " << m_root << ")" << std::endl;*/ assert(node(m_root).size()); }
+	void setRoot(h256 _root) { flush(); m_root = _root == h256() ? c_shaNull : _root; /*std::cout << "Setting root to " << _root << " (patched to " << m_root << ")" << std::endl;*/ assert(node(m_root)->size()); }
+
+	/// Sets whether changes are deferred. While they are, changed nodes are kept decoded in memory and are neither
+	/// stored nor killed until flush() is called, so a node changed again before then never reaches the DB, which
+	/// still holds the old root. at() and root() see the changes; iterating, proving, diffing and copying need them
+	/// flushed first. Changes not flushed by the time the trie is destroyed are dropped.
+	void setDeferred(bool _deferred) { m_deferred = _deferred; if (!_deferred) flush(); }
+	bool isDeferred() const { return m_deferred; }
+	/// Kills the nodes replaced by any deferred changes, then encodes, hashes and stores the changes, updating the root.
+	void flush();
+
+	/// Sets the pool across which flush() builds the changed subtrees of the topmost branch; null (the default) for none.
+	/// The result is the same either way; only the DB's insert() must be called from one thread at a time.
+	void setWorkerPool(WorkerPool* _pool) { m_pool = _pool; }
+
+	/// Keeps the top @a _levels levels of the trie in memory, decoded, as far as @a _budget bytes go (upper levels first).
+	/// Reads of their nodes then go to neither the node cache nor the DB. They follow the root as it moves: on the first
+	/// read after, nodes still in the trie are kept and only new ones are read in. 0 levels (the default) keeps none.
+	void setPinnedLevels(unsigned _levels, size_t _budget = c_defaultPinBudget) { m_pinLevels = _levels; m_pinBudget = _budget; m_pinnedRoot.reset(); m_pinnedAt = h256(); m_pinnedByHash.clear(); m_pinnedBytes = 0; }
+	unsigned pinnedLevels() const { return m_pinLevels; }
+	/// Bytes used by the pinned levels, including bookkeeping.
+	size_t pinnedBytes() const { return m_pinnedBytes; }
+
+	struct PinStats
+	{
+		uint hits = 0;		///< Node reads served by the pinned levels.
+		uint loads = 0;		///< Nodes read in to bring them up to date.
+	};
+	PinStats const& pinStats() const { return m_pinStats; }
+	void resetPinStats() { m_pinStats = PinStats(); }
 
-	h256 root() const { assert(node(m_root).size()); h256 ret = (m_root == c_shaNull ? h256() : m_root); /*std::cout << "Returning root as " << ret << " (really " << m_root << ")" << std::endl;*/ return ret; }	// patch the root in the case of the empty trie. TODO: handle this properly.
+	/// With deferred changes not yet flushed, each call encodes and hashes them afresh, storing nothing.
+	h256 root() const { if (m_dirty) return dirtyRootHash(); assert(node(m_root)->size()); h256 ret = (m_root == c_shaNull ? h256() : m_root); /*std::cout << "Returning root as " << ret << " (really " << m_root << ")" << std::endl;*/ return ret; }	// patch the root in the case of the empty trie. TODO: handle this properly.
 
 	void debugPrint() {}
 
 	std::string at(bytesConstRef _key) const;
+	/// As at(), for a trie all of whose keys are @a _Bytes long, as TrieDB's are. The key is split into nibbles once,
+	/// and the descent is a loop that can take each node's key to end no later than ours does.
+	template <unsigned _Bytes> std::string atFixed(bytesConstRef _key) const;
 	void insert(bytesConstRef _key, bytesConstRef _value);
 	void remove(bytesConstRef _key);
 
+	/// @returns the RLP of each stored node from the root down along @a _key, as far as the trie shows its value or
+	/// its absence. Nodes small enough to be inline in their parent aren't repeated. Check it with verifyProof().
+	std::vector<bytes> prove(bytesConstRef _key) const;
+
+	/// Calls @a _f(key, value in @a _from, value in @a _to) in order of key for each key whose value differs between the
+	/// tries with roots @a _from and @a _to, both in this trie's DB. A value is empty where its trie lacks the key.
+	/// The two are walked together, and subtrees they share (by hash) aren't entered.
+	template <class _F> void diff(h256 _from, h256 _to, _F const& _f) const;
+
+	/// A key whose value differs between two tries: empty @a from if it was added, empty @a to if it was removed.
+	struct Change
+	{
+		bytes key;
+		bytes from;
+		bytes to;
+	};
+	/// @returns the keys whose values differ between the tries with roots @a _from and @a _to, in order.
+	std::vector<Change> diff(h256 _from, h256 _to) const
+	{
+		std::vector<Change> ret;
+		diff(_from, _to, [&](bytesConstRef _k, bytesConstRef _a, bytesConstRef _b) { ret.push_back(Change{_k.toBytes(), _a.toBytes(), _b.toBytes()}); });
+		return ret;
+	}
+
+	/// A key and the value to give it; an empty value removes the key.
+	using BatchItem = std::pair<bytesConstRef, bytesConstRef>;
+
+	/// Inserts and removes all of @a _batch in one descent: each node on the paths of the batch's keys is fetched once,
+	/// updated for every key beneath it, and encoded and hashed once at the end. Later items for the same key win.
+	/// Leaves the trie as the same sequence of insert() and remove() calls would. Best given sorted by key.
+	void applyBatch(vector_ref<BatchItem const> _batch);
+
+	/// Iterates over the trie's keys in order. Nodes aren't copied: each level of the trail refers into a node held
+	/// (shared) from the DB's node cache, so the refs given out stay valid until the iterator moves on.
 	class iterator
 	{
 	public:
@@ -129,10 +383,13 @@ public:
 		iterator() {}
 		iterator(GenericTrieDB const* _db)
 		{
+			assert(!_db->m_dirty);
 			m_that = _db;
-			m_trail.push_back(Node{_db->node(_db->m_root), std::string(1, '\0'), 255});	// one null byte is the HPE for the empty key.
+			pushRoot();
 			next();
 		}
+		/// Creates an iterator at the first key no less than @a _key.
+		iterator(GenericTrieDB const* _db, bytesConstRef _key);
 
 		iterator& operator++()
 		{
@@ -143,24 +400,67 @@ public:
 		value_type operator*() const { return at(); }
 		value_type operator->() const { return at(); }
 
-		bool operator==(iterator const& _c) const { return _c.m_trail == m_trail; }
-		bool operator!=(iterator const& _c) const { return _c.m_trail != m_trail; }
+		bool operator==(iterator const& _c) const { return _c.m_that == m_that && _c.m_key == m_key; }
+		bool operator!=(iterator const& _c) const { return !operator==(_c); }
 
 		value_type at() const
 		{
 			assert(m_trail.size());
-			Node const& b = m_trail.back();
-			assert(b.key.size());
-			assert(!(b.key[0] & 0x10));	// should be an integer number of bytes (i.e. not an odd number of nibbles).
+			RLP rlp(m_trail.back().rlp);
+			return std::make_pair(bytesConstRef(&m_keyBytes), rlp[rlp.itemCount() == 2 ? 1 : 16].payload());
+		}
 
-			RLP rlp(b.rlp);
-			if (rlp.itemCount() == 2)
-				return std::make_pair(bytesConstRef(b.key).cropped(1), rlp[1].payload());
-			else
-				return std::make_pair(bytesConstRef(b.key).cropped(1), rlp[16].payload());
+		/// Ends the iteration (making this equal to end()) at the first key no less than @a _end.
+		iterator& stopAt(bytesConstRef _end)
+		{
+			m_stop = _end.toBytes();
+			m_bounded = true;
+			if (m_that && !settle())
+				next();
+			return *this;
 		}
 
 	private:
+		struct Node
+		{
+			NodeRef pin;			///< Keeps the data of rlp alive; shared with the parent if rlp is inline in it.
+			bytesConstRef rlp;
+			unsigned keyLen;		///< Nibbles of m_key leading to this node, including its own if it's a leaf or extension once entered.
+			byte child;				///< 255 -> entering; for a branch, 16 is its value.
+
+			void incrementChild() { child = child == 16 ? 0 : child == 15 ? 17 : (child + 1); }
+		};
+
+		void pushRoot()
+		{
+			NodeRef r = m_that->node(m_that->m_root);
+			m_trail.push_back(Node{r, bytesConstRef(*r), 0, 255});
+		}
+
+		/// @returns the node for @a _r, an item of @a _parent, to be entered with @a _keyLen nibbles of key.
+		Node childOf(Node const& _parent, RLP const& _r, unsigned _keyLen) const
+		{
+			if (_r.isList())
+				return Node{_parent.pin, _r.data(), _keyLen, 255};
+			NodeRef n = m_that->node(_r.toHash<h256>());
+			return Node{n, bytesConstRef(*n), _keyLen, 255};
+		}
+
+		/// Takes the key we're at from m_key; @returns false (and empties the trail) if it's past where we stop.
+		bool settle()
+		{
+			assert(!(m_key.size() % 2));	// should be an integer number of bytes (i.e. not an odd number of nibbles).
+			m_keyBytes.resize(m_key.size() / 2);
+			for (unsigned i = 0; i < m_keyBytes.size(); ++i)
+				m_keyBytes[i] = (byte)(m_key[i * 2] * 16 + m_key[i * 2 + 1]);
+			if (m_bounded && !std::lexicographical_compare(m_keyBytes.begin(), m_keyBytes.end(), m_stop.begin(), m_stop.end()))
+			{
+				m_trail.clear();
+				return false;
+			}
+			return true;
+		}
+
 		void next()
 		{
 			while (true)
@@ -168,13 +468,15 @@ public:
 				if (m_trail.empty())
 				{
 					m_that = nullptr;
+					m_key.clear();
+					m_keyBytes.clear();
 					return;
 				}
 
-				Node const& b = m_trail.back();
+				Node& b = m_trail.back();
 				RLP rlp(b.rlp);
 
-				if (m_trail.back().child == 255)
+				if (b.child == 255)
 				{
 					// Entering. Look for first...
 					if (rlp.isEmpty())
@@ -182,36 +484,31 @@ public:
 						m_trail.pop_back();
 						continue;
 					}
-					if (!(rlp.isList() && (rlp.itemCount() == 2 || rlp.itemCount() == 17)))
-					{
-						cdebug << b.rlp.size() << asHex(b.rlp);
-						cdebug << rlp;
-						auto c = rlp.itemCount();
-						cdebug << c;
-						assert(rlp.isList() && (rlp.itemCount() == 2 || rlp.itemCount() == 17));
-					}
+					assert(rlp.isList() && (rlp.itemCount() == 2 || rlp.itemCount() == 17));
 					if (rlp.itemCount() == 2)
 					{
-						// Just turn it into a valid Branch
-						m_trail.back().key = hexPrefixEncode(keyOf(m_trail.back().key), keyOf(rlp), false);
+						// Take on its part of the key.
+						m_key.resize(b.keyLen);
+						NibbleSlice k = keyOf(rlp);
+						for (unsigned i = 0; i < k.size(); ++i)
+							m_key.push_back(k[i]);
 						if (isLeaf(rlp))
 						{
 							// leaf - exit now.
-							m_trail.back().child = 0;
-							return;
+							b.keyLen = m_key.size();
+							b.child = 0;
+							if (settle())
+								return;
+							continue;
 						}
 
-						// enter child.
-						m_trail.back().rlp = m_that->deref(rlp[1]);
-						// no need to set .child as 255 - it's already done.
+						// enter child in its place.
+						b = childOf(b, rlp[1], m_key.size());
 						continue;
 					}
 					else
-					{
 						// Already a branch - look for first valid.
-						m_trail.back().setFirstChild();
-						// run through to...
-					}
+						b.child = 16;
 				}
 				else
 				{
@@ -221,93 +518,99 @@ public:
 						m_trail.pop_back();
 						continue;
 					}
-					// else run through to...
-					m_trail.back().incrementChild();
+					b.incrementChild();
 				}
 
-				// ...here. should only get here if we're a list.
-				assert(rlp.isList() && rlp.itemCount() == 17);
-				for (;; m_trail.back().incrementChild())
-					if (m_trail.back().child == 17)
+				// ...here. should only get here if we're a branch.
+				for (;; b.incrementChild())
+					if (b.child == 17)
 					{
 						// finished here.
 						m_trail.pop_back();
 						break;
 					}
-					else if (!rlp[m_trail.back().child].isEmpty())
+					else if (!rlp[b.child].isEmpty())
 					{
-						if (m_trail.back().child == 16)
-							return;	// have a value at this node - exit now.
-						else
+						m_key.resize(b.keyLen);
+						if (b.child == 16)
 						{
-							// lead-on to another node - enter child.
-							m_trail.push_back(m_trail.back());
-							m_trail.back().key = hexPrefixEncode(keyOf(m_trail.back().key), NibbleSlice(bytesConstRef(&m_trail.back().child, 1), 1), false);
-							m_trail.back().rlp = m_that->deref(rlp[m_trail.back().child]);
-							m_trail.back().child = 255;
+							// have a value at this node - exit now.
+							if (settle())
+								return;
 							break;
 						}
+						// lead-on to another node - enter child.
+						m_key.push_back(b.child);
+						m_trail.push_back(childOf(b, rlp[b.child], m_key.size()));
+						break;
 					}
 			}
 		}
 
-		struct Node
-		{
-			std::string rlp;
-			std::string key;		// as hexPrefixEncoding.
-			byte child;				// 255 -> entering
-
-			void setFirstChild() { child = 16; }
-			void incrementChild() { child = child == 16 ? 0 : child == 15 ? 17 : (child + 1); }
-
-			bool operator==(Node const& _c) const { return rlp == _c.rlp && key == _c.key && child == _c.child; }
-			bool operator!=(Node const& _c) const { return !operator==(_c); }
-		};
-
 		std::vector<Node> m_trail;
-		GenericTrieDB<DB> const* m_that;
+		bytes m_key;				///< The key, as nibbles, up to the node we're in.
+		bytes m_keyBytes;			///< The key we're at.
+		bytes m_stop;
+		bool m_bounded = false;
+		GenericTrieDB<DB> const* m_that = nullptr;
 	};
 
 	iterator begin() const { return this; }
 	iterator end() const { return iterator(); }
 
+	/// @returns an iterator at the first key no less than @a _key.
+	iterator lower_bound(bytesConstRef _key) const { return iterator(this, _key); }
+	/// @returns the keys in [@a _begin, @a _end), for use with range-based for.
+	TrieRange<iterator> range(bytesConstRef _begin, bytesConstRef _end) const { return TrieRange<iterator>{lower_bound(_begin).stopAt(_end)}; }
+	/// @returns the keys starting with @a _prefix, for use with range-based for.
+	TrieRange<iterator> prefixed(bytesConstRef _prefix) const;
+
 private:
-	RLPStream& streamNode(RLPStream& _s, bytes const& _b);
+	/// Forgets any deferred changes not yet flushed.
+	void dropDeferred() { m_dirtyRoot.reset(); m_pins.clear(); m_kills.clear(); m_dirty = false; }
+	/// @returns the root the deferred changes would give, without storing them.
+	h256 dirtyRootHash() const;
 
 	std::string atAux(RLP const& _here, NibbleSlice _key) const;
 
-	void mergeAtAux(RLPStream& _out, RLP const& _replace, NibbleSlice _key, bytesConstRef _value);
-	bytes mergeAt(RLP const& _replace, NibbleSlice _k, bytesConstRef _v);
+	// insert() and remove() make their nodes in m_scratch: each of these returns RLP held there until the next call.
 
-	bool deleteAtAux(RLPStream& _out, RLP const& _replace, NibbleSlice _key);
-	bytes deleteAt(RLP const& _replace, NibbleSlice _k);
+	/// @returns the RLP by which a parent refers to the node @a _n: the node itself if small, else its hash, once stored.
+	bytesConstRef childRef(bytesConstRef _n);
+
+	bytesConstRef mergeAtAux(RLP const& _replace, NibbleSlice _key, bytesConstRef _value);
+	bytesConstRef mergeAt(RLP const& _replace, NibbleSlice _k, bytesConstRef _v);
+
+	/// @returns the new child RLP, or an empty ref if @a _key wasn't found.
+	bytesConstRef deleteAtAux(RLP const& _replace, NibbleSlice _key);
+	bytesConstRef deleteAt(RLP const& _replace, NibbleSlice _k);
 
 	// in: null (DEL)  -- OR --  [_k, V] (DEL)
 	// out: [_k, _s]
 	// -- OR --
 	// in: [V0, ..., V15, S16] (DEL)  AND  _k == {}
 	// out: [V0, ..., V15, _s]
-	bytes place(RLP const& _orig, NibbleSlice _k, bytesConstRef _s);
+	bytesConstRef place(RLP const& _orig, NibbleSlice _k, bytesConstRef _s);
 
 	// in: [K, S] (DEL)
 	// out: null
 	// -- OR --
 	// in: [V0, ..., V15, S] (DEL)
 	// out: [V0, ..., V15, null]
-	bytes remove(RLP const& _orig);
+	bytesConstRef remove(RLP const& _orig);
 
 	// in: [K1 & K2, V] (DEL) : nibbles(K1) == _s, 0 < _s <= nibbles(K1 & K2)
 	// out: [K1, H] ; [K2, V] => H (INS)  (being  [K1, [K2, V]]  if necessary)
-	bytes cleve(RLP const& _orig, uint _s);
+	bytesConstRef cleve(RLP const& _orig, uint _s);
 
 	// in: [K1, H] (DEL) ; H <= [K2, V] (DEL)  (being  [K1, [K2, V]] (DEL)  if necessary)
 	// out: [K1 & K2, V]
-	bytes graft(RLP const& _orig);
+	bytesConstRef graft(RLP const& _orig);
 
 	// in: [V0, ... V15, S] (DEL)
 	// out1: [k{i}, Vi]    where i < 16
 	// out2: [k{}, S]      where i == 16
-	bytes merge(RLP const& _orig, byte _i);
+	bytesConstRef merge(RLP const& _orig, byte _i);
 
 	// in: [k{}, S] (DEL)
 	// out: [null ** 16, S]
@@ -317,20 +620,130 @@ private:
 	// -- OR --
 	// in: [k{i}K, V] (DEL)
 	// out: [null ** i, H, null ** (16 - i)] ; [K, V] => H (INS)  (being [null ** i, [K, V], null ** (16 - i)]  if necessary)
-	bytes branch(RLP const& _orig);
+	bytesConstRef branch(RLP const& _orig);
 
 	bool isTwoItemNode(RLP const& _n) const;
-	std::string deref(RLP const& _n) const;
 
-	std::string node(h256 _h) const { return m_db->lookup(_h); }
+	/// A node being rewritten by applyBatch() or a deferred change. Children not (yet) visited are left as their original RLP in refs.
+	struct BatchNode
+	{
+		enum Kind { Leaf, Extension, Branch };
+
+		Kind kind;
+		bytes key;								///< As nibbles; leaf and extension only.
+		std::string value;						///< Leaf and branch only.
+		std::unique_ptr<BatchNode> nodes[16];	///< Decoded children; an extension's child is [0].
+		bytesConstRef refs[16];					///< Undecoded children's RLP; empty if none.
+	};
+	using BatchNodePtr = std::unique_ptr<BatchNode>;
+
+	/// Decodes the node @a _rlp, whose data must outlive the result; null if it is empty.
+	static BatchNodePtr decodeBatchNode(bytesConstRef _rlp);
+	/// @returns the decoded root, decoding it (and marking its stored node for killing at flush()) if not done already.
+	BatchNodePtr& dirtyRoot();
+	/// @returns child @a _i of @a _n, decoding it (and marking its stored node for killing at flush()) if not done already.
+	BatchNodePtr& batchChild(BatchNode& _n, unsigned _i);
+	void batchInsert(BatchNodePtr& io_n, NibbleSlice _k, bytesConstRef _v);
+	bool batchRemove(BatchNodePtr& io_n, NibbleSlice _k);
+	/// Restores the trie's invariants at @a io_n after a removal beneath it.
+	void normalizeBatchNode(BatchNodePtr& io_n);
+	/// A node made while encoding, to be stored later; its RLP is held by the arena it was encoded into.
+	using NewNode = std::pair<h256, bytesConstRef>;
+	/// Where encodeBatchNode() makes its nodes: each is measured and written to @a stream in one pass, then copied
+	/// into @a arena. Those referred to by hash are added to @a made.
+	struct BatchEncoder
+	{
+		Arena& arena;
+		RLPStream& stream;
+		std::vector<NewNode>& made;
+	};
+	/// @returns the RLP of @a _n, held by @a io_e's arena. Changed children are added to its made, to be stored by the caller.
+	static bytesConstRef encodeBatchNode(BatchNode const& _n, BatchEncoder& io_e);
+	/// Streams @a _n given its hex-prefixed @a _key (if any) and the RLP of its children.
+	template <class _S> static void streamBatchNode(_S& _s, BatchNode const& _n, bytesConstRef _key, bytesConstRef const* _children);
+	/// Encodes the changed children of the topmost branch across m_pool, stores them and leaves them as refs.
+	void encodeAcrossPool(BatchNode& _n);
+	std::string atDirty(BatchNode const* _here, NibbleSlice _key) const;
+
+	/// @returns the list node @a _orig with item @a _i replaced by @a _v, written in one exact-size pass.
+	template <class _V> bytesConstRef replacing(RLP const& _orig, byte _i, _V const& _v);
+	template <class _S, class _V> static void streamReplacing(_S& _s, RLPIndex const& _orig, byte _i, _V const& _v);
+	/// @returns the RLP list of @a _ts.
+	template <class ... _Ts> bytesConstRef scratchList(_Ts const& ... _ts);
+	/// @returns the hex-prefix encoding of the first @a _n1 nibbles of @a _s1 then the first @a _n2 of @a _s2.
+	bytesConstRef scratchHexPrefix(NibbleSlice _s1, uint _n1, bool _leaf, NibbleSlice _s2 = NibbleSlice(), uint _n2 = 0);
+	/// @returns the bytes of m_scratchStream, copied into m_scratch.
+	bytesConstRef scratchOut();
+
+	/// @returns the node @a _h from the pinned levels, or else by way of the DB's node cache; an empty string if there's no such node.
+	NodeRef node(h256 _h) const
+	{
+		if (!m_pinnedByHash.empty())
+		{
+			auto it = m_pinnedByHash.find(_h);
+			if (it != m_pinnedByHash.end())
+			{
+				++m_pinStats.hits;
+				return it->second;
+			}
+		}
+		return m_db->nodeCache().lookup(_h, [&]() { return m_db->lookup(_h); });
+	}
 	void insertNode(h256 _h, bytesConstRef _v) { m_db->insert(_h, _v); }
 	void killNode(h256 _h) { m_db->kill(_h); }
 
 	h256 insertNode(bytesConstRef _v) { auto h = sha3(_v); insertNode(h, _v); return h; }
 	void killNode(RLP const& _d) { if (_d.data().size() >= 32) killNode(sha3(_d.data())); }
 
+	/// A place in a trie being diffed: the node referred to by an RLP item (a hash, the node itself, or nothing if
+	/// empty), entered @a offset nibbles into its own key.
+	struct DiffPos
+	{
+		NodeRef pin;			///< Keeps the data of item alive.
+		bytesConstRef item;
+		unsigned offset;
+	};
+	/// Finds what lies one nibble on from @a _p: the place under each nibble, and the value at @a _p itself.
+	void expand(DiffPos const& _p, DiffPos* o_children, bytesConstRef& o_value, NodeRef& o_valuePin) const;
+	template <class _F> void diffAux(DiffPos const& _a, DiffPos const& _b, bytes& io_key, _F const& _f) const;
+
 	h256 m_root;
 	DB* m_db = nullptr;
+	WorkerPool* m_pool = nullptr;
+
+	Arena m_scratch{c_scratchBlockSize};	///< The nodes made by one insert() or remove(); rewound at the start of each.
+	RLPStream m_scratchStream;				///< Where each of them is encoded before it's copied to m_scratch.
+	static const size_t c_scratchBlockSize = 16 * 1024;
+
+	bool m_deferred = false;
+	bool m_dirty = false;				///< True if m_dirtyRoot holds changes not yet flushed; m_root is then stale.
+	BatchNodePtr m_dirtyRoot;			///< The decoded root while dirty; null if the trie is empty.
+	std::vector<NodeRef> m_pins;		///< Nodes whose data undecoded children in m_dirtyRoot refer to; they may have left the DB.
+	std::vector<h256> m_kills;			///< Stored nodes replaced by m_dirtyRoot, to be killed by flush().
+	std::vector<NewNode> m_made;		///< The nodes made by the last flush(); kept only to reuse its buffer.
+
+	/// A node of the pinned levels, with its items indexed and its pinned children by the item referring to them.
+	struct PinnedNode
+	{
+		NodeRef rlp;
+		RLPIndex items;
+		std::unique_ptr<PinnedNode> children[16];
+	};
+	/// @returns the pinned root, pinning the levels anew first if the root has moved; null if none are pinned.
+	PinnedNode const* pinned() const;
+	void repin() const;
+
+	static const size_t c_defaultPinBudget = 4 * 1024 * 1024;
+	/// Rough cost of a pinned node's bookkeeping: the PinnedNode itself and its entry in m_pinnedByHash.
+	static const size_t c_pinOverhead = 320;
+
+	unsigned m_pinLevels = 0;
+	size_t m_pinBudget = c_defaultPinBudget;
+	mutable std::unique_ptr<PinnedNode> m_pinnedRoot;
+	mutable h256 m_pinnedAt;								///< The root of which m_pinnedRoot is.
+	mutable std::unordered_map<h256, NodeRef> m_pinnedByHash;	///< The RLP of each pinned node.
+	mutable size_t m_pinnedBytes = 0;
+	mutable PinStats m_pinStats;
 };
 
 template <class DB>
@@ -345,6 +758,31 @@ std::ostream& operator<<(std::ostream& _out, GenericTrieDB<DB> const& _db)
 #pragma warning(pop)
 #endif
 
+/// The bytes a TrieDB keys a KeyType by: those of the object itself, which suits FixedHash.
+template <class KeyType> struct TrieKey
+{
+	static const unsigned c_size = sizeof(KeyType);
+
+	TrieKey(KeyType const& _k): m_key(_k) {}
+	bytesConstRef ref() const { return bytesConstRef((byte const*)&m_key, sizeof(KeyType)); }
+	static KeyType decode(bytesConstRef _b) { assert(_b.size() == sizeof(KeyType)); KeyType ret; memcpy(&ret, _b.data(), sizeof(KeyType)); return ret; }
+
+	KeyType m_key;
+};
+
+/// A u256 is keyed by its 32 big-endian bytes, as in hash256(u256Map). The object's own bytes won't do: they include
+/// limbs beyond those in use, which aren't necessarily zero.
+template <> struct TrieKey<u256>
+{
+	static const unsigned c_size = 32;
+
+	TrieKey(u256 _k): m_key(_k) {}
+	bytesConstRef ref() const { return m_key.ref(); }
+	static u256 decode(bytesConstRef _b) { assert(_b.size() == 32); return h256(_b.data()); }
+
+	h256 m_key;
+};
+
 template <class KeyType, class DB>
 class TrieDB: public GenericTrieDB<DB>
 {
@@ -354,10 +792,25 @@ public:
 
 	std::string operator[](KeyType _k) const { return at(_k); }
 
-	std::string at(KeyType _k) const { return GenericTrieDB<DB>::at(bytesConstRef((byte const*)&_k, sizeof(KeyType))); }
-	void insert(KeyType _k, bytesConstRef _value) { GenericTrieDB<DB>::insert(bytesConstRef((byte const*)&_k, sizeof(KeyType)), _value); }
+	std::string at(KeyType _k) const { return GenericTrieDB<DB>::template atFixed<TrieKey<KeyType>::c_size>(TrieKey<KeyType>(_k).ref()); }
+	void insert(KeyType _k, bytesConstRef _value) { GenericTrieDB<DB>::insert(TrieKey<KeyType>(_k).ref(), _value); }
 	void insert(KeyType _k, bytes const& _value) { insert(_k, bytesConstRef(&_value)); }
-	void remove(KeyType _k) { GenericTrieDB<DB>::remove(bytesConstRef((byte const*)&_k, sizeof(KeyType))); }
+	void remove(KeyType _k) { GenericTrieDB<DB>::remove(TrieKey<KeyType>(_k).ref()); }
+
+	/// As GenericTrieDB::applyBatch(); an empty value removes its key.
+	void applyBatch(std::vector<std::pair<KeyType, bytes>> const& _batch)
+	{
+		std::vector<TrieKey<KeyType>> keys;
+		keys.reserve(_batch.size());
+		std::vector<typename GenericTrieDB<DB>::BatchItem> b;
+		b.reserve(_batch.size());
+		for (auto const& i: _batch)
+		{
+			keys.push_back(i.first);
+			b.push_back(std::make_pair(keys.back().ref(), bytesConstRef(&i.second)));
+		}
+		GenericTrieDB<DB>::applyBatch(&b);
+	}
 
 	class iterator: public GenericTrieDB<DB>::iterator
 	{
@@ -367,6 +820,7 @@ public:
 
 		iterator() {}
 		iterator(TrieDB const* _db): Super(_db) {}
+		explicit iterator(Super const& _s): Super(_s) {}
 
 		value_type operator*() const { return at(); }
 		value_type operator->() const { return at(); }
@@ -374,16 +828,55 @@ public:
 		value_type at() const
 		{
 			auto p = Super::at();
-			value_type ret;
-			assert(p.first.size() == sizeof(KeyType));
-			memcpy(&ret.first, p.first.data(), sizeof(KeyType));
-			ret.second = p.second;
-			return ret;
+			return std::make_pair(TrieKey<KeyType>::decode(p.first), p.second);
 		}
 	};
 
 	iterator begin() const { return this; }
 	iterator end() const { return iterator(); }
+
+	std::vector<bytes> prove(KeyType _k) const { return GenericTrieDB<DB>::prove(TrieKey<KeyType>(_k).ref()); }
+	/// As eth::verifyProof(), for a proof from prove(KeyType).
+	static std::string verifyProof(h256 _root, KeyType _k, std::vector<bytes> const& _proof) { return eth::verifyProof(_root, TrieKey<KeyType>(_k).ref(), _proof); }
+
+	/// As GenericTrieDB::diff(), giving keys as KeyType.
+	template <class _F> void diff(h256 _from, h256 _to, _F const& _f) const { GenericTrieDB<DB>::diff(_from, _to, [&](bytesConstRef _k, bytesConstRef _a, bytesConstRef _b) { _f(TrieKey<KeyType>::decode(_k), _a, _b); }); }
+
+	iterator lower_bound(KeyType _k) const { return iterator(GenericTrieDB<DB>::lower_bound(TrieKey<KeyType>(_k).ref())); }
+	/// @returns the keys in [@a _begin, @a _end), ordered by their bytes.
+	TrieRange<iterator> range(KeyType _begin, KeyType _end) const { return TrieRange<iterator>{iterator(GenericTrieDB<DB>::range(TrieKey<KeyType>(_begin).ref(), TrieKey<KeyType>(_end).ref()).first)}; }
+};
+
+/**
+ * @brief A read-only view of a TrieDB as of one root, for use by any thread while the trie is written by another.
+ * The DB must be safe to read concurrently with writes, as ConcurrentNodeStore is. Each thread should have its own
+ * snapshot: the handle itself is not for sharing (its iterators and caches are its own), but it is cheap to make.
+ */
+template <class KeyType, class DB>
+class TrieSnapshot
+{
+public:
+	using iterator = typename TrieDB<KeyType, DB>::iterator;
+
+	/// Nothing is written through a snapshot, so it needs only const access to @a _db.
+	TrieSnapshot(DB const* _db, h256 _root): m_trie(const_cast<DB*>(_db), _root) {}
+
+	h256 root() const { return m_trie.root(); }
+
+	std::string operator[](KeyType _k) const { return at(_k); }
+	std::string at(KeyType _k) const { return m_trie.at(_k); }
+	bool contains(KeyType _k) const { return !at(_k).empty(); }
+
+	iterator begin() const { return m_trie.begin(); }
+	iterator end() const { return m_trie.end(); }
+	iterator lower_bound(KeyType _k) const { return m_trie.lower_bound(_k); }
+	TrieRange<iterator> range(KeyType _begin, KeyType _end) const { return m_trie.range(_begin, _end); }
+
+	std::vector<bytes> prove(KeyType _k) const { return m_trie.prove(_k); }
+
+private:
+	/// Never written; only its const members are used.
+	TrieDB<KeyType, DB> m_trie;
 };
 
 template <class KeyType, class DB>
@@ -400,30 +893,391 @@ std::ostream& operator<<(std::ostream& _out, TrieDB<KeyType, DB> const& _db)
 namespace eth
 {
 
+template <class DB> GenericTrieDB<DB>::iterator::iterator(GenericTrieDB const* _db, bytesConstRef _key)
+{
+	assert(!_db->m_dirty);
+	m_that = _db;
+	pushRoot();
+	NibbleSlice k(_key);
+	// Descend along _key for as long as nodes follow it, then carry on from there as next() would.
+	while (true)
+	{
+		Node& b = m_trail.back();
+		RLP rlp(b.rlp);
+		if (rlp.isEmpty())
+			break;
+		if (rlp.itemCount() == 2)
+		{
+			NibbleSlice p = keyOf(rlp);
+			unsigned m = std::min(p.size(), k.size());
+			int c = 0;
+			for (unsigned i = 0; i < m && !c; ++i)
+				c = (int)p[i] - (int)k[i];
+			if (c > 0 || (!c && k.size() < p.size()))
+				break;						// all beneath come after _key: enter as usual.
+			if (c < 0 || (isLeaf(rlp) && k.size() > p.size()))
+			{
+				b.child = 0;				// all beneath come before _key: pass it by.
+				break;
+			}
+			for (unsigned i = 0; i < p.size(); ++i)
+				m_key.push_back(p[i]);
+			k = k.mid(p.size());
+			if (isLeaf(rlp))
+			{
+				// _key itself.
+				b.keyLen = m_key.size();
+				b.child = 0;
+				if (!settle())
+					next();
+				return;
+			}
+			b = childOf(b, rlp[1], m_key.size());
+		}
+		else
+		{
+			if (!k.size())
+				break;						// the branch's value is _key: enter as usual.
+			b.child = k[0];
+			if (rlp[b.child].isEmpty())
+				break;						// carry on from the next child.
+			m_key.push_back(k[0]);
+			k = k.mid(1);
+			m_trail.push_back(childOf(b, rlp[b.child], m_key.size()));
+		}
+	}
+	next();
+}
+
+template <class DB> std::vector<bytes> GenericTrieDB<DB>::prove(bytesConstRef _key) const
+{
+	assert(!m_dirty);
+	std::vector<bytes> ret;
+	NodeRef root = node(m_root);
+	ret.push_back(asBytes(*root));
+	RLP n(ret.back());
+	NibbleSlice k(_key);
+	while (n.isList())
+	{
+		RLP next;
+		if (n.itemCount() == 2)
+		{
+			NibbleSlice nk = keyOf(n);
+			if (isLeaf(n) || !k.contains(nk))
+				break;
+			k = k.mid(nk.size());
+			next = n[1];
+		}
+		else
+		{
+			if (!k.size())
+				break;
+			next = n[k[0]];
+			k = k.mid(1);
+		}
+
+		if (next.isList())
+			n = next;
+		else if (next.isEmpty())
+			break;
+		else
+		{
+			ret.push_back(asBytes(*node(next.toHash<h256>())));
+			n = RLP(ret.back());
+		}
+	}
+	return ret;
+}
+
+template <class DB> template <class _F> void GenericTrieDB<DB>::diff(h256 _from, h256 _to, _F const& _f) const
+{
+	assert(!m_dirty);
+	auto rootOf = [](h256 _h)
+	{
+		if (_h == h256() || _h == c_shaNull)
+			return DiffPos{NodeRef(), bytesConstRef(), 0};
+		NodeRef pin = std::make_shared<std::string const>(asString(rlp(_h)));
+		return DiffPos{pin, bytesConstRef(*pin), 0};
+	};
+	bytes key;
+	diffAux(rootOf(_from), rootOf(_to), key, _f);
+}
+
+template <class DB> template <class _F> void GenericTrieDB<DB>::diffAux(DiffPos const& _a, DiffPos const& _b, bytes& io_key, _F const& _f) const
+{
+	if (_a.offset == _b.offset && _a.item.size() == _b.item.size() && !memcmp(_a.item.data(), _b.item.data(), _a.item.size()))
+		return;		// the same subtree.
+
+	DiffPos ac[16] = {};
+	DiffPos bc[16] = {};
+	bytesConstRef av;
+	bytesConstRef bv;
+	NodeRef ap;
+	NodeRef bp;
+	expand(_a, ac, av, ap);
+	expand(_b, bc, bv, bp);
+	if (av.size() != bv.size() || memcmp(av.data(), bv.data(), av.size()))
+	{
+		assert(io_key.size() % 2 == 0);		// values only end whole-byte keys.
+		bytes k(io_key.size() / 2);
+		for (unsigned i = 0; i < k.size(); ++i)
+			k[i] = (byte)(io_key[i * 2] * 16 + io_key[i * 2 + 1]);
+		_f(bytesConstRef(&k), av, bv);
+	}
+	for (byte i = 0; i < 16; ++i)
+		if (ac[i].item.size() || bc[i].item.size())
+		{
+			io_key.push_back(i);
+			diffAux(ac[i], bc[i], io_key, _f);
+			io_key.pop_back();
+		}
+}
+
+template <class DB> void GenericTrieDB<DB>::expand(DiffPos const& _p, DiffPos* o_children, bytesConstRef& o_value, NodeRef& o_valuePin) const
+{
+	if (!_p.item.size())
+		return;
+	RLP r(_p.item);
+	NodeRef pin = _p.pin;
+	bytesConstRef n = _p.item;
+	if (r.isEmpty())
+		return;
+	if (!r.isList())
+	{
+		pin = node(r.toHash<h256>());
+		n = bytesConstRef(*pin);
+	}
+
+	RLP rn(n);
+	if (rn.isEmpty())
+		return;
+	if (rn.itemCount() == 2)
+	{
+		NibbleSlice k = keyOf(rn).mid(_p.offset);
+		if (k.size())
+			// part way along its key: it's the only thing here, a nibble further in. Refer to it directly from now on.
+			o_children[k[0]] = DiffPos{pin, n, _p.offset + 1};
+		else if (isLeaf(rn))
+		{
+			o_value = rn[1].payload();
+			o_valuePin = pin;
+		}
+		else
+			expand(DiffPos{pin, rn[1].data(), 0}, o_children, o_value, o_valuePin);
+		return;
+	}
+	for (unsigned i = 0; i < 16; ++i)
+		if (!rn[i].isEmpty())
+			o_children[i] = DiffPos{pin, rn[i].data(), 0};
+	if (!rn[16].isEmpty())
+	{
+		o_value = rn[16].payload();
+		o_valuePin = pin;
+	}
+}
+
+template <class DB> TrieRange<typename GenericTrieDB<DB>::iterator> GenericTrieDB<DB>::prefixed(bytesConstRef _prefix) const
+{
+	// The keys before the least key greater than all starting with _prefix; all but for a prefix of all 0xff bytes.
+	bytes end = _prefix.toBytes();
+	while (end.size() && end.back() == 0xff)
+		end.pop_back();
+	if (end.empty())
+		return TrieRange<iterator>{lower_bound(_prefix)};
+	++end.back();
+	return range(_prefix, &end);
+}
+
 template <class DB> void GenericTrieDB<DB>::init()
 {
+	flush();
 	m_root = insertNode(&RLPNull);
 //	std::cout << "Initialised root to " << m_root << std::endl;
-	assert(node(m_root).size());
+	assert(node(m_root)->size());
 }
 
 template <class DB> void GenericTrieDB<DB>::insert(bytesConstRef _key, bytesConstRef _value)
 {
-	std::string rv = node(m_root);
-	assert(rv.size());
-	bytes b = mergeAt(RLP(rv), NibbleSlice(_key), _value);
+	if (m_deferred)
+		return batchInsert(dirtyRoot(), NibbleSlice(_key), _value);
+
+	m_scratch.rewind();
+	NodeRef rv = node(m_root);
+	assert(rv->size());
+	bytesConstRef b = mergeAt(RLP(*rv), NibbleSlice(_key), _value);
 
 	// mergeAt won't attempt to delete the node is it's less than 32 bytes
 	// However, we know it's the root node and thus always hashed.
 	// So, if it's less than 32 (and thus should have been deleted but wasn't) then we delete it here.
-	if (rv.size() < 32)
+	if (rv->size() < 32)
 		killNode(m_root);
-	m_root = insertNode(&b);
+	m_root = insertNode(b);
 }
 
 template <class DB> std::string GenericTrieDB<DB>::at(bytesConstRef _key) const
 {
-	return atAux(RLP(node(m_root)), _key);
+	if (m_dirty)
+		return atDirty(m_dirtyRoot.get(), _key);
+	return atAux(RLP(*node(m_root)), _key);
+}
+
+template <class DB> template <unsigned _Bytes> std::string GenericTrieDB<DB>::atFixed(bytesConstRef _key) const
+{
+	assert(_key.size() == _Bytes);
+	if (m_dirty)
+		return atDirty(m_dirtyRoot.get(), _key);
+
+	static const unsigned c_nibbles = _Bytes * 2;
+	std::array<byte, c_nibbles> k;
+	for (unsigned i = 0; i < _Bytes; ++i)
+	{
+		k[i * 2] = _key[i] >> 4;
+		k[i * 2 + 1] = _key[i] & 15;
+	}
+
+	// While in the pinned levels, p is the node we're at and its items are found through its index.
+	PinnedNode const* p = pinned();
+	if (p)
+		++m_pinStats.hits;
+	NodeRef pin = p ? p->rlp : node(m_root);
+	RLP n(*pin);
+	unsigned d = 0;		// nibbles of the key used so far.
+	while (true)
+	{
+		if (n.isEmpty() || n.isNull())
+			return std::string();
+		auto item = [&](unsigned i) { return p ? p->items[i] : n[i]; };
+		RLP next;
+		unsigned slot;
+		if ((p ? p->items.itemCount() : n.itemCount()) == 2)
+		{
+			NibbleSlice nk = keyOf(item(0).payload());
+			if (nk.size() > c_nibbles - d || sharedNibbles(nk.data, nk.offset, nk.offset + nk.size(), _key, d, c_nibbles) != nk.size())
+				return std::string();
+			d += nk.size();
+			if (isLeaf(n))
+				// keys all being as long as ours, a leaf that matches so far is ours.
+				return d == c_nibbles ? item(1).toString() : std::string();
+			next = item(slot = 1);
+		}
+		else
+		{
+			if (d == c_nibbles)
+				return item(16).toString();
+			next = item(slot = k[d++]);
+			if (next.isEmpty())
+				return std::string();
+		}
+		if (next.isList())
+		{
+			n = next;
+			p = nullptr;
+		}
+		else if (p && p->children[slot])
+		{
+			++m_pinStats.hits;
+			p = p->children[slot].get();
+			n = RLP(*p->rlp);
+		}
+		else
+		{
+			p = nullptr;
+			pin = node(next.toHash<h256>());
+			n = RLP(*pin);
+		}
+	}
+}
+
+template <class DB> typename GenericTrieDB<DB>::PinnedNode const* GenericTrieDB<DB>::pinned() const
+{
+	if (!m_pinLevels || m_dirty)
+		return nullptr;
+	if (m_pinnedAt != m_root)
+		repin();
+	return m_pinnedRoot.get();
+}
+
+template <class DB> void GenericTrieDB<DB>::repin() const
+{
+	// Nodes still in the trie are taken from those pinned before; only the rest are read in.
+	std::unordered_map<h256, NodeRef> old;
+	old.swap(m_pinnedByHash);
+	m_pinnedBytes = 0;
+	m_pinnedAt = m_root;
+
+	auto pin = [&](h256 const& _h)
+	{
+		std::unique_ptr<PinnedNode> ret;
+		auto it = old.find(_h);
+		NodeRef r = it != old.end() ? it->second : m_db->nodeCache().lookup(_h, [&]() { return m_db->lookup(_h); });
+		if (it == old.end())
+			++m_pinStats.loads;
+		size_t cost = r->size() + c_pinOverhead;
+		if (r->size() && m_pinnedBytes + cost <= m_pinBudget)
+		{
+			m_pinnedBytes += cost;
+			m_pinnedByHash[_h] = r;
+			ret.reset(new PinnedNode{r, RLP(*r).index(), {}});
+		}
+		return ret;
+	};
+
+	// Breadth first, so the budget goes to the upper levels first.
+	m_pinnedRoot = pin(m_root);
+	std::vector<PinnedNode*> level;
+	if (m_pinnedRoot)
+		level.push_back(m_pinnedRoot.get());
+	for (unsigned l = 1; l < m_pinLevels && !level.empty(); ++l)
+	{
+		std::vector<PinnedNode*> next;
+		for (PinnedNode* p: level)
+		{
+			RLPIndex const& items = p->items;
+			// A leaf's value or an extension's key may be 32 bytes too; only branches' and extensions' children are nodes.
+			unsigned begin = items.itemCount() == 2 ? 1 : 0;
+			unsigned end = items.itemCount() == 2 ? (isLeaf(RLP(*p->rlp)) ? 1 : 2) : 16;
+			for (unsigned i = begin; i < end; ++i)
+				if (items[i].isData() && items[i].size() == 32)
+					if ((p->children[i] = pin(items[i].toHash<h256>())))
+						next.push_back(p->children[i].get());
+		}
+		level.swap(next);
+	}
+}
+
+template <class DB> std::string GenericTrieDB<DB>::atDirty(BatchNode const* _here, NibbleSlice _key) const
+{
+	while (_here)
+	{
+		BatchNode const& n = *_here;
+		unsigned i = 0;
+		if (n.kind == BatchNode::Branch)
+		{
+			if (!_key.size())
+				return n.value;
+			i = _key[0];
+			_key = _key.mid(1);
+		}
+		else
+		{
+			uint shared = 0;
+			for (; shared < n.key.size() && shared < _key.size() && n.key[shared] == _key[shared]; ++shared) {}
+			if (shared < n.key.size())
+				return std::string();
+			_key = _key.mid(shared);
+			if (n.kind == BatchNode::Leaf)
+				return _key.size() ? std::string() : n.value;
+		}
+
+		if (n.refs[i])
+		{
+			// an unchanged subtree - read it as usual.
+			RLP r(n.refs[i]);
+			return atAux(r.isList() ? r : RLP(*node(r.toHash<h256>())), _key);
+		}
+		_here = n.nodes[i].get();
+	}
+	return std::string();
 }
 
 template <class DB> std::string GenericTrieDB<DB>::atAux(RLP const& _here, NibbleSlice _key) const
@@ -440,7 +1294,7 @@ template <class DB> std::string GenericTrieDB<DB>::atAux(RLP const& _here, Nibbl
 			return _here[1].toString();
 		else if (_key.contains(k) && !isLeaf(_here))
 			// not yet at leaf and it might yet be us. onwards...
-			return atAux(_here[1].isList() ? _here[1] : RLP(node(_here[1].toHash<h256>())), _key.mid(k.size()));
+			return atAux(_here[1].isList() ? _here[1] : RLP(*node(_here[1].toHash<h256>())), _key.mid(k.size()));
 		else
 			// not us.
 			return std::string();
@@ -453,11 +1307,11 @@ template <class DB> std::string GenericTrieDB<DB>::atAux(RLP const& _here, Nibbl
 		if (n.isEmpty())
 			return std::string();
 		else
-			return atAux(n.isList() ? n : RLP(node(n.toHash<h256>())), _key.mid(1));
+			return atAux(n.isList() ? n : RLP(*node(n.toHash<h256>())), _key.mid(1));
 	}
 }
 
-template <class DB> bytes GenericTrieDB<DB>::mergeAt(RLP const& _orig, NibbleSlice _k, bytesConstRef _v)
+template <class DB> bytesConstRef GenericTrieDB<DB>::mergeAt(RLP const& _orig, NibbleSlice _k, bytesConstRef _v)
 {
 //	::operator<<(std::cout << "mergeAt ", _orig) << _k << _v.toString() << std::endl;
 
@@ -483,10 +1337,7 @@ template <class DB> bytes GenericTrieDB<DB>::mergeAt(RLP const& _orig, NibbleSli
 		if (_k.contains(k) && !isLeaf(_orig))
 		{
 			killNode(sha3(_orig.data()));
-			RLPStream s(2);
-			s.append(_orig[0]);
-			mergeAtAux(s, _orig[1], _k.mid(k.size()), _v);
-			return s.out();
+			return replacing(_orig, 1, RLP(mergeAtAux(_orig[1], _k.mid(k.size()), _v)));
 		}
 
 		auto sh = _k.shared(k);
@@ -511,67 +1362,487 @@ template <class DB> bytes GenericTrieDB<DB>::mergeAt(RLP const& _orig, NibbleSli
 
 		// not exactly our node - delve to next level at the correct index.
 		byte n = _k[0];
-		RLPStream r(17);
-		for (byte i = 0; i < 17; ++i)
-			if (i == n)
-				mergeAtAux(r, _orig[i], _k.mid(1), _v);
-			else
-				r.append(_orig[i]);
-		return r.out();
+		return replacing(_orig, n, RLP(mergeAtAux(_orig[n], _k.mid(1), _v)));
 	}
 
 }
 
-template <class DB> void GenericTrieDB<DB>::mergeAtAux(RLPStream& _out, RLP const& _orig, NibbleSlice _k, bytesConstRef _v)
+template <class DB> bytesConstRef GenericTrieDB<DB>::mergeAtAux(RLP const& _orig, NibbleSlice _k, bytesConstRef _v)
 {
 	RLP r = _orig;
-	std::string s;
+	NodeRef s;
 	if (!r.isList() && !r.isEmpty())
 	{
 		s = node(_orig.toHash<h256>());
-		r = RLP(s);
+		r = RLP(*s);
 		assert(!r.isNull());
 		killNode(_orig.toHash<h256>());
 	}
 	else
 		killNode(_orig);
-	bytes b = mergeAt(r, _k, _v);
+	bytesConstRef b = mergeAt(r, _k, _v);
 //	::operator<<(std::cout, RLP(b)) << std::endl;
-	streamNode(_out, b);
+	return childRef(b);
 }
 
 template <class DB> void GenericTrieDB<DB>::remove(bytesConstRef _key)
 {
-	std::string rv = node(m_root);
-	bytes b = deleteAt(RLP(rv), NibbleSlice(_key));
+	if (m_deferred)
+	{
+		batchRemove(dirtyRoot(), NibbleSlice(_key));
+		return;
+	}
+
+	m_scratch.rewind();
+	NodeRef rv = node(m_root);
+	bytesConstRef b = deleteAt(RLP(*rv), NibbleSlice(_key));
 	if (b.size())
 	{
-		if (rv.size() < 32)
+		if (rv->size() < 32)
 			killNode(m_root);
-		m_root = insertNode(&b);
+		m_root = insertNode(b);
+	}
+}
+
+template <class DB> void GenericTrieDB<DB>::applyBatch(vector_ref<BatchItem const> _batch)
+{
+	if (_batch.empty())
+		return;
+	BatchNodePtr& root = dirtyRoot();
+	for (auto const& i: _batch)
+		if (i.second.empty())
+			batchRemove(root, NibbleSlice(i.first));
+		else
+			batchInsert(root, NibbleSlice(i.first), i.second);
+	if (!m_deferred)
+		flush();
+}
+
+template <class DB> typename GenericTrieDB<DB>::BatchNodePtr& GenericTrieDB<DB>::dirtyRoot()
+{
+	if (!m_dirty)
+	{
+		m_pins.push_back(node(m_root));
+		m_kills.push_back(m_root);
+		m_dirtyRoot = decodeBatchNode(bytesConstRef(*m_pins.back()));
+		m_dirty = true;
+	}
+	return m_dirtyRoot;
+}
+
+template <class DB> void GenericTrieDB<DB>::flush()
+{
+	if (!m_dirty)
+		return;
+	// Killed before the new nodes are stored, in case one of them is the same as one it replaces.
+	for (h256 const& h: m_kills)
+		killNode(h);
+	m_kills.clear();
+	if (m_pool && m_dirtyRoot)
+		encodeAcrossPool(*m_dirtyRoot);
+	m_scratch.rewind();
+	m_made.clear();
+	BatchEncoder e{m_scratch, m_scratchStream, m_made};
+	bytesConstRef b = m_dirtyRoot ? encodeBatchNode(*m_dirtyRoot, e) : bytesConstRef(&RLPNull);
+	for (auto const& i: m_made)
+		insertNode(i.first, i.second);
+	// As with insert(), the root is always stored by hash, however small.
+	m_root = insertNode(b);
+	dropDeferred();
+}
+
+template <class DB> h256 GenericTrieDB<DB>::dirtyRootHash() const
+{
+	if (!m_dirtyRoot)
+		return h256();
+	Arena a(c_scratchBlockSize);
+	RLPStream s;
+	std::vector<NewNode> made;
+	BatchEncoder e{a, s, made};
+	return sha3(encodeBatchNode(*m_dirtyRoot, e));
+}
+
+template <class DB> typename GenericTrieDB<DB>::BatchNodePtr GenericTrieDB<DB>::decodeBatchNode(bytesConstRef _rlp)
+{
+	RLP r(_rlp);
+	if (r.isNull() || r.isEmpty())
+		return BatchNodePtr();
+	assert(r.isList() && (r.itemCount() == 2 || r.itemCount() == 17));
+
+	BatchNodePtr ret(new BatchNode);
+	if (r.itemCount() == 2)
+	{
+		NibbleSlice k = keyOf(r);
+		for (uint i = 0; i < k.size(); ++i)
+			ret->key.push_back(k[i]);
+		if (isLeaf(r))
+		{
+			ret->kind = BatchNode::Leaf;
+			ret->value = r[1].payload().toString();
+		}
+		else
+		{
+			ret->kind = BatchNode::Extension;
+			ret->refs[0] = r[1].data();
+		}
+	}
+	else
+	{
+		ret->kind = BatchNode::Branch;
+		for (unsigned i = 0; i < 16; ++i)
+			if (!r[i].isEmpty())
+				ret->refs[i] = r[i].data();
+		ret->value = r[16].payload().toString();
+	}
+	return ret;
+}
+
+template <class DB> typename GenericTrieDB<DB>::BatchNodePtr& GenericTrieDB<DB>::batchChild(BatchNode& _n, unsigned _i)
+{
+	if (!_n.nodes[_i] && _n.refs[_i])
+	{
+		RLP r(_n.refs[_i]);
+		if (r.isList())
+			_n.nodes[_i] = decodeBatchNode(_n.refs[_i]);
+		else
+		{
+			h256 h = r.toHash<h256>();
+			m_pins.push_back(node(h));
+			m_kills.push_back(h);
+			_n.nodes[_i] = decodeBatchNode(bytesConstRef(*m_pins.back()));
+		}
+		_n.refs[_i].reset();
+	}
+	return _n.nodes[_i];
+}
+
+template <class DB> void GenericTrieDB<DB>::batchInsert(BatchNodePtr& io_n, NibbleSlice _k, bytesConstRef _v)
+{
+	if (!io_n)
+	{
+		io_n.reset(new BatchNode);
+		io_n->kind = BatchNode::Leaf;
+		for (uint i = 0; i < _k.size(); ++i)
+			io_n->key.push_back(_k[i]);
+		io_n->value = _v.toString();
+		return;
+	}
+
+	BatchNode& n = *io_n;
+	if (n.kind == BatchNode::Branch)
+	{
+		if (_k.size())
+			batchInsert(batchChild(n, _k[0]), _k.mid(1), _v);
+		else
+			n.value = _v.toString();
+		return;
+	}
+
+	uint shared = 0;
+	for (; shared < n.key.size() && shared < _k.size() && n.key[shared] == _k[shared]; ++shared) {}
+	if (shared == n.key.size())
+	{
+		if (n.kind == BatchNode::Extension)
+			return batchInsert(batchChild(n, 0), _k.mid(shared), _v);
+		if (shared == _k.size())
+		{
+			n.value = _v.toString();
+			return;
+		}
+	}
+
+	// Keys diverge (or one ends) after the shared nibbles: put a branch there, holding what was here...
+	BatchNodePtr b(new BatchNode);
+	b->kind = BatchNode::Branch;
+	if (shared == n.key.size())
+		b->value = std::move(n.value);
+	else
+	{
+		byte i = n.key[shared];
+		n.key.erase(n.key.begin(), n.key.begin() + shared + 1);
+		if (n.kind == BatchNode::Extension && n.key.empty())
+		{
+			// nothing left of the extension - its child goes straight into the branch.
+			b->nodes[i] = std::move(n.nodes[0]);
+			b->refs[i] = n.refs[0];
+		}
+		else
+			b->nodes[i] = std::move(io_n);
+	}
+
+	// ...then the new item.
+	batchInsert(b, _k.mid(shared), _v);
+
+	if (shared)
+	{
+		BatchNodePtr e(new BatchNode);
+		e->kind = BatchNode::Extension;
+		for (uint i = 0; i < shared; ++i)
+			e->key.push_back(_k[i]);
+		e->nodes[0] = std::move(b);
+		io_n = std::move(e);
+	}
+	else
+		io_n = std::move(b);
+}
+
+template <class DB> bool GenericTrieDB<DB>::batchRemove(BatchNodePtr& io_n, NibbleSlice _k)
+{
+	if (!io_n)
+		return false;
+
+	BatchNode& n = *io_n;
+	if (n.kind == BatchNode::Branch)
+	{
+		if (_k.size())
+		{
+			if (!batchRemove(batchChild(n, _k[0]), _k.mid(1)))
+				return false;
+		}
+		else if (n.value.empty())
+			return false;
+		else
+			n.value.clear();
+		normalizeBatchNode(io_n);
+		return true;
+	}
+
+	uint shared = 0;
+	for (; shared < n.key.size() && shared < _k.size() && n.key[shared] == _k[shared]; ++shared) {}
+	if (shared < n.key.size())
+		return false;
+	if (n.kind == BatchNode::Leaf)
+	{
+		if (shared < _k.size())
+			return false;
+		io_n.reset();
+		return true;
+	}
+	if (!batchRemove(batchChild(n, 0), _k.mid(shared)))
+		return false;
+	normalizeBatchNode(io_n);
+	return true;
+}
+
+template <class DB> void GenericTrieDB<DB>::normalizeBatchNode(BatchNodePtr& io_n)
+{
+	BatchNode& n = *io_n;
+	if (n.kind == BatchNode::Branch)
+	{
+		unsigned used = 0;
+		byte last = 0;
+		for (byte i = 0; i < 16; ++i)
+			if (n.nodes[i] || n.refs[i])
+			{
+				++used;
+				last = i;
+			}
+		if (used > 1 || (used && n.value.size()))
+			return;
+		if (!used)
+		{
+			// just the value: a leaf for the empty key.
+			n.kind = BatchNode::Leaf;
+			n.key.clear();
+			return;
+		}
+		// just one child: an extension of one nibble, which may then join with the child.
+		batchChild(n, last);
+		n.kind = BatchNode::Extension;
+		n.key = bytes(1, last);
+		if (last)
+		{
+			n.nodes[0] = std::move(n.nodes[last]);
+			n.refs[last].reset();
+		}
+	}
+
+	assert(n.kind == BatchNode::Extension);
+	BatchNodePtr& c = batchChild(n, 0);
+	if (!c)
+		io_n.reset();
+	else if (c->kind != BatchNode::Branch)
+	{
+		// join the extension onto the front of its leaf or extension child.
+		c->key.insert(c->key.begin(), n.key.begin(), n.key.end());
+		io_n = std::move(c);
+	}
+}
+
+template <class DB> void GenericTrieDB<DB>::encodeAcrossPool(BatchNode& _n)
+{
+	// Fewest changed subtrees for it to be worth waking the pool.
+	static const unsigned c_minParallelChildren = 4;
+
+	BatchNode* n = &_n;
+	if (n->kind == BatchNode::Extension && n->nodes[0])
+		n = n->nodes[0].get();
+	if (n->kind != BatchNode::Branch)
+		return;
+	unsigned changed[16];
+	unsigned count = 0;
+	for (unsigned i = 0; i < 16; ++i)
+		if (n->nodes[i])
+			changed[count++] = i;
+	if (count < c_minParallelChildren)
+		return;
+
+	// Each task encodes into its own arena, which holds its nodes until they're stored.
+	std::unique_ptr<Arena> arenas[16];
+	std::vector<NewNode> made[16];
+	std::string refs[16];
+	m_pool->run(count, [&](unsigned j)
+	{
+		arenas[j].reset(new Arena(c_scratchBlockSize));
+		RLPStream s;
+		BatchEncoder e{*arenas[j], s, made[j]};
+		bytesConstRef b = encodeBatchNode(*n->nodes[changed[j]], e);
+		if (b.size() < 32)
+			refs[j] = b.toString();
+		else
+		{
+			h256 h = sha3(b);
+			made[j].push_back(NewNode(h, b));
+			refs[j] = asString(rlp(h));
+		}
+	});
+
+	// Only now touch the DB, from this thread.
+	for (unsigned j = 0; j < count; ++j)
+	{
+		for (auto const& i: made[j])
+			insertNode(i.first, i.second);
+		m_pins.push_back(std::make_shared<std::string const>(std::move(refs[j])));
+		n->refs[changed[j]] = bytesConstRef(*m_pins.back());
+		n->nodes[changed[j]].reset();
+	}
+}
+
+template <class DB> bytesConstRef GenericTrieDB<DB>::encodeBatchNode(BatchNode const& _n, BatchEncoder& io_e)
+{
+	// Children first: each is done with the stream before its parent is written to it.
+	bytesConstRef children[16];
+	unsigned count = _n.kind == BatchNode::Branch ? 16 : _n.kind == BatchNode::Extension ? 1 : 0;
+	for (unsigned i = 0; i < count; ++i)
+		if (_n.nodes[i])
+		{
+			bytesConstRef c = encodeBatchNode(*_n.nodes[i], io_e);
+			if (c.size() < 32)
+				children[i] = c;
+			else
+			{
+				h256 h = sha3(c);
+				io_e.made.push_back(NewNode(h, c));
+				byte* r = (byte*)io_e.arena.allocate(33);
+				r[0] = c_rlpDataImmLenStart + 32;
+				memcpy(r + 1, h.data(), 32);
+				children[i] = bytesConstRef(r, 33);
+			}
+		}
+		else
+			children[i] = _n.refs[i];
+
+	bytesConstRef key;
+	if (_n.kind != BatchNode::Branch)
+	{
+		uint n = hexPrefixSize(_n.key.size());
+		byte* k = (byte*)io_e.arena.allocate(n);
+		hexPrefixWrite(_n.key, _n.kind == BatchNode::Leaf, k);
+		key = bytesConstRef(k, n);
+	}
+
+	io_e.stream.clear();
+	streamBatchNode(io_e.stream.measure(), _n, key, children);
+	streamBatchNode(io_e.stream.prepare(), _n, key, children);
+	bytes const& o = io_e.stream.out();
+	byte* ret = (byte*)io_e.arena.allocate(o.size());
+	memcpy(ret, o.data(), o.size());
+	return bytesConstRef(ret, o.size());
+}
+
+template <class DB> template <class _S> void GenericTrieDB<DB>::streamBatchNode(_S& _s, BatchNode const& _n, bytesConstRef _key, bytesConstRef const* _children)
+{
+	auto streamChild = [&](unsigned _i)
+	{
+		if (_children[_i])
+			_s.appendRaw(_children[_i]);
+		else
+			_s.append(bytesConstRef());
+	};
+	if (_n.kind == BatchNode::Leaf)
+		_s.appendList(2) << _key << _n.value;
+	else if (_n.kind == BatchNode::Extension)
+	{
+		_s.appendList(2) << _key;
+		streamChild(0);
+	}
+	else
+	{
+		_s.appendList(17);
+		for (unsigned i = 0; i < 16; ++i)
+			streamChild(i);
+		_s << _n.value;
 	}
 }
 
 template <class DB> bool GenericTrieDB<DB>::isTwoItemNode(RLP const& _n) const
 {
-	return (_n.isData() && RLP(node(_n.toHash<h256>())).itemCount() == 2)
+	return (_n.isData() && RLP(*node(_n.toHash<h256>())).itemCount() == 2)
 			|| (_n.isList() && _n.itemCount() == 2);
 }
 
-template <class DB> std::string GenericTrieDB<DB>::deref(RLP const& _n) const
+template <class DB> template <class _S, class _V> void GenericTrieDB<DB>::streamReplacing(_S& _s, RLPIndex const& _orig, byte _i, _V const& _v)
+{
+	_s.appendList(_orig.itemCount());
+	for (uint i = 0; i < _orig.itemCount(); ++i)
+		if (i == _i)
+			_s << _v;
+		else
+			_s.appendRaw(_orig[i].data());
+}
+
+template <class DB> template <class _V> bytesConstRef GenericTrieDB<DB>::replacing(RLP const& _orig, byte _i, _V const& _v)
+{
+	RLPIndex o = _orig.index();
+	m_scratchStream.clear();
+	streamReplacing(m_scratchStream.measure(), o, _i, _v);
+	streamReplacing(m_scratchStream.prepare(), o, _i, _v);
+	return scratchOut();
+}
+
+template <class DB> template <class ... _Ts> bytesConstRef GenericTrieDB<DB>::scratchList(_Ts const& ... _ts)
+{
+	m_scratchStream.clear();
+	rlpListAux(m_scratchStream.measure().appendList(sizeof ...(_Ts)), _ts...);
+	rlpListAux(m_scratchStream.prepare().appendList(sizeof ...(_Ts)), _ts...);
+	return scratchOut();
+}
+
+template <class DB> bytesConstRef GenericTrieDB<DB>::scratchOut()
+{
+	bytes const& o = m_scratchStream.out();
+	byte* ret = (byte*)m_scratch.allocate(o.size());
+	memcpy(ret, o.data(), o.size());
+	return bytesConstRef(ret, o.size());
+}
+
+template <class DB> bytesConstRef GenericTrieDB<DB>::scratchHexPrefix(NibbleSlice _s1, uint _n1, bool _leaf, NibbleSlice _s2, uint _n2)
 {
-	return _n.isList() ? _n.data().toString() : node(_n.toHash<h256>());
+	uint n = hexPrefixSize(_n1 + _n2);
+	byte* ret = (byte*)m_scratch.allocate(n);
+	hexPrefixWrite(_s1, _n1, _s2, _n2, _leaf, ret);
+	return bytesConstRef(ret, n);
 }
 
-template <class DB> bytes GenericTrieDB<DB>::deleteAt(RLP const& _orig, NibbleSlice _k)
+template <class DB> bytesConstRef GenericTrieDB<DB>::deleteAt(RLP const& _orig, NibbleSlice _k)
 {
 	// The caller will make sure that the bytes are inserted properly.
 	// - This might mean inserting an entry into m_over
 	// We will take care to ensure that (our reference to) _orig is killed.
 
 	// Empty - not found - no change.
-	if (_orig.isEmpty())
-		return bytes();
+	if (_orig.isEmpty() || _orig.isNull())
+		return bytesConstRef();
 
 	assert(_orig.isList() && (_orig.itemCount() == 2 || _orig.itemCount() == 17));
 	if (_orig.itemCount() == 2)
@@ -581,24 +1852,24 @@ template <class DB> bytes GenericTrieDB<DB>::deleteAt(RLP const& _orig, NibbleSl
 
 		// exactly our node - return null.
 		if (k == _k && isLeaf(_orig))
-			return RLPNull;
+			return bytesConstRef(&RLPNull);
 
 		// partial key is our key - move down.
-		if (_k.contains(k))
+		if (_k.contains(k) && !isLeaf(_orig))
 		{
-			RLPStream s;
-			s.appendList(2) << _orig[0];
-			if (!deleteAtAux(s, _orig[1], _k.mid(k.size())))
-				return bytes();
+			bytesConstRef c = deleteAtAux(_orig[1], _k.mid(k.size()));
+			if (!c.size())
+				return bytesConstRef();
 			killNode(sha3(_orig.data()));
-			RLP r(s.out());
+			bytesConstRef b = replacing(_orig, 1, RLP(c));
+			RLP r(b);
 			if (isTwoItemNode(r[1]))
 				return graft(r);
-			return s.out();
+			return b;
 		}
 		else
 			// not found - no change.
-			return bytes();
+			return bytesConstRef();
 	}
 	else
 	{
@@ -617,32 +1888,24 @@ template <class DB> bytes GenericTrieDB<DB>::deleteAt(RLP const& _orig, NibbleSl
 				else
 					return merge(_orig, used);
 			else
-			{
-				RLPStream r(17);
-				for (byte i = 0; i < 16; ++i)
-					r << _orig[i];
-				r << "";
-				return r.out();
-			}
+				return replacing(_orig, 16, bytesConstRef());
 		}
 		else
 		{
 			// not exactly our node - delve to next level at the correct index.
-			RLPStream r(17);
+			if (!_k.size())	// no value here - not found.
+				return bytesConstRef();
 			byte n = _k[0];
-			for (byte i = 0; i < 17; ++i)
-				if (i == n)
-					if (!deleteAtAux(r, _orig[i], _k.mid(1)))	// bomb out if the key didn't turn up.
-						return bytes();
-					else {}
-				else
-					r << _orig[i];
+			bytesConstRef c = deleteAtAux(_orig[n], _k.mid(1));
+			if (!c.size())	// bomb out if the key didn't turn up.
+				return bytesConstRef();
+			bytesConstRef b = replacing(_orig, n, RLP(c));
 
 			// check if we ended up leaving the node invalid.
-			RLP rlp(r.out());
+			RLP rlp(b);
 			byte used = uniqueInUse(rlp, 255);
 			if (used == 255)	// no - all ok.
-				return r.out();
+				return b;
 
 			// yes; merge
 			if (isTwoItemNode(rlp[used]))
@@ -654,69 +1917,65 @@ template <class DB> bytes GenericTrieDB<DB>::deleteAt(RLP const& _orig, NibbleSl
 
 }
 
-template <class DB> bool GenericTrieDB<DB>::deleteAtAux(RLPStream& _out, RLP const& _orig, NibbleSlice _k)
+template <class DB> bytesConstRef GenericTrieDB<DB>::deleteAtAux(RLP const& _orig, NibbleSlice _k)
 {
-	bytes b = deleteAt(_orig.isList() ? _orig : RLP(node(_orig.toHash<h256>())), _k);
+	NodeRef s;
+	if (!_orig.isList())
+		s = node(_orig.toHash<h256>());
+	bytesConstRef b = deleteAt(s ? RLP(*s) : _orig, _k);
 
 	if (!b.size())	// not found - no change.
-		return false;
+		return bytesConstRef();
 
 	if (_orig.isList())
 		killNode(_orig);
 	else
 		killNode(_orig.toHash<h256>());
 
-	streamNode(_out, b);
-	return true;
+	return childRef(b);
 }
 
-template <class DB> bytes GenericTrieDB<DB>::place(RLP const& _orig, NibbleSlice _k, bytesConstRef _s)
+template <class DB> bytesConstRef GenericTrieDB<DB>::place(RLP const& _orig, NibbleSlice _k, bytesConstRef _s)
 {
 //	::operator<<(std::cout << "place ", _orig) << ", " << _k << ", " << _s.toString() << std::endl;
 
 	killNode(_orig);
 	if (_orig.isEmpty())
-		return (RLPStream(2) << hexPrefixEncode(_k, true) << _s).out();
+		return scratchList(scratchHexPrefix(_k, _k.size(), true), _s);
 
 	assert(_orig.isList() && (_orig.itemCount() == 2 || _orig.itemCount() == 17));
 	if (_orig.itemCount() == 2)
-		return (RLPStream(2) << _orig[0] << _s).out();
+		return replacing(_orig, 1, _s);
 
-	auto s = RLPStream(17);
-	for (uint i = 0; i < 16; ++i)
-		s << _orig[i];
-	s << _s;
-	return s.out();
+	return replacing(_orig, 16, _s);
 }
 
 // in1: [K, S] (DEL)
 // out1: null
 // in2: [V0, ..., V15, S] (DEL)
 // out2: [V0, ..., V15, null] iff exists i: !!Vi  -- OR --  null otherwise
-template <class DB> bytes GenericTrieDB<DB>::remove(RLP const& _orig)
+template <class DB> bytesConstRef GenericTrieDB<DB>::remove(RLP const& _orig)
 {
 	killNode(_orig);
 
 	assert(_orig.isList() && (_orig.itemCount() == 2 || _orig.itemCount() == 17));
 	if (_orig.itemCount() == 2)
-		return RLPNull;
-	RLPStream r(17);
-	for (uint i = 0; i < 16; ++i)
-		r << _orig[i];
-	r << "";
-	return r.out();
+		return bytesConstRef(&RLPNull);
+	return replacing(_orig, 16, bytesConstRef());
 }
 
-template <class DB> RLPStream& GenericTrieDB<DB>::streamNode(RLPStream& _s, bytes const& _b)
+template <class DB> bytesConstRef GenericTrieDB<DB>::childRef(bytesConstRef _n)
 {
-	if (_b.size() < 32)
-		_s.appendRaw(_b);
-	else
-		_s.append(insertNode(&_b));
-	return _s;
+	if (_n.size() < 32)
+		return _n;
+	h256 h = insertNode(_n);
+	byte* ret = (byte*)m_scratch.allocate(33);
+	ret[0] = c_rlpDataImmLenStart + 32;
+	memcpy(ret + 1, h.data(), 32);
+	return bytesConstRef(ret, 33);
 }
 
-template <class DB> bytes GenericTrieDB<DB>::cleve(RLP const& _orig, uint _s)
+template <class DB> bytesConstRef GenericTrieDB<DB>::cleve(RLP const& _orig, uint _s)
 {
 //	::operator<<(std::cout << "cleve ", _orig) << ", " << _s << std::endl;
 
@@ -725,20 +1984,15 @@ template <class DB> bytes GenericTrieDB<DB>::cleve(RLP const& _orig, uint _s)
 	auto k = keyOf(_orig);
 	assert(_s && _s <= k.size());
 
-	RLPStream bottom(2);
-	bottom << hexPrefixEncode(k, isLeaf(_orig), _s) << _orig[1];
-
-	RLPStream top(2);
-	top << hexPrefixEncode(k, false, 0, _s);
-	streamNode(top, bottom.out());
+	bytesConstRef c = childRef(scratchList(scratchHexPrefix(k.mid(_s), k.size() - _s, isLeaf(_orig)), _orig[1]));
 
-	return top.out();
+	return scratchList(scratchHexPrefix(k, _s, false), RLP(c));
 }
 
-template <class DB> bytes GenericTrieDB<DB>::graft(RLP const& _orig)
+template <class DB> bytesConstRef GenericTrieDB<DB>::graft(RLP const& _orig)
 {
 	assert(_orig.isList() && _orig.itemCount() == 2);
-	std::string s;
+	NodeRef s;
 	RLP n;
 	if (_orig[1].isList())
 		n = _orig[1];
@@ -748,64 +2002,50 @@ template <class DB> bytes GenericTrieDB<DB>::graft(RLP const& _orig)
 		auto lh = _orig[1].toHash<h256>();
 		s = node(lh);
 		killNode(lh);
-		n = RLP(s);
+		n = RLP(*s);
 	}
 	assert(n.itemCount() == 2);
 
-	return (RLPStream(2) << hexPrefixEncode(keyOf(_orig), keyOf(n), isLeaf(n)) << n[1]).out();
+	NibbleSlice k1 = keyOf(_orig);
+	NibbleSlice k2 = keyOf(n);
+	return scratchList(scratchHexPrefix(k1, k1.size(), isLeaf(n), k2, k2.size()), n[1]);
 //	auto ret =
 //	std::cout << keyOf(_orig) << " ++ " << keyOf(n) << " == " << keyOf(RLP(ret)) << std::endl;
 //	return ret;
 }
 
-template <class DB> bytes GenericTrieDB<DB>::merge(RLP const& _orig, byte _i)
+template <class DB> bytesConstRef GenericTrieDB<DB>::merge(RLP const& _orig, byte _i)
 {
 	assert(_orig.isList() && _orig.itemCount() == 17);
-	RLPStream s(2);
 	if (_i != 16)
 	{
 		assert(!_orig[_i].isEmpty());
-		s << hexPrefixEncode(bytesConstRef(&_i, 1), false, 1, 2, 0);
+		return scratchList(scratchHexPrefix(NibbleSlice(bytesConstRef(&_i, 1), 1), 1, false), _orig[_i]);
 	}
 	else
-		s << hexPrefixEncode(bytes(), true);
-	s << _orig[_i];
-	return s.out();
+		return scratchList(scratchHexPrefix(NibbleSlice(), 0, true), _orig[_i]);
 }
 
-template <class DB> bytes GenericTrieDB<DB>::branch(RLP const& _orig)
+template <class DB> bytesConstRef GenericTrieDB<DB>::branch(RLP const& _orig)
 {
 //	::operator<<(std::cout << "branch ", _orig) << std::endl;
 
 	assert(_orig.isList() && _orig.itemCount() == 2);
 
 	auto k = keyOf(_orig);
-	RLPStream r(17);
 	if (k.size() == 0)
 	{
 		assert(isLeaf(_orig));
-		for (uint i = 0; i < 16; ++i)
-			r << "";
-		r << _orig[1];
+		return replacing(RLP(c_emptyBranch), 16, _orig[1]);
 	}
-	else
+
+	byte b = k[0];
+	if (isLeaf(_orig) || k.size() > 1)
 	{
-		byte b = k[0];
-		for (uint i = 0; i < 16; ++i)
-			if (i == b)
-				if (isLeaf(_orig) || k.size() > 1)
-				{
-					RLPStream bottom(2);
-					bottom << hexPrefixEncode(k.mid(1), isLeaf(_orig)) << _orig[1];
-					streamNode(r, bottom.out());
-				}
-				else
-					r << _orig[1];
-			else
-				r << "";
-		r << "";
+		bytesConstRef c = childRef(scratchList(scratchHexPrefix(k.mid(1), k.size() - 1, isLeaf(_orig)), _orig[1]));
+		return replacing(RLP(c_emptyBranch), b, RLP(c));
 	}
-	return r.out();
+	return replacing(RLP(c_emptyBranch), b, _orig[1]);
 }
 
 }
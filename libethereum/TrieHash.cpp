@@ -21,6 +21,9 @@
 
 #include "Common.h"
 #include "TrieCommon.h"
+#include "Keccak.h"
+#include "Exceptions.h"
+#include "WorkerPool.h"
 #include "TrieHash.h"
 using namespace std;
 using namespace eth;
@@ -40,9 +43,13 @@ namespace eth
 bool g_hashDebug = false;
 #endif
 
-void hash256aux(HexMap const& _s, HexMap::const_iterator _begin, HexMap::const_iterator _end, unsigned _preLen, RLPStream& _rlp);
+/// Fewest entries beneath a branch for it to be worth handing its children to a worker pool.
+static const unsigned c_minParallelEntries = 256;
 
-void hash256rlp(HexMap const& _s, HexMap::const_iterator _begin, HexMap::const_iterator _end, unsigned _preLen, RLPStream& _rlp)
+void hash256aux(HexMap const& _s, HexMap::const_iterator _begin, HexMap::const_iterator _end, unsigned _preLen, RLPStream& _rlp, WorkerPool* _pool);
+
+/// Streams the node for entries [_begin, _end) into _rlp. If _pool is given, the children of the first branch are built across it.
+void hash256rlp(HexMap const& _s, HexMap::const_iterator _begin, HexMap::const_iterator _end, unsigned _preLen, RLPStream& _rlp, WorkerPool* _pool)
 {
 #if ENABLE_DEBUG_PRINT
 	static std::string s_indent;
@@ -82,7 +89,7 @@ void hash256rlp(HexMap const& _s, HexMap::const_iterator _begin, HexMap::const_i
 				std::cerr << s_indent << asHex(bytesConstRef(_begin->first.data() + _preLen, sharedPre), 1) << ": " << std::endl;
 #endif
 			_rlp.appendList(2) << hexPrefixEncode(_begin->first, false, _preLen, (int)sharedPre);
-			hash256aux(_s, _begin, _end, (unsigned)sharedPre, _rlp);
+			hash256aux(_s, _begin, _end, (unsigned)sharedPre, _rlp, _pool);
 #if ENABLE_DEBUG_PRINT
 			if (g_hashDebug)
 				std::cerr << s_indent << "= " << hex << sha3(_rlp.out()) << dec << std::endl;
@@ -101,22 +108,49 @@ void hash256rlp(HexMap const& _s, HexMap::const_iterator _begin, HexMap::const_i
 #endif
 				++b;
 			}
+			// build the children first so that those needing a hash can be hashed together.
+			HexMap::const_iterator ends[17];
+			ends[0] = b;
+			unsigned entries = 0;
 			for (auto i = 0; i < 16; ++i)
 			{
-				auto n = b;
-				for (; n != _end && n->first[_preLen] == i; ++n) {}
-				if (b == n)
-					_rlp << "";
-				else
+				auto n = ends[i];
+				for (; n != _end && n->first[_preLen] == i; ++n, ++entries) {}
+				ends[i + 1] = n;
+			}
+			RLPStream children[16];
+			auto buildChild = [&](unsigned i)
+			{
+				if (ends[i] != ends[i + 1])
 				{
 #if ENABLE_DEBUG_PRINT
 					if (g_hashDebug)
 						std::cerr << s_indent << std::hex << i << ": " << std::dec << std::endl;
 #endif
-					hash256aux(_s, b, n, _preLen + 1, _rlp);
+					hash256rlp(_s, ends[i], ends[i + 1], _preLen + 1, children[i], nullptr);
 				}
-				b = n;
-			}
+			};
+			if (_pool && entries >= c_minParallelEntries)
+				_pool->run(16, buildChild);
+			else
+				for (unsigned i = 0; i < 16; ++i)
+					buildChild(i);
+
+			bytesConstRef toHash[16];
+			h256 hashes[16];
+			unsigned hashCount = 0;
+			for (auto const& c: children)
+				if (c.out().size() >= 32)
+					toHash[hashCount++] = bytesConstRef(&c.out());
+			sha3Batch(vector_ref<bytesConstRef const>(toHash, hashCount), vector_ref<h256>(hashes, hashCount));
+			hashCount = 0;
+			for (auto const& c: children)
+				if (c.out().empty())
+					_rlp << "";
+				else if (c.out().size() < 32)
+					_rlp.APPEND_CHILD(c.out());
+				else
+					_rlp << hashes[hashCount++];
 			if (_preLen == _begin->first.size())
 				_rlp << _begin->second;
 			else
@@ -134,10 +168,10 @@ void hash256rlp(HexMap const& _s, HexMap::const_iterator _begin, HexMap::const_i
 #endif
 }
 
-void hash256aux(HexMap const& _s, HexMap::const_iterator _begin, HexMap::const_iterator _end, unsigned _preLen, RLPStream& _rlp)
+void hash256aux(HexMap const& _s, HexMap::const_iterator _begin, HexMap::const_iterator _end, unsigned _preLen, RLPStream& _rlp, WorkerPool* _pool)
 {
 	RLPStream rlp;
-	hash256rlp(_s, _begin, _end, _preLen, rlp);
+	hash256rlp(_s, _begin, _end, _preLen, rlp, _pool);
 	if (rlp.out().size() < 32)
 	{
 		// RECURSIVE RLP
@@ -155,7 +189,7 @@ void hash256aux(HexMap const& _s, HexMap::const_iterator _begin, HexMap::const_i
 	}
 }
 
-h256 hash256(StringMap const& _s)
+h256 hash256(StringMap const& _s, WorkerPool* _pool)
 {
 	// build patricia tree.
 	if (_s.empty())
@@ -164,7 +198,7 @@ h256 hash256(StringMap const& _s)
 	for (auto i = _s.rbegin(); i != _s.rend(); ++i)
 		hexMap[toHex(i->first)] = i->second;
 	RLPStream s;
-	hash256rlp(hexMap, hexMap.cbegin(), hexMap.cend(), 0, s);
+	hash256rlp(hexMap, hexMap.cbegin(), hexMap.cend(), 0, s, _pool);
 	return sha3(s.out());
 }
 
@@ -177,11 +211,11 @@ bytes rlp256(StringMap const& _s)
 	for (auto i = _s.rbegin(); i != _s.rend(); ++i)
 		hexMap[toHex(i->first)] = i->second;
 	RLPStream s;
-	hash256aux(hexMap, hexMap.cbegin(), hexMap.cend(), 0, s);
+	hash256aux(hexMap, hexMap.cbegin(), hexMap.cend(), 0, s, nullptr);
 	return s.out();
 }
 
-h256 hash256(u256Map const& _s)
+h256 hash256(u256Map const& _s, WorkerPool* _pool)
 {
 	// build patricia tree.
 	if (_s.empty())
@@ -190,8 +224,92 @@ h256 hash256(u256Map const& _s)
 	for (auto i = _s.rbegin(); i != _s.rend(); ++i)
 		hexMap[toHex(toBigEndianString(i->first))] = asString(rlp(i->second));
 	RLPStream s;
-	hash256rlp(hexMap, hexMap.cbegin(), hexMap.cend(), 0, s);
+	hash256rlp(hexMap, hexMap.cbegin(), hexMap.cend(), 0, s, _pool);
 	return sha3(s.out());
 }
 
+static void appendChild(RLPStream& _s, bytes const& _rlp)
+{
+	if (_rlp.size() < 32)
+		_s.APPEND_CHILD(_rlp);
+	else
+		_s << sha3(_rlp);
+}
+
+void TrieRootBuilder::insert(bytesConstRef _key, bytesConstRef _value)
+{
+	if (_value.empty())
+		return;
+	if (m_pending)
+	{
+		NibbleSlice last(&m_key);
+		NibbleSlice key(_key);
+		unsigned d = last.shared(key);
+		if (d == key.size() || (d < last.size() && key[d] < last[d]))
+			throw TrieKeyOutOfOrder();
+
+		// everything beneath where the keys part is done with: the pending node goes in the branch there.
+		closeFrom(d + 1);
+		if (m_branches.empty() || m_branches.back().depth < d)
+			m_branches.push_back(Branch(d));
+		Branch& b = m_branches.back();
+		if (d == last.size())
+			b.value = m_value;
+		else
+		{
+			for (; b.next < last[d]; ++b.next)
+				b.rlp << "";
+			appendChild(b.rlp, pendingRLP(d + 1));
+			++b.next;
+		}
+		m_closed.clear();
+	}
+	m_key = _key.toBytes();
+	m_value = _value.toBytes();
+	m_pending = true;
+}
+
+void TrieRootBuilder::closeFrom(unsigned _depth)
+{
+	for (; m_branches.size() && m_branches.back().depth >= _depth; m_branches.pop_back())
+	{
+		Branch& b = m_branches.back();
+		unsigned slot = NibbleSlice(&m_key)[b.depth];
+		for (; b.next < slot; ++b.next)
+			b.rlp << "";
+		appendChild(b.rlp, pendingRLP(b.depth + 1));
+		for (++b.next; b.next < 16; ++b.next)
+			b.rlp << "";
+		b.rlp << b.value;
+		b.rlp.swapOut(m_closed);
+		m_closedDepth = b.depth;
+	}
+}
+
+bytes TrieRootBuilder::pendingRLP(unsigned _from) const
+{
+	if (!m_closed.empty() && m_closedDepth == _from)
+		return m_closed;
+	RLPStream s(2);
+	if (m_closed.empty())
+		s << hexPrefixEncode(NibbleSlice(&m_key), true, _from) << m_value;
+	else
+	{
+		s << hexPrefixEncode(NibbleSlice(&m_key), false, _from, m_closedDepth);
+		appendChild(s, m_closed);
+	}
+	return s.out();
+}
+
+h256 TrieRootBuilder::root()
+{
+	if (!m_pending)
+		return h256();
+	closeFrom(0);
+	h256 ret = sha3(pendingRLP(0));
+	m_pending = false;
+	m_closed.clear();
+	return ret;
+}
+
 }
@@ -22,12 +22,56 @@
 #pragma once
 
 #include "Common.h"
+#include "RLP.h"
 
 namespace eth
 {
 
+class WorkerPool;
+
 bytes rlp256(StringMap const& _s);
-h256 hash256(StringMap const& _s);
-h256 hash256(u256Map const& _s);
+/// If @a _pool is given, large tries have their top-level subtrees built and hashed across it.
+h256 hash256(StringMap const& _s, WorkerPool* _pool = nullptr);
+h256 hash256(u256Map const& _s, WorkerPool* _pool = nullptr);
+
+/**
+ * @brief Computes a trie's root from its entries given in increasing order of key, as read from a database iterator.
+ * Rather than the whole map it holds only the latest entry and, for each branch on the path to it, the encoded
+ * children so far: memory depends on the length of the keys, not their number.
+ */
+class TrieRootBuilder
+{
+public:
+	/// Adds an entry. Empty values are skipped, as in a trie.
+	/// @throws TrieKeyOutOfOrder if @a _key doesn't sort after the key last inserted.
+	void insert(bytesConstRef _key, bytesConstRef _value);
+
+	/// @returns the root of the trie of all entries inserted, as hash256() of them would, and starts afresh.
+	h256 root();
+
+private:
+	/// A branch still open to children; those before @a next are encoded in @a rlp.
+	struct Branch
+	{
+		Branch(unsigned _depth): depth(_depth), rlp(17) {}
+		unsigned depth;
+		unsigned next = 0;
+		RLPStream rlp;
+		bytes value;
+	};
+
+	/// Closes the open branches at or below @a _depth, each taking the pending node as its last child.
+	void closeFrom(unsigned _depth);
+	/// @returns the RLP of the pending node as a child whose key starts at nibble @a _from of m_key.
+	bytes pendingRLP(unsigned _from) const;
+
+	std::vector<Branch> m_branches;		///< In increasing order of depth.
+	bool m_pending = false;
+	/// The pending node: the latest entry or, if m_closed isn't empty, the branch encoded in it at m_closedDepth.
+	bytes m_key;
+	bytes m_value;
+	bytes m_closed;
+	unsigned m_closedDepth = 0;
+};
 
 }
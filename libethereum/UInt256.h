@@ -0,0 +1,404 @@
+/*
+	This file is part of cpp-ethereum.
+
+	cpp-ethereum is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	Foobar is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/** @file UInt256.h
+ * @date 2014
+ *
+ * Fixed-width 256-bit unsigned integer on native 64-bit limbs.
+ */
+
+#pragma once
+
+#include <array>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include "Common.h"
+
+// Double-width products and quotients come from the compiler where it has a 128-bit type, from intrinsics on 64-bit
+// MSVC (products only), and otherwise from 32-bit halves.
+#if defined(__GNUC__) && defined(__SIZEOF_INT128__)
+#define ETH_UINT256_INT128 1
+#else
+#define ETH_UINT256_INT128 0
+#endif
+#if defined(_MSC_VER) && defined(_M_X64)
+#define ETH_UINT256_MSVC_X64 1
+#include <intrin.h>
+#else
+#define ETH_UINT256_MSVC_X64 0
+#endif
+
+namespace eth
+{
+
+/**
+ * @brief Unsigned 256-bit integer held in four native 64-bit limbs, with the same wrap-around (mod 2^256)
+ * arithmetic as u256. Uses compiler intrinsics where there are any (see the limb helpers below) rather than
+ * the generic multiprecision code. Converts explicitly to and from u256 and h256.
+ */
+class UInt256
+{
+public:
+	UInt256(): m_limbs{{0, 0, 0, 0}} {}
+	template <class _T, class = typename std::enable_if<std::is_integral<_T>::value>::type>
+	UInt256(_T _v): m_limbs{{(uint64_t)_v, 0, 0, 0}} { if (std::is_signed<_T>::value && (int64_t)_v < 0) m_limbs[1] = m_limbs[2] = m_limbs[3] = ~(uint64_t)0; }
+	explicit UInt256(u256 const& _v) { byte b[32] = {}; toCompactBigEndianLimbs(_v, b + 32); fromBigEndian(b); }
+	explicit UInt256(h256 const& _h) { fromBigEndian(_h.data()); }
+
+	explicit operator u256() const { byte b[32]; toBigEndian(b); return fromBigEndianLimbs<u256>(bytesConstRef(b, 32)); }
+	explicit operator h256() const { h256 ret; toBigEndian(ret.data()); return ret; }
+	explicit operator bool() const { return m_limbs[0] | m_limbs[1] | m_limbs[2] | m_limbs[3]; }
+	template <class _T, class = typename std::enable_if<std::is_integral<_T>::value>::type>
+	explicit operator _T() const { return (_T)m_limbs[0]; }
+
+	/// Reads/writes the 32-byte big-endian representation at @a _b.
+	void fromBigEndian(byte const* _b) { for (unsigned i = 0; i < 4; ++i) { uint64_t l; memcpy(&l, _b + 24 - 8 * i, 8); m_limbs[i] = toBig(l); } }
+	void toBigEndian(byte* o_b) const { for (unsigned i = 0; i < 4; ++i) { uint64_t l = toBig(m_limbs[i]); memcpy(o_b + 24 - 8 * i, &l, 8); } }
+
+	/// @returns the limb @a _i, least significant first.
+	uint64_t limb(unsigned _i) const { return m_limbs[_i]; }
+
+	/// @returns the index of the most significant set bit; undefined if zero.
+	unsigned msb() const { for (unsigned i = 4; i-- > 0;) if (m_limbs[i]) return i * 64 + 63 - clz(m_limbs[i]); return 0; }
+
+	bool operator==(UInt256 const& _c) const { return !((m_limbs[0] ^ _c.m_limbs[0]) | (m_limbs[1] ^ _c.m_limbs[1]) | (m_limbs[2] ^ _c.m_limbs[2]) | (m_limbs[3] ^ _c.m_limbs[3])); }
+	bool operator!=(UInt256 const& _c) const { return !operator==(_c); }
+	bool operator<(UInt256 const& _c) const { for (unsigned i = 4; i-- > 0;) if (m_limbs[i] != _c.m_limbs[i]) return m_limbs[i] < _c.m_limbs[i]; return false; }
+	bool operator>(UInt256 const& _c) const { return _c < *this; }
+	bool operator<=(UInt256 const& _c) const { return !(_c < *this); }
+	bool operator>=(UInt256 const& _c) const { return !(*this < _c); }
+
+	UInt256& operator+=(UInt256 const& _c)
+	{
+		bool carry = false;
+		for (unsigned i = 0; i < 4; ++i)
+			carry = addCarry(m_limbs[i], _c.m_limbs[i], carry, m_limbs[i]);
+		return *this;
+	}
+	UInt256& operator-=(UInt256 const& _c)
+	{
+		bool borrow = false;
+		for (unsigned i = 0; i < 4; ++i)
+			borrow = subBorrow(m_limbs[i], _c.m_limbs[i], borrow, m_limbs[i]);
+		return *this;
+	}
+	UInt256& operator*=(UInt256 const& _c)
+	{
+		UInt256 r;
+		for (unsigned i = 0; i < 4; ++i)
+		{
+			uint64_t carry = 0;
+			for (unsigned j = 0; i + j < 4; ++j)
+			{
+				// m_limbs[i] * _c.m_limbs[j] + r.m_limbs[i + j] + carry never overflows 128 bits.
+				uint64_t hi;
+				uint64_t lo = mul(m_limbs[i], _c.m_limbs[j], hi);
+				hi += addCarry(lo, r.m_limbs[i + j], false, lo);
+				hi += addCarry(lo, carry, false, lo);
+				r.m_limbs[i + j] = lo;
+				carry = hi;
+			}
+		}
+		return *this = r;
+	}
+	/// @throws std::overflow_error on division by zero, as u256 does.
+	UInt256& operator/=(UInt256 const& _c) { UInt256 r; divMod(*this, _c, *this, r); return *this; }
+	UInt256& operator%=(UInt256 const& _c) { UInt256 q; divMod(*this, _c, q, *this); return *this; }
+	UInt256& operator&=(UInt256 const& _c) { for (unsigned i = 0; i < 4; ++i) m_limbs[i] &= _c.m_limbs[i]; return *this; }
+	UInt256& operator|=(UInt256 const& _c) { for (unsigned i = 0; i < 4; ++i) m_limbs[i] |= _c.m_limbs[i]; return *this; }
+	UInt256& operator^=(UInt256 const& _c) { for (unsigned i = 0; i < 4; ++i) m_limbs[i] ^= _c.m_limbs[i]; return *this; }
+	UInt256& operator<<=(unsigned _n)
+	{
+		unsigned l = _n / 64, b = _n % 64;
+		for (unsigned i = 4; i-- > 0;)
+			m_limbs[i] = i < l ? 0 : (m_limbs[i - l] << b) | (b && i > l ? m_limbs[i - l - 1] >> (64 - b) : 0);
+		return *this;
+	}
+	UInt256& operator>>=(unsigned _n)
+	{
+		unsigned l = _n / 64, b = _n % 64;
+		for (unsigned i = 0; i < 4; ++i)
+			m_limbs[i] = i + l > 3 ? 0 : (m_limbs[i + l] >> b) | (b && i + l < 3 ? m_limbs[i + l + 1] << (64 - b) : 0);
+		return *this;
+	}
+	UInt256& operator++() { for (unsigned i = 0; i < 4 && !++m_limbs[i]; ++i) {} return *this; }
+	UInt256& operator--() { for (unsigned i = 0; i < 4 && !m_limbs[i]--; ++i) {} return *this; }
+	UInt256 operator++(int) { UInt256 ret = *this; ++*this; return ret; }
+	UInt256 operator--(int) { UInt256 ret = *this; --*this; return ret; }
+
+	UInt256 operator+(UInt256 const& _c) const { return UInt256(*this) += _c; }
+	UInt256 operator-(UInt256 const& _c) const { return UInt256(*this) -= _c; }
+	UInt256 operator*(UInt256 const& _c) const { return UInt256(*this) *= _c; }
+	UInt256 operator/(UInt256 const& _c) const { return UInt256(*this) /= _c; }
+	UInt256 operator%(UInt256 const& _c) const { return UInt256(*this) %= _c; }
+	UInt256 operator&(UInt256 const& _c) const { return UInt256(*this) &= _c; }
+	UInt256 operator|(UInt256 const& _c) const { return UInt256(*this) |= _c; }
+	UInt256 operator^(UInt256 const& _c) const { return UInt256(*this) ^= _c; }
+	UInt256 operator<<(unsigned _n) const { return _n < 256 ? UInt256(*this) <<= _n : UInt256(); }
+	UInt256 operator>>(unsigned _n) const { return _n < 256 ? UInt256(*this) >>= _n : UInt256(); }
+	UInt256 operator~() const { UInt256 ret; for (unsigned i = 0; i < 4; ++i) ret.m_limbs[i] = ~m_limbs[i]; return ret; }
+	UInt256 operator-() const { return UInt256() - *this; }
+	bool operator!() const { return !(bool)*this; }
+
+	/// Sets @a o_q to @a _u / @a _v and @a o_r to @a _u % @a _v (Knuth's algorithm D on 64-bit digits).
+	/// @a o_q and @a o_r may alias @a _u or @a _v. @throws std::overflow_error if @a _v is zero.
+	static void divMod(UInt256 const& _u, UInt256 const& _v, UInt256& o_q, UInt256& o_r);
+
+private:
+	static uint64_t toBig(uint64_t _l)
+	{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+		return _l;
+#elif defined(__GNUC__)
+		return __builtin_bswap64(_l);
+#elif defined(_MSC_VER)
+		return _byteswap_uint64(_l);
+#else
+		_l = ((_l & 0x00ff00ff00ff00ffull) << 8) | ((_l >> 8) & 0x00ff00ff00ff00ffull);
+		_l = ((_l & 0x0000ffff0000ffffull) << 16) | ((_l >> 16) & 0x0000ffff0000ffffull);
+		return (_l << 32) | (_l >> 32);
+#endif
+	}
+
+	/// @returns the number of leading zero bits in @a _l, which must be non-zero.
+	static unsigned clz(uint64_t _l)
+	{
+#if defined(__GNUC__)
+		return __builtin_clzll(_l);
+#elif ETH_UINT256_MSVC_X64
+		unsigned long i;
+		_BitScanReverse64(&i, _l);
+		return 63 - i;
+#else
+		unsigned ret = 0;
+		for (unsigned b = 32; b; b /= 2)
+			if (!(_l >> (64 - b)))
+			{
+				ret += b;
+				_l <<= b;
+			}
+		return ret;
+#endif
+	}
+
+	/// Sets @a o_sum to @a _a + @a _b + @a _carry. @returns the carry out.
+	static bool addCarry(uint64_t _a, uint64_t _b, bool _carry, uint64_t& o_sum)
+	{
+#if defined(__GNUC__)
+		bool c1 = __builtin_add_overflow(_a, _b, &o_sum);
+		bool c2 = __builtin_add_overflow(o_sum, (uint64_t)_carry, &o_sum);
+		return c1 | c2;
+#elif ETH_UINT256_MSVC_X64
+		unsigned long long s;
+		bool ret = _addcarry_u64(_carry, _a, _b, &s) != 0;
+		o_sum = s;
+		return ret;
+#else
+		uint64_t s = _a + _b;
+		bool c1 = s < _a;
+		o_sum = s + _carry;
+		return c1 | (o_sum < s);
+#endif
+	}
+
+	/// Sets @a o_diff to @a _a - @a _b - @a _borrow. @returns the borrow out.
+	static bool subBorrow(uint64_t _a, uint64_t _b, bool _borrow, uint64_t& o_diff)
+	{
+#if defined(__GNUC__)
+		bool b1 = __builtin_sub_overflow(_a, _b, &o_diff);
+		bool b2 = __builtin_sub_overflow(o_diff, (uint64_t)_borrow, &o_diff);
+		return b1 | b2;
+#elif ETH_UINT256_MSVC_X64
+		unsigned long long d;
+		bool ret = _subborrow_u64(_borrow, _a, _b, &d) != 0;
+		o_diff = d;
+		return ret;
+#else
+		uint64_t d = _a - _b;
+		bool b1 = _a < _b;
+		o_diff = d - _borrow;
+		return b1 | (d < (uint64_t)_borrow);
+#endif
+	}
+
+	/// @returns the low half of @a _a * @a _b and sets @a o_hi to the high half.
+	static uint64_t mul(uint64_t _a, uint64_t _b, uint64_t& o_hi)
+	{
+#if ETH_UINT256_INT128
+		unsigned __int128 p = (unsigned __int128)_a * _b;
+		o_hi = (uint64_t)(p >> 64);
+		return (uint64_t)p;
+#elif ETH_UINT256_MSVC_X64
+		unsigned long long hi;
+		uint64_t ret = _umul128(_a, _b, &hi);
+		o_hi = hi;
+		return ret;
+#else
+		uint64_t al = (uint32_t)_a, ah = _a >> 32, bl = (uint32_t)_b, bh = _b >> 32;
+		uint64_t ll = al * bl, lh = al * bh, hl = ah * bl, hh = ah * bh;
+		uint64_t mid = (ll >> 32) + (uint32_t)lh + (uint32_t)hl;
+		o_hi = hh + (lh >> 32) + (hl >> 32) + (mid >> 32);
+		return (mid << 32) | (uint32_t)ll;
+#endif
+	}
+
+	/// @returns (@a _hi * 2^64 + @a _lo) / @a _d and sets @a o_rem to the remainder. @a _hi must be less than @a _d,
+	/// so that the quotient fits.
+	static uint64_t div(uint64_t _hi, uint64_t _lo, uint64_t _d, uint64_t& o_rem)
+	{
+#if ETH_UINT256_INT128
+		unsigned __int128 n = ((unsigned __int128)_hi << 64) | _lo;
+		o_rem = (uint64_t)(n % _d);
+		return (uint64_t)(n / _d);
+#else
+		// Two steps of long division in 32-bit digits, after normalising @a _d (Hacker's Delight, divlu).
+		unsigned s = clz(_d);
+		_d <<= s;
+		uint64_t dh = _d >> 32, dl = (uint32_t)_d;
+		uint64_t n32 = s ? (_hi << s) | (_lo >> (64 - s)) : _hi;
+		uint64_t n10 = _lo << s;
+		uint64_t n1 = n10 >> 32, n0 = (uint32_t)n10;
+
+		uint64_t q1 = n32 / dh, r = n32 - q1 * dh;
+		while ((q1 >> 32) || q1 * dl > ((r << 32) | n1))
+		{
+			--q1;
+			r += dh;
+			if (r >> 32)
+				break;
+		}
+		uint64_t n21 = (n32 << 32) + n1 - q1 * _d;
+
+		uint64_t q0 = n21 / dh;
+		r = n21 - q0 * dh;
+		while ((q0 >> 32) || q0 * dl > ((r << 32) | n0))
+		{
+			--q0;
+			r += dh;
+			if (r >> 32)
+				break;
+		}
+		o_rem = ((n21 << 32) + n0 - q0 * _d) >> s;
+		return (q1 << 32) | q0;
+#endif
+	}
+
+	std::array<uint64_t, 4> m_limbs;	///< Least significant first.
+};
+
+inline void UInt256::divMod(UInt256 const& _u, UInt256 const& _v, UInt256& o_q, UInt256& o_r)
+{
+	unsigned n = 4;
+	for (; n && !_v.m_limbs[n - 1]; --n) {}
+	if (!n)
+		throw std::overflow_error("Division by zero.");
+	unsigned m = 4;
+	for (; m && !_u.m_limbs[m - 1]; --m) {}
+
+	if (_u < _v)
+	{
+		o_r = _u;
+		o_q = UInt256();
+		return;
+	}
+
+	UInt256 q;
+	if (n == 1)
+	{
+		// Single-digit divisor: one native 128/64 division per digit.
+		uint64_t d = _v.m_limbs[0];
+		uint64_t rem = 0;
+		for (unsigned i = m; i-- > 0;)
+			q.m_limbs[i] = div(rem, _u.m_limbs[i], d, rem);
+		o_q = q;
+		o_r = UInt256(rem);
+		return;
+	}
+
+	// Normalise so that the divisor's top digit has its high bit set.
+	unsigned s = clz(_v.m_limbs[n - 1]);
+	uint64_t vn[4];
+	uint64_t un[5];
+	for (unsigned i = n; i-- > 0;)
+		vn[i] = (_v.m_limbs[i] << s) | (s && i ? _v.m_limbs[i - 1] >> (64 - s) : 0);
+	un[m] = s ? _u.m_limbs[m - 1] >> (64 - s) : 0;
+	for (unsigned i = m; i-- > 0;)
+		un[i] = (_u.m_limbs[i] << s) | (s && i ? _u.m_limbs[i - 1] >> (64 - s) : 0);
+
+	for (unsigned j = m - n + 1; j-- > 0;)
+	{
+		// Estimate the quotient digit from the top two digits; it is at most two too big. The top digit is never more
+		// than the divisor's, and when they're equal the estimate is the largest digit, with a remainder that may
+		// overflow (in which case the estimate can't be refined).
+		uint64_t qhat;
+		uint64_t rhat;
+		bool rhatOverflow;
+		if (un[j + n] >= vn[n - 1])
+		{
+			qhat = ~(uint64_t)0;
+			rhatOverflow = addCarry(un[j + n - 1], vn[n - 1], false, rhat);
+		}
+		else
+		{
+			qhat = div(un[j + n], un[j + n - 1], vn[n - 1], rhat);
+			rhatOverflow = false;
+		}
+		while (!rhatOverflow)
+		{
+			uint64_t hi;
+			uint64_t lo = mul(qhat, vn[n - 2], hi);
+			if (hi < rhat || (hi == rhat && lo <= un[j + n - 2]))
+				break;
+			--qhat;
+			rhatOverflow = addCarry(rhat, vn[n - 1], false, rhat);
+		}
+
+		// Multiply and subtract.
+		uint64_t carry = 0;
+		bool borrow = false;
+		for (unsigned i = 0; i < n; ++i)
+		{
+			uint64_t hi;
+			uint64_t lo = mul(qhat, vn[i], hi);
+			hi += addCarry(lo, carry, false, lo);
+			carry = hi;
+			borrow = subBorrow(un[i + j], lo, borrow, un[i + j]);
+		}
+		borrow = subBorrow(un[j + n], carry, borrow, un[j + n]);
+
+		q.m_limbs[j] = qhat;
+		if (borrow)
+		{
+			// Estimate was one too big: add the divisor back.
+			--q.m_limbs[j];
+			bool c = false;
+			for (unsigned i = 0; i < n; ++i)
+				c = addCarry(un[i + j], vn[i], c, un[i + j]);
+			un[j + n] += c;
+		}
+	}
+
+	UInt256 r;
+	for (unsigned i = 0; i < n; ++i)
+		r.m_limbs[i] = (un[i] >> s) | (s ? un[i + 1] << (64 - s) : 0);
+	o_q = q;
+	o_r = r;
+}
+
+inline std::ostream& operator<<(std::ostream& _out, UInt256 const& _v) { return _out << (u256)_v; }
+
+}
@@ -0,0 +1,114 @@
+/*
+	This file is part of cpp-ethereum.
+
+	cpp-ethereum is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	Foobar is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/** @file WorkerPool.cpp
+ * @date 2014
+ */
+
+#include "WorkerPool.h"
+using namespace std;
+using namespace eth;
+
+WorkerPool::WorkerPool(unsigned _threads):
+	m_next(0)
+{
+	for (unsigned i = 1; i < _threads; ++i)
+		m_workers.push_back(thread([=](){ work(); }));
+}
+
+WorkerPool::~WorkerPool()
+{
+	{
+		lock_guard<mutex> l(m_lock);
+		m_stop = true;
+	}
+	m_wake.notify_all();
+	for (auto& i: m_workers)
+		i.join();
+}
+
+WorkerPool& WorkerPool::shared()
+{
+	static WorkerPool s_pool;
+	return s_pool;
+}
+
+void WorkerPool::run(unsigned _n, function<void(unsigned)> const& _f)
+{
+	unique_lock<mutex> busy(m_busy, try_to_lock);
+	if (!busy || m_workers.empty() || _n < 2)
+	{
+		for (unsigned i = 0; i < _n; ++i)
+			_f(i);
+		return;
+	}
+
+	{
+		lock_guard<mutex> l(m_lock);
+		m_job = &_f;
+		m_count = _n;
+		m_next = 0;
+		m_active = m_workers.size();
+		m_exception = nullptr;
+		++m_generation;
+	}
+	m_wake.notify_all();
+	drain();
+
+	unique_lock<mutex> l(m_lock);
+	m_done.wait(l, [&](){ return !m_active; });
+	m_job = nullptr;
+	if (m_exception)
+		rethrow_exception(m_exception);
+}
+
+void WorkerPool::drain()
+{
+	for (unsigned i = m_next++; i < m_count; i = m_next++)
+		try
+		{
+			(*m_job)(i);
+		}
+		catch (...)
+		{
+			lock_guard<mutex> l(m_lock);
+			if (!m_exception)
+				m_exception = current_exception();
+		}
+}
+
+void WorkerPool::work()
+{
+	unsigned seen = 0;
+	while (true)
+	{
+		{
+			unique_lock<mutex> l(m_lock);
+			m_wake.wait(l, [&](){ return m_stop || m_generation != seen; });
+			if (m_stop)
+				return;
+			seen = m_generation;
+		}
+		drain();
+		bool last;
+		{
+			lock_guard<mutex> l(m_lock);
+			last = !--m_active;
+		}
+		if (last)
+			m_done.notify_one();
+	}
+}
@@ -0,0 +1,80 @@
+/*
+	This file is part of cpp-ethereum.
+
+	cpp-ethereum is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	Foobar is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/** @file WorkerPool.h
+ * @date 2014
+ */
+
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm>
+#include <exception>
+#include <functional>
+#include <vector>
+
+namespace eth
+{
+
+/**
+ * @brief A fixed set of threads for splitting up a CPU-bound job, such as hashing the subtrees of a trie.
+ */
+class WorkerPool
+{
+public:
+	/// Creates a pool that runs jobs over @a _threads threads in all, including the one calling run().
+	explicit WorkerPool(unsigned _threads = defaultThreads());
+	~WorkerPool();
+
+	WorkerPool(WorkerPool const&) = delete;
+	WorkerPool& operator=(WorkerPool const&) = delete;
+
+	/// The number of threads a job is run over, including the caller.
+	unsigned threads() const { return m_workers.size() + 1; }
+
+	/// Calls @a _f with each of 0 to @a _n - 1, spread over the pool, and returns once all calls have.
+	/// The first exception thrown by any of them is rethrown. If the pool is already busy (e.g. run() is
+	/// called from within a job) the calls are simply made in turn on the calling thread.
+	void run(unsigned _n, std::function<void(unsigned)> const& _f);
+
+	/// The pool shared by the whole process, sized to the hardware.
+	static WorkerPool& shared();
+	static unsigned defaultThreads() { return std::max(1u, std::thread::hardware_concurrency()); }
+
+private:
+	void work();
+	/// Makes calls of the current job until none are left.
+	void drain();
+
+	std::vector<std::thread> m_workers;
+	std::mutex m_busy;						///< Held by whoever is running a job.
+
+	std::mutex m_lock;						///< Guards all below but m_next.
+	std::condition_variable m_wake;
+	std::condition_variable m_done;
+	std::function<void(unsigned)> const* m_job = nullptr;
+	unsigned m_count = 0;
+	std::atomic<unsigned> m_next;
+	unsigned m_generation = 0;				///< Bumped for each job, so workers can tell a new one from a spurious wake.
+	unsigned m_active = 0;					///< Workers yet to finish the current job.
+	std::exception_ptr m_exception;
+	bool m_stop = false;
+};
+
+}
@@ -0,0 +1,98 @@
+/*
+	This file is part of cpp-ethereum.
+
+	cpp-ethereum is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	Foobar is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/** @file fixedHash.cpp
+ * @date 2014
+ * FixedHash test functions: word-wise operators against the arithmetic type, and ordered vs. hashed lookup.
+ */
+
+#include <chrono>
+#include <random>
+#include <Common.h>
+using namespace std;
+using namespace std::chrono;
+using namespace eth;
+
+template <unsigned N> static void checkOperators(mt19937_64& _rng)
+{
+	using Arith = boost::multiprecision::number<boost::multiprecision::cpp_int_backend<N * 8, N * 8, boost::multiprecision::unsigned_magnitude, boost::multiprecision::unchecked, void>>;
+	vector<FixedHash<N>> hs(1);
+	for (unsigned i = 0; i < 200; ++i)
+	{
+		FixedHash<N> h;
+		for (unsigned j = 0; j < N; ++j)
+			h[j] = _rng() % 3 ? (byte)_rng() : 0;
+		hs.push_back(h);
+		// Differ from the previous one only in the last byte, to exercise the tail.
+		h[N - 1] ^= 1;
+		hs.push_back(h);
+	}
+	for (auto const& a: hs)
+	{
+		Arith x = a;
+		assert((bool)a == !!x);
+		FixedHash<N> n = a;
+		assert((Arith)~n == ~x);
+		for (unsigned k = 0; k < 8; ++k)
+		{
+			auto const& b = hs[_rng() % hs.size()];
+			Arith y = b;
+			assert((a == b) == (x == y) && (a != b) == (x != y) && (a < b) == (x < y));
+			assert((Arith)(a ^ b) == (x ^ y) && (Arith)(a | b) == (x | y) && (Arith)(a & b) == (x & y));
+			if (a == b)
+				assert(std::hash<FixedHash<N>>()(a) == std::hash<FixedHash<N>>()(b));
+		}
+	}
+}
+
+template <class _Map> static double nsPerLookup(_Map& _m, vector<h256> const& _keys)
+{
+	unsigned const c_rounds = 16;
+	size_t found = 0;
+	auto start = steady_clock::now();
+	for (unsigned r = 0; r < c_rounds; ++r)
+		for (auto const& k: _keys)
+			found += _m.count(k);
+	double ns = duration_cast<nanoseconds>(steady_clock::now() - start).count();
+	assert(found == c_rounds * _keys.size());
+	return ns / (c_rounds * _keys.size());
+}
+
+int fixedHashTest()
+{
+	mt19937_64 rng(42);
+	checkOperators<32>(rng);
+	checkOperators<20>(rng);
+
+	h256Hash s;
+	for (unsigned i = 0; i < 1000; ++i)
+		s.insert(sha3(toBigEndian(u256(i))));
+	assert(s.size() == 1000 && s.count(sha3(toBigEndian(u256(999)))) && !s.count(h256()));
+
+	// Benchmark: hot-path lookups of hash keys.
+	vector<h256> keys;
+	map<h256, bytes> om;
+	unordered_map<h256, bytes> um;
+	for (unsigned i = 0; i < 100000; ++i)
+	{
+		keys.push_back(sha3(toBigEndian(u256(i))));
+		om[keys.back()];
+		um[keys.back()];
+	}
+	shuffle(keys.begin(), keys.end(), rng);
+	cout << "h256 lookup: std::map " << nsPerLookup(om, keys) << " ns, std::unordered_map " << nsPerLookup(um, keys) << " ns" << endl;
+	return 0;
+}
@@ -0,0 +1,132 @@
+/*
+	This file is part of cpp-ethereum.
+
+	cpp-ethereum is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	Foobar is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/** @file keccak.cpp
+ * @date 2014
+ * Keccak test functions: the in-tree hashes against CryptoPP, and benchmarks.
+ */
+
+#include <chrono>
+#include <random>
+#if WIN32
+#pragma warning(push)
+#pragma warning(disable:4244)
+#else
+#pragma GCC diagnostic ignored "-Wunused-function"
+#endif
+#include <sha3.h>
+#if WIN32
+#pragma warning(pop)
+#endif
+#include <Keccak.h>
+#include <Dagger.h>
+using namespace std;
+using namespace std::chrono;
+using namespace eth;
+
+static h256 cryptoppSha3(bytesConstRef _input)
+{
+	h256 ret;
+	CryptoPP::SHA3_256 ctx;
+	ctx.Update(_input.data(), _input.size());
+	ctx.TruncatedFinal(ret.data(), 32);
+	return ret;
+}
+
+int keccakTest()
+{
+	mt19937_64 rng(42);
+
+	// Every length through the first few blocks, including the fixed-size fast paths.
+	bytes all(3 * 136 + 1);
+	for (auto& b: all)
+		b = (byte)rng();
+	for (unsigned len = 0; len <= all.size(); ++len)
+		assert(sha3(bytesConstRef(all.data(), len)) == cryptoppSha3(bytesConstRef(all.data(), len)));
+
+	// Lengths around the block boundaries, in runs of equal and of mixed length.
+	vector<bytes> data;
+	for (unsigned len: { 0, 1, 31, 32, 33, 64, 134, 135, 136, 137, 271, 272, 273, 1000 })
+		for (unsigned i = 0; i < 5; ++i)
+		{
+			data.push_back(bytes(len));
+			for (auto& b: data.back())
+				b = (byte)rng();
+		}
+	for (unsigned i = 0; i < 37; ++i)
+	{
+		data.push_back(bytes(rng() % 600));
+		for (auto& b: data.back())
+			b = (byte)rng();
+	}
+
+	vector<bytesConstRef> inputs;
+	for (auto const& d: data)
+		inputs.push_back(bytesConstRef(&d));
+	for (bool simd: { false, true })
+	{
+		vector<h256> out(inputs.size());
+		sha3Batch(&inputs, &out, simd);
+		for (unsigned i = 0; i < inputs.size(); ++i)
+			assert(out[i] == sha3(inputs[i]));
+		// And at every misalignment of the batch against the lanes.
+		for (unsigned o = 1; o < 4; ++o)
+		{
+			sha3Batch(vector_ref<bytesConstRef const>(inputs.data() + o, inputs.size() - o), vector_ref<h256>(out.data(), out.size() - o), simd);
+			for (unsigned i = o; i < inputs.size(); ++i)
+				assert(out[i - o] == sha3(inputs[i]));
+		}
+	}
+	// Batched mining finds the same kind of solution as eval() checks.
+	for (unsigned i = 0; i < 20; ++i)
+	{
+		h256 root = sha3(toBigEndian(u256(i)));
+		u256 solution;
+		Dagger d;
+		assert(d.mine(solution, root, 64, 1000).completed && Dagger::verify(root, solution, 64));
+	}
+	assert(sha3(bytesConstRef()) == h256(fromUserHex("c5d2460186f7233c927e7db2dcc703c0e500b653ca82273b7bfad8045d85a470")));
+
+	// Benchmark: many 64-byte inputs, as in mining and trie nodes.
+	vector<bytes> small(4096, bytes(64));
+	vector<bytesConstRef> smallRefs;
+	for (auto& s: small)
+	{
+		for (auto& b: s)
+			b = (byte)rng();
+		smallRefs.push_back(bytesConstRef(&s));
+	}
+	vector<h256> out(small.size());
+	bytes sized(136);
+	auto time = [&](function<void()> const& _f)
+	{
+		auto start = steady_clock::now();
+		_f();
+		return (double)duration_cast<nanoseconds>(steady_clock::now() - start).count() / small.size();
+	};
+	double single = time([&]() { for (unsigned i = 0; i < smallRefs.size(); ++i) out[i] = sha3(smallRefs[i]); });
+	double scalar = time([&]() { sha3Batch(&smallRefs, &out, false); });
+	double batched = time([&]() { sha3Batch(&smallRefs, &out); });
+	for (unsigned len: { 32, 64, 136 })
+	{
+		bytesConstRef in(sized.data(), len);
+		double inTree = time([&]() { for (auto& o: out) o = sha3(in); });
+		double cryptopp = time([&]() { for (auto& o: out) o = cryptoppSha3(in); });
+		cout << "sha3 of " << len << " bytes: in-tree " << inTree << " ns, CryptoPP " << cryptopp << " ns" << endl;
+	}
+	cout << "sha3 of 64 bytes: single " << single << " ns, batch (scalar) " << scalar << " ns, batch (" << sha3BatchLanes() << " lanes) " << batched << " ns" << endl;
+	return 0;
+}
@@ -29,10 +29,33 @@ int cryptoTest();
 int stateTest();
 int hexPrefixTest();
 int peerTest(int argc, char** argv);
+int packetFramerTest();
+int peerSendTest();
+int uint256Test();
+int fixedHashTest();
+int keccakTest();
+int workerPoolTest();
 
+#include <atomic>
 #include <BlockInfo.h>
 using namespace eth;
 
+/// Number of calls to the global operator new so far, from any thread; used by the benchmarks to count allocations.
+std::atomic<size_t> g_allocations(0);
+
+void* operator new(size_t _n)
+{
+	g_allocations.fetch_add(1, std::memory_order_relaxed);
+	if (void* ret = malloc(_n))
+		return ret;
+	throw std::bad_alloc();
+}
+
+void operator delete(void* _p) noexcept
+{
+	free(_p);
+}
+
 int main(int argc, char** argv)
 {
 /*	RLPStream s;
@@ -44,6 +67,12 @@ int main(int argc, char** argv)
 	hexPrefixTest();
 	rlpTest();
 	trieTest();
+	packetFramerTest();
+	peerSendTest();
+	uint256Test();
+	fixedHashTest();
+	keccakTest();
+	workerPoolTest();
 //	daggerTest();
 //	cryptoTest();
 //	stateTest();
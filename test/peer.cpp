@@ -26,6 +26,174 @@ using namespace std;
 using namespace eth;
 using boost::asio::ip::tcp;
 
+static bytes sealed(bytes const& _payload)
+{
+	uint32_t len = _payload.size();
+	bytes ret = { 0x22, 0x40, 0x08, 0x91, (byte)(len >> 24), (byte)(len >> 16), (byte)(len >> 8), (byte)len };
+	return ret + _payload;
+}
+
+int packetFramerTest()
+{
+	typedef pair<PacketFramer::Piece, bytes> Piece;
+
+	bytes big(3 * 1024 * 1024);
+	for (unsigned i = 0; i < big.size(); ++i)
+		big[i] = (byte)(i * 7);
+
+	// Blocks packets: a small one, handed out whole, and a large one, handed out block by block.
+	RLPStream small;
+	small.appendList(3) << (unsigned)Blocks << bytes(100, 1) << bytes(200, 2);
+	vector<bytes> blocks;
+	for (unsigned i = 0; i < 40; ++i)
+		blocks.push_back(rlp(bytes(i % 4 ? i * 997 : 100000 + i, (byte)i)));
+	blocks.push_back(rlpList(1, 2, 3));
+	RLPStream large;
+	large.appendList(blocks.size() + 1) << (unsigned)Blocks;
+	for (auto const& b: blocks)
+		large.appendRaw(b);
+
+	vector<bytes> payloads = { rlpList((unsigned)Ping), bytes(), rlp("dog"), big, small.out(), large.out(), rlpList((unsigned)Pong) };
+	vector<Piece> pieces;
+	for (auto const& p: payloads)
+		if (&p == &payloads[5])
+		{
+			for (auto const& b: blocks)
+				pieces.push_back(Piece(PacketFramer::Item, b));
+			pieces.push_back(Piece(PacketFramer::End, bytes()));
+		}
+		else
+			pieces.push_back(Piece(PacketFramer::Packet, p));
+
+	// Garbage (including partial sync tokens) before, between and after the packets.
+	bytes stream = bytes{ 0x22, 0x40, 0x08, 0x00, 0x22, 1, 2 };
+	size_t largeEnd = 0;
+	for (auto const& p: payloads)
+	{
+		stream = stream + sealed(p) + bytes{ 0x91, 0x22, 0x40 };
+		if (&p == &payloads[5])
+			largeEnd = stream.size() - 3;
+	}
+	size_t garbage = stream.size();
+	for (auto const& p: payloads)
+		garbage -= p.size() + 8;
+
+	for (size_t chunk: { (size_t)1, (size_t)3, (size_t)1000, (size_t)65536, stream.size() })
+	{
+		PacketFramer f;
+		vector<Piece> got;
+		size_t firstBlockAt = 0;
+		for (size_t i = 0; i < stream.size(); i += chunk)
+		{
+			f.feed(bytesConstRef(&stream).cropped(i, min(chunk, stream.size() - i)));
+			PacketFramer::Piece piece;
+			for (bytesConstRef p; f.next(p, piece);)
+			{
+				if (piece == PacketFramer::Item && !firstBlockAt)
+					firstBlockAt = i + chunk;
+				got.push_back(Piece(piece, p.toBytes()));
+			}
+		}
+		assert(got == pieces);
+		// Blocks are handed out as they arrive, not once the packet is all in.
+		assert(chunk == stream.size() || firstBlockAt < largeEnd);
+		assert(f.pending() == 2);	// the trailing "\x22\x40" may yet become a sync token.
+		assert(f.skipped() == garbage - 2);
+	}
+
+	// A block claiming more than is left of its packet is a broken packet.
+	{
+		RLPStream s;
+		s.appendList(2) << (unsigned)Blocks << bytes(100000, 0);
+		bytes broken = sealed(s.out());
+		broken[8 + 6] = 0xff;	// the block's length (after the list's and its own headers and the packet type), now beyond the packet.
+		PacketFramer f;
+		f.feed(&broken);
+		bytesConstRef p;
+		PacketFramer::Piece piece;
+		bool threw = false;
+		try
+		{
+			f.next(p, piece);
+		}
+		catch (BadPacket const&)
+		{
+			threw = true;
+		}
+		assert(threw);
+	}
+	return 0;
+}
+
+namespace eth
+{
+/// Reaches into a PeerSession's write queue, to see how the packets sent to it are gathered into writes.
+struct PeerSessionTest
+{
+	static void send(PeerSession& _s, SealedPacket const& _p) { _s.send(_p); }
+	static vector<SealedPacket> const& writing(PeerSession const& _s) { return _s.m_writing; }
+	static vector<SealedPacket> const& queued(PeerSession const& _s) { return _s.m_writeQueue; }
+};
+}
+
+int peerSendTest()
+{
+	typedef PeerSessionTest T;
+	ba::io_service io;
+	ba::io_service::work work(io);	// so run_one() waits for the next write rather than stopping between them.
+	bi::tcp::acceptor acceptor(io, bi::tcp::endpoint(bi::address_v4::loopback(), 0));
+	PeerServer server("Test", 0);
+	server.setVerbosity(0);
+
+	// Each session writes to one end of a loopback connection; what it sent is read from the other.
+	vector<bi::tcp::socket> remotes;
+	vector<shared_ptr<PeerSession>> sessions;
+	remotes.reserve(3);
+	for (unsigned i = 0; i < 3; ++i)
+	{
+		bi::tcp::socket s(io);
+		s.connect(acceptor.local_endpoint());
+		remotes.emplace_back(io);
+		acceptor.accept(remotes.back());
+		sessions.push_back(make_shared<PeerSession>(&server, std::move(s), 0));
+	}
+	auto received = [&](unsigned _i, size_t _n) { bytes ret(_n); ba::read(remotes[_i], ba::buffer(ret)); return ret; };
+
+	// Packets sent while a write is in flight are queued, then all go out in order in the next (single) write.
+	{
+		PeerSession& s = *sessions[0];
+		SealedPacket a = make_shared<bytes const>(sealed(rlpList((unsigned)Ping)));
+		SealedPacket b = make_shared<bytes const>(sealed(rlpList((unsigned)Pong)));
+		SealedPacket c = make_shared<bytes const>(sealed(rlpList((unsigned)GetPeers)));
+		T::send(s, a);
+		T::send(s, b);
+		T::send(s, c);
+		assert(T::writing(s) == vector<SealedPacket>{ a } && (T::queued(s) == vector<SealedPacket>{ b, c }));
+		while (T::writing(s).size() && T::writing(s)[0] == a)
+			io.run_one();
+		assert((T::writing(s) == vector<SealedPacket>{ b, c }) && T::queued(s).empty());
+		while (T::writing(s).size())
+			io.run_one();
+		assert(received(0, a->size() + b->size() + c->size()) == *a + *b + *c);
+	}
+
+	// One packet broadcast to several sessions is shared by them all, not copied into each.
+	{
+		SealedPacket p = make_shared<bytes const>(sealed(bytes(4096, 0x42)));
+		for (unsigned i = 1; i < 3; ++i)
+			T::send(*sessions[i], p);
+		assert(p.use_count() == 3);
+		for (unsigned i = 1; i < 3; ++i)
+			assert(T::writing(*sessions[i]).size() == 1 && T::writing(*sessions[i])[0].get() == p.get());
+		while (T::writing(*sessions[1]).size() || T::writing(*sessions[2]).size())
+			io.run_one();
+		for (unsigned i = 1; i < 3; ++i)
+			assert(received(i, p->size()) == *p);
+		assert(p.use_count() == 1);
+	}
+	return 0;
+}
+
 int peerTest(int argc, char** argv)
 {
 	short listenPort = 30303;
@@ -20,10 +20,16 @@
  * RLP test functions.
  */
 
+#include <atomic>
 #include <RLP.h>
+#include <RLPSchema.h>
+#include <BlockInfo.h>
+#include <Exceptions.h>
 using namespace std;
 using namespace eth;
 
+extern std::atomic<size_t> g_allocations;
+
 int rlpTest()
 {
 	// int of value 15
@@ -42,6 +48,26 @@ int rlpTest()
 	assert(twoItemList[1] == "dog");
 	assert(asString(rlpList(15, "dog")) == "\xc5\x0f\x83""dog");
 
+	// indexed 2-item list
+	RLPIndex twoItemIndex = twoItemList.index();
+	assert(twoItemIndex.itemCount() == 2);
+	assert(twoItemIndex[1] == "dog");
+	assert(twoItemIndex[0] == 15);
+	assert(twoItemIndex[2].isNull());
+	assert(RLP("\x83""dog").index().itemCount() == 0);
+
+	// indexed long list (spills beyond the inline offsets)
+	{
+		RLPStream s(100);
+		for (unsigned i = 0; i < 100; ++i)
+			s << (eth::uint)i * 1000;
+		RLP r(s.out());
+		RLPIndex ri = r.index();
+		assert(ri.itemCount() == 100 && r.itemCount() == 100);
+		for (unsigned i = 100; i-- > 0;)
+			assert(ri[i] == (eth::uint)i * 1000 && ri[i].data() == r[i].data());
+	}
+
 	// null
 	assert(RLP("\x80") == "");
 	assert(asString(rlp("")) == "\x80");
@@ -62,6 +88,215 @@ int rlpTest()
 	assert(RLP("\xb8\x38""Lorem ipsum dolor sit amet, consectetur adipisicing elit") == "Lorem ipsum dolor sit amet, consectetur adipisicing elit");
 	assert(asString(rlp("Lorem ipsum dolor sit amet, consectetur adipisicing elit")) == "\xb8\x38""Lorem ipsum dolor sit amet, consectetur adipisicing elit");
 
+	// native uint/u160/u256 encoding and decoding agree with bigint.
+	{
+		u256s vals = { 0, 1, 0x7f, 0x80, 0xff, 0x100, 0xffffffff, (u256)1 << 63, ~(u256)0 >> 96, ~(u256)0 >> 8, ~(u256)0 };
+		for (unsigned i = 0; i < 256; i += 7)
+			vals.push_back(((u256)1 << i) + i);
+		for (auto v: vals)
+		{
+			bytes e = RLPStream().append(v).out();
+			assert(e == RLPStream().append(bigint(v)).out());
+			assert(RLPMeasure().append(v).size() == e.size());
+			assert(RLP(e).toInt<u256>() == v);
+			u160 w = (u160)v;
+			bytes f = RLPStream().append(w).out();
+			assert(f == RLPStream().append(bigint(w)).out());
+			assert(RLPMeasure().append(w).size() == f.size());
+			assert(RLP(f).toInt<u160>() == w);
+			assert(RLP(e).toInt<u160>(RLP::LaisezFaire) == w);
+			eth::uint x = (eth::uint)v;
+			bytes g = RLPStream().append(x).out();
+			assert(g == RLPStream().append(bigint(x)).out());
+			assert(RLPMeasure().append(x).size() == g.size());
+			assert(RLP(g).toInt<eth::uint>() == x);
+		}
+	}
+
+	// typed schemas decode in place and report malformed input by return value.
+	{
+		using S = RLPSchema<RLPInt<eth::uint>, RLPBytes, RLPListOf<RLPHash<32>>, RLPSchema<RLPInt<u256>, RLPList>>;
+		S::Type v;
+		h256 h = sha3("dog");
+		RLP empty(RLPEmptyList);
+		bytes inner = rlpList(u256(1) << 200, empty);
+		bytes good = rlpList(1024, "dog", h256s{ h, h256() }, RLP(inner));
+		assert(S::decode(&good, v));
+		assert(get<0>(v) == 1024 && get<1>(v).toString() == "dog" && get<2>(v) == (h256s{ h, h256() }));
+		assert(get<1>(v).data() >= good.data() && get<1>(v).data() < good.data() + good.size());
+		assert(get<0>(get<3>(v)) == u256(1) << 200 && get<1>(get<3>(v)).itemCount() == 0);
+
+		auto bad = [](bytes const& _b) { S::Type v; return !S::decode(&_b, v); };
+		for (unsigned i = 0; i < good.size(); ++i)
+			assert(bad(bytes(good.begin(), good.begin() + i)));	// truncated
+		assert(bad(good + bytes(1, 0)));	// trailing data
+		assert(bad(rlpList(1024, "dog", h256s{ h })));	// too few fields
+		assert(bad(rlpList(1024, "dog", h256s{ h }, RLP(inner), 1)));	// too many fields
+		assert(bad(rlpList(empty, "dog", h256s{ h }, RLP(inner))));	// list for int
+		assert(bad(rlpList(1024, empty, h256s{ h }, RLP(inner))));	// list for data
+		assert(bad(rlpList(1024, "dog", h256s{ h }, inner)));	// data for list
+		assert(bad(rlpList(1024, "dog", vector<string>{ string(33, 'x') }, RLP(inner))));	// oversized hash
+		assert(bad(rlpList(u256(1) << 64, "dog", h256s{ h }, RLP(inner))));	// int too big
+		bytes nonCanon = { 0xc9, 0x82, 0x00, 0x01, 0x80, 0xc0, 0xc3, 0x01, 0xc1, 0xc0 };
+		assert(bad(nonCanon));	// leading zero
+		nonCanon[2] = 0x01;
+		assert(!bad(nonCanon));
+		assert(!S::decode(RLP(RLPNull), v));
+
+		// a transaction round-trips through its schema and rejects garbage.
+		Transaction t;
+		t.nonce = 42;
+		t.receiveAddress = right160(h);
+		t.value = 1000000;
+		t.data = u256s{ 1, 2, u256(1) << 255 };
+		t.vrs = Signature{ 27, 1, 2 };
+		bytes tr = t.rlp();
+		Transaction u(&tr);
+		assert(u.nonce == t.nonce && u.receiveAddress == t.receiveAddress && u.value == t.value && u.data == t.data && u.vrs.s == t.vrs.s);
+		bool threw = false;
+		try { Transaction w(&good); } catch (InvalidTransactionFormat const&) { threw = true; }
+		assert(threw);
+	}
+
+	// prepared (exact-size) streams write the same bytes as unprepared ones.
+	{
+		auto fill = [](RLPStream& _s)
+		{
+			_s.appendList(4) << "dog" << bytes(100, 42);
+			_s.appendList(2) << (eth::uint)1024 << h256(fromUserHex("ff00ff00ff00ff00ff00ff00ff00ff00ff00ff00ff00ff00ff00ff00ff00ff00"));
+			_s.appendList(0);
+		};
+		auto measure = [](RLPMeasure& _s)
+		{
+			_s.appendList(4) << "dog" << bytes(100, 42);
+			_s.appendList(2) << (eth::uint)1024 << h256(fromUserHex("ff00ff00ff00ff00ff00ff00ff00ff00ff00ff00ff00ff00ff00ff00ff00ff00"));
+			_s.appendList(0);
+		};
+		RLPStream plain;
+		fill(plain);
+		RLPMeasure m;
+		measure(m);
+		assert(m.size() == plain.out().size());
+		RLPStream prepared;
+		measure(prepared.measure());
+		size_t room = prepared.prepare().out().capacity();
+		fill(prepared);
+		assert(prepared.out() == plain.out());
+		// all written to the room prepare() made, without growing it.
+		assert(prepared.out().capacity() == room && room >= prepared.out().size());
+	}
+
+	// prepared fills within lists still open, prepared or not, write the same bytes as the plain encoding.
+	{
+		Transaction t;
+		t.nonce = 42;
+		t.value = 1000000;
+		t.fee = 100;
+		t.data = u256s{ 1, 2, u256(1) << 255 };
+		t.vrs = Signature{ 27, 1, 2 };
+		bytes tr = t.rlp();
+
+		RLPStream plain(2);
+		plain.appendRaw(tr).appendRaw(tr);
+		RLPStream txs(2);
+		t.fillStream(txs);
+		t.fillStream(txs);
+		assert(txs.out() == plain.out());
+		assert(RLP(txs.out()).itemCount() == 2);
+
+		// an outer prepare() whose lists are not all begun when a transaction prepares its own.
+		RLPStream nestedPlain(2);
+		nestedPlain.appendRaw(tr);
+		nestedPlain.appendList(2) << "dog" << tr;
+		RLPStream nested;
+		nested.measure().appendList(2).appendRaw(tr).appendList(2) << "dog" << tr;
+		nested.prepare().appendList(2);
+		t.fillStream(nested);
+		nested.appendList(2) << "dog" << tr;
+		assert(nested.out() == nestedPlain.out());
+
+		// and the same for block headers.
+		BlockInfo const& bi = BlockInfo::genesis();
+		RLPStream header;
+		bi.fillStream(header, true);
+		RLPStream headers(3);
+		bi.fillStream(headers, true);
+		t.fillStream(headers);
+		bi.fillStream(headers, true);
+		RLPStream headersPlain(3);
+		headersPlain.appendRaw(header.out()).appendRaw(tr).appendRaw(header.out());
+		assert(headers.out() == headersPlain.out());
+	}
+
+	// Benchmark: allocations when encoding a block (its header, transactions and uncles); only reported.
+	{
+		Transaction t;
+		t.nonce = 42;
+		t.value = 1000000;
+		t.fee = 100;
+		t.data = u256s(20, 0xdeadbeef);
+		t.vrs = Signature{27, 1, 2};
+		BlockInfo const& bi = BlockInfo::genesis();
+		unsigned const c_txs = 100;
+		unsigned const c_uncles = 2;
+
+		// as it was: each list's header inserted once it's complete, and the transactions and uncles encoded
+		// into streams of their own before being copied into the block's.
+		auto oldHeader = [&](RLPStream& _s) { _s.appendList(9) << bi.parentHash << bi.sha3Uncles << bi.coinbaseAddress << bi.stateRoot << bi.sha3Transactions << bi.difficulty << bi.timestamp << bi.extraData << bi.nonce; };
+		size_t a = g_allocations;
+		RLPStream txs(c_txs);
+		for (unsigned i = 0; i < c_txs; ++i)
+			txs.appendList(8) << t.nonce << t.receiveAddress << t.value << t.fee << t.data << t.vrs.v << t.vrs.r << t.vrs.s;
+		RLPStream uncles(c_uncles);
+		for (unsigned i = 0; i < c_uncles; ++i)
+			oldHeader(uncles);
+		RLPStream unpreparedOut(3);
+		oldHeader(unpreparedOut);
+		unpreparedOut.appendRaw(txs.out()).appendRaw(uncles.out());
+		size_t unprepared = g_allocations - a;
+
+		// measured up front and written in one pass, straight into the block's stream.
+		auto encode = [&](RLPStream& _s)
+		{
+			RLPMeasure& m = _s.measure().appendList(3);
+			bi.fillMeasure(m, true);
+			m.appendList(c_txs);
+			for (unsigned i = 0; i < c_txs; ++i)
+				t.fillMeasure(m);
+			m.appendList(c_uncles);
+			for (unsigned i = 0; i < c_uncles; ++i)
+				bi.fillMeasure(m, true);
+			size_t room = _s.prepare().out().capacity();
+			_s.appendList(3);
+			bi.fillStream(_s, true);
+			_s.appendList(c_txs);
+			for (unsigned i = 0; i < c_txs; ++i)
+				t.fillStream(_s);
+			_s.appendList(c_uncles);
+			for (unsigned i = 0; i < c_uncles; ++i)
+				bi.fillStream(_s, true);
+			// the nested fillStream()s prepare within the room made for the block, without growing it.
+			assert(_s.out().capacity() == room);
+		};
+		a = g_allocations;
+		RLPStream preparedOut;
+		encode(preparedOut);
+		size_t prepared = g_allocations - a;
+		assert(preparedOut.out() == unpreparedOut.out());
+		RLP block(preparedOut.out());
+		assert(block.itemCount() == 3 && block[1].itemCount() == c_txs && block[2].itemCount() == c_uncles);
+
+		// a stream kept for the next block has its bookkeeping to hand.
+		bytes first;
+		preparedOut.swapOut(first);
+		a = g_allocations;
+		encode(preparedOut);
+		size_t reused = g_allocations - a;
+		assert(preparedOut.out() == first);
+
+		cout << "Allocations per block (" << c_txs << " transactions, " << c_uncles << " uncles): " << unprepared << " unprepared, " << prepared << " prepared, " << reused << " prepared into a reused stream" << endl;
+	}
+
 	return 0;
 }
 
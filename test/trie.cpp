@@ -20,15 +20,84 @@
  * Trie test functions.
  */
 
+#include <chrono>
 #include <random>
+#include <thread>
+#include <atomic>
 #include <TrieHash.h>
 #include <TrieDB.h>
 #include <MemTrie.h>
+#include <Arena.h>
+#include <Exceptions.h>
 using namespace std;
 using namespace eth;
 
+extern std::atomic<size_t> g_allocations;
+
+namespace
+{
+
+/// A BasicMap that counts the allocations made within it and its node cache, to tell them from the trie's own.
+class AllocationCountingMap: public BasicMap
+{
+public:
+	/// Stands in for the node cache, counting what it allocates.
+	class Cache
+	{
+	public:
+		Cache(AllocationCountingMap const* _m): m_map(_m) {}
+		template <class _F> NodeRef lookup(h256 const& _h, _F const& _fetch) { Scope s(m_map); return m_cache.lookup(_h, _fetch); }
+
+	private:
+		AllocationCountingMap const* m_map;
+		NodeCache m_cache;
+	};
+
+	std::string lookup(h256 _h) const { Scope s(this); return BasicMap::lookup(_h); }
+	void insert(h256 _h, bytesConstRef _v) { Scope s(this); BasicMap::insert(_h, _v); }
+	void kill(h256 _h) { Scope s(this); BasicMap::kill(_h); }
+	Cache& nodeCache() const { return m_cache; }
+
+	/// Allocations made within the map and its cache so far.
+	size_t allocations() const { return m_allocations; }
+
+private:
+	/// Counts the allocations made during its lifetime, unless it's within another.
+	struct Scope
+	{
+		Scope(AllocationCountingMap const* _m): m(_m), start(g_allocations) { ++m->m_depth; }
+		~Scope() { if (!--m->m_depth) m->m_allocations += g_allocations - start; }
+		AllocationCountingMap const* m;
+		size_t start;
+	};
+
+	mutable unsigned m_depth = 0;
+	mutable size_t m_allocations = 0;
+	mutable Cache m_cache{this};
+};
+
+}
+
 int trieTest()
 {
+	{
+		// Keys with bytes of 0x80 and above split into nibbles as their unsigned values, whatever the sign of char.
+		assert(toHex(string("\x80\xff\x7f")) == bytes({8, 0, 15, 15, 7, 15}));
+		StringMap s;
+		s[string("\xff\x80")] = "high";
+		s[string("\x7f\x00", 2)] = "low";
+		s[string("\xff")] = "short";
+		BasicMap m;
+		GenericTrieDB<BasicMap> t(&m);
+		t.init();
+		for (auto const& i: s)
+			t.insert(i.first, i.second);
+		assert(hash256(s) == t.root());
+		MemTrie mt;
+		for (auto const& i: s)
+			mt.insert(i.first, i.second);
+		assert(mt.hash256() == t.root());
+	}
 	{
 		BasicMap m;
 		GenericTrieDB<BasicMap> t(&m);
@@ -186,6 +255,806 @@ int trieTest()
 			}
 		}
 	}
+	{
+		// The node cache: results don't depend on its budget, and repeated reads hit it.
+		for (size_t budget: { (size_t)0, (size_t)4096, (size_t)1 << 24 })
+		{
+			BasicMap m;
+			m.nodeCache().setBudget(budget);
+			GenericTrieDB<BasicMap> d(&m);
+			d.init();
+			StringMap s;
+			for (int i = 0; i < 300; ++i)
+			{
+				auto k = randomWord();
+				s[k] = toString(i);
+				d.insert(k, toString(i));
+			}
+			assert(d.root() == hash256(s));
+			assert(m.nodeCache().used() <= budget);
+			m.nodeCache().resetCounters();
+			for (auto const& i: s)
+				assert(d.at(i.first) == i.second);
+			if (budget > 4096)
+				assert(m.nodeCache().hits() > m.nodeCache().misses());
+			else if (!budget)
+				assert(!m.nodeCache().hits() && !m.nodeCache().count());
+		}
+	}
+	{
+		// Roots built from a stream of sorted entries are those of the whole map.
+		mt19937_64 rng(42);
+		TrieRootBuilder b;
+		for (int round = 0; round < 100; ++round)
+		{
+			StringMap s;
+			for (unsigned n = rng() % 40; n; --n)
+				s[randomWord()] = toString(rng() % 1000);
+			if (round % 3 == 0)
+			{
+				s[""] = "root";
+				s["do"] = "verb";
+				s["dog"] = "puppy";
+				s["doge"] = "coin";
+			}
+			for (auto const& i: s)
+				b.insert(i.first, i.second);
+			assert(b.root() == hash256(s));
+		}
+		u256Map m;
+		for (unsigned i = 0; i < 5000; ++i)
+			m[u256(sha3(toBigEndian(u256(i))))] = i;
+		for (auto const& i: m)
+		{
+			bytes v = rlp(i.second);
+			b.insert(toBigEndianString(i.first), &v);
+		}
+		assert(b.root() == hash256(m));
+
+		b.insert(string("dog"), string("puppy"));
+		bool threw = false;
+		try
+		{
+			b.insert(string("do"), string("verb"));
+		}
+		catch (TrieKeyOutOfOrder const&)
+		{
+			threw = true;
+		}
+		assert(threw);
+	}
+	{
+		// Diffs find just the keys that changed between two roots, without walking what the tries share.
+		mt19937_64 rng(42);
+		// Each trie gets its own map, as BasicMap's reference counts assume one trie; both roots' nodes then go in one.
+		BasicMap m;
+		BasicMap mt;
+		GenericTrieDB<BasicMap> from(&m);
+		GenericTrieDB<BasicMap> to(&mt);
+		from.init();
+		to.init();
+		StringMap a;
+		for (unsigned i = 0; i < 3000; ++i)
+			a[toBigEndianString(sha3(toBigEndian(u256(i))))] = toString(i);
+		a[""] = "root";
+		a["do"] = "verb";
+		a["dog"] = "puppy";
+		vector<string> keys;
+		for (auto const& i: a)
+		{
+			from.insert(i.first, i.second);
+			to.insert(i.first, i.second);
+			keys.push_back(i.first);
+		}
+		StringMap b = a;
+		for (unsigned i = 0; i < 30; ++i)
+		{
+			string k = keys[rng() % keys.size()];
+			if (i % 3 == 0)
+				b[k] = "changed" + toString(i);
+			else if (i % 3 == 1)
+				b.erase(k);
+			else
+				b[k + toString(i)] = toString(i);
+		}
+		b.erase("do");
+		b["doge"] = "coin";
+		for (auto const& i: a)
+			if (!b.count(i.first))
+				to.remove(i.first);
+		for (auto const& i: b)
+			if (!a.count(i.first) || a[i.first] != i.second)
+				to.insert(i.first, i.second);
+		assert(to.root() == hash256(b));
+		for (auto const& i: mt.get())
+			m.insert(i.first, bytesConstRef(i.second));
+
+		m.nodeCache().setBudget(0);
+		m.nodeCache().resetCounters();
+		auto changes = from.diff(from.root(), to.root());
+		unsigned fetched = m.nodeCache().misses();
+		vector<GenericTrieDB<BasicMap>::Change> expected;
+		StringMap all = a;
+		all.insert(b.begin(), b.end());
+		for (auto const& i: all)
+		{
+			string x = a.count(i.first) ? a[i.first] : string();
+			string y = b.count(i.first) ? b[i.first] : string();
+			if (x != y)
+				expected.push_back(GenericTrieDB<BasicMap>::Change{asBytes(i.first), asBytes(x), asBytes(y)});
+		}
+		assert(changes.size() == expected.size());
+		for (unsigned i = 0; i < changes.size(); ++i)
+			assert(changes[i].key == expected[i].key && changes[i].from == expected[i].from && changes[i].to == expected[i].to);
+		assert(fetched < a.size() / 10);
+
+		auto back = from.diff(to.root(), from.root());
+		assert(back.size() == changes.size() && back[0].from == changes[0].to && back[0].to == changes[0].from);
+		assert(from.diff(h256(), from.root()).size() == a.size());
+		assert(from.diff(to.root(), to.root()).empty());
+		cout << changes.size() << " changes between roots of " << a.size() << " entries: " << fetched << " nodes fetched" << endl;
+	}
+	{
+		// Batches leave the same trie as the equivalent inserts and removes.
+		mt19937_64 rng(42);
+		BasicMap ms;
+		BasicMap mb;
+		GenericTrieDB<BasicMap> sequential(&ms);
+		GenericTrieDB<BasicMap> batched(&mb);
+		sequential.init();
+		batched.init();
+		StringMap s;
+		vector<string> keys;
+		for (int i = 0; i < 60; ++i)
+			keys.push_back(randomWord());
+		keys.push_back("");
+		keys.push_back("do");
+		keys.push_back("dog");
+		keys.push_back("doge");
+		for (int round = 0; round < 200; ++round)
+		{
+			vector<pair<string, string>> items;
+			for (unsigned n = rng() % 12; n; --n)
+				items.push_back(make_pair(keys[rng() % keys.size()], rng() % 3 ? toString(rng() % 1000) : string()));
+			sort(items.begin(), items.end(), [](pair<string, string> const& _a, pair<string, string> const& _b) { return _a.first < _b.first; });
+			vector<GenericTrieDB<BasicMap>::BatchItem> batch;
+			for (auto const& i: items)
+			{
+				batch.push_back(make_pair(bytesConstRef(i.first), bytesConstRef(i.second)));
+				if (i.second.empty())
+				{
+					sequential.remove(bytesConstRef(i.first));
+					s.erase(i.first);
+				}
+				else
+				{
+					sequential.insert(bytesConstRef(i.first), bytesConstRef(i.second));
+					s[i.first] = i.second;
+				}
+			}
+			batched.applyBatch(&batch);
+			assert(batched.root() == sequential.root());
+			assert(batched.root() == hash256(s));
+			// and only the nodes reachable from the root; insert() and remove() can leave stale nodes behind.
+			h256Hash reachable;
+			function<void(RLP const&)> walk = [&](RLP const& _n)
+			{
+				if (_n.isData() && _n.size() == 32)
+				{
+					h256 h = _n.toHash<h256>();
+					reachable.insert(h);
+					return walk(RLP(mb.lookup(h)));
+				}
+				if (_n.isList() && _n.itemCount() == 2 && !isLeaf(_n))
+					walk(_n[1]);
+				else if (_n.isList() && _n.itemCount() == 17)
+					for (unsigned i = 0; i < 16; ++i)
+						walk(_n[i]);
+			};
+			walk(RLP(rlp(batched.root() ? batched.root() : c_shaNull)));
+			assert(mb.get().size() == reachable.size());
+			for (auto const& i: reachable)
+				assert(mb.get().count(i));
+			for (auto const& i: s)
+				assert(batched.at(bytesConstRef(i.first)) == i.second);
+		}
+	}
+	{
+		// Iteration, seeking and ranges visit just what the ordered map would.
+		mt19937_64 rng(42);
+		BasicMap m;
+		GenericTrieDB<BasicMap> d(&m);
+		d.init();
+		StringMap s;
+		auto randomKey = [&]()
+		{
+			string k(rng() % 5, '\0');
+			for (auto& c: k)
+				c = "\x00\x01\x10\x11\x7f\x80\xfe\xff"[rng() % 8];
+			return k;
+		};
+		for (int i = 0; i < 300; ++i)
+		{
+			auto k = randomKey();
+			s[k] = toString(i);
+			d.insert(k, toString(i));
+		}
+		auto it = s.begin();
+		for (auto const& i: d)
+		{
+			assert(it != s.end() && i.first.toString() == it->first && i.second.toString() == it->second);
+			++it;
+		}
+		assert(it == s.end());
+		for (int i = 0; i < 500; ++i)
+		{
+			string a = randomKey();
+			string b = randomKey();
+			auto di = d.lower_bound(bytesConstRef(a));
+			auto si = s.lower_bound(a);
+			assert((di == d.end()) == (si == s.end()));
+			if (si != s.end())
+			{
+				assert((*di).first.toString() == si->first);
+				assert(di == d.lower_bound(bytesConstRef(si->first)));
+			}
+			vector<string> want;
+			for (auto j = si; j != s.end() && j->first < b; ++j)
+				want.push_back(j->first);
+			vector<string> got;
+			for (auto const& j: d.range(bytesConstRef(a), bytesConstRef(b)))
+				got.push_back(j.first.toString());
+			assert(got == want);
+			want.clear();
+			for (auto j = si; j != s.end() && j->first.compare(0, a.size(), a) == 0; ++j)
+				want.push_back(j->first);
+			got.clear();
+			for (auto const& j: d.prefixed(bytesConstRef(a)))
+				got.push_back(j.first.toString());
+			assert(got == want);
+		}
+
+		TrieDB<Address, BasicMap> t(&m);
+		t.init();
+		map<Address, bytes> accounts;
+		for (unsigned i = 0; i < 100; ++i)
+		{
+			Address a = right160(sha3(toBigEndian(u256(i))));
+			accounts[a] = rlp(u256(i));
+			t.insert(a, accounts[a]);
+		}
+		Address from = right160(sha3(string("from")));
+		Address to = right160(sha3(string("to")));
+		if (to < from)
+			swap(from, to);
+		auto ai = accounts.lower_bound(from);
+		for (auto const& i: t.range(from, to))
+		{
+			assert(ai->first == i.first && ai->second == i.second.toBytes());
+			++ai;
+		}
+		assert(ai == accounts.lower_bound(to));
+	}
+	{
+		// Proofs show each key's value, or its absence, given just the root; and nothing else gets through.
+		mt19937_64 rng(42);
+		BasicMap m;
+		GenericTrieDB<BasicMap> d(&m);
+		d.init();
+		assert(verifyProof(d.root(), bytesConstRef(string("dog")), d.prove(bytesConstRef(string("dog")))).empty());
+		StringMap s;
+		for (int i = 0; i < 200; ++i)
+		{
+			auto k = randomWord();
+			s[k] = toString(i);
+			d.insert(k, toString(i));
+		}
+		s["do"] = "verb";
+		d.insert(string("do"), string("verb"));
+		vector<string> probes;
+		for (auto const& i: s)
+			probes.push_back(i.first);
+		for (int i = 0; i < 100; ++i)
+			probes.push_back(randomWord());
+		probes.push_back("");
+		probes.push_back("d");
+		for (auto const& k: probes)
+		{
+			auto proof = d.prove(bytesConstRef(k));
+			assert(verifyProof(d.root(), bytesConstRef(k), proof) == (s.count(k) ? s[k] : string()));
+			auto failsWith = [&](h256 _root, vector<bytes> const& _proof)
+			{
+				try
+				{
+					verifyProof(_root, bytesConstRef(k), _proof);
+				}
+				catch (InvalidTrieProof const&)
+				{
+					return true;
+				}
+				return false;
+			};
+			assert(failsWith(~d.root(), proof));
+			auto tampered = proof;
+			auto& n = tampered[rng() % tampered.size()];
+			n[rng() % n.size()] ^= 1;
+			assert(failsWith(d.root(), tampered));
+			tampered = proof;
+			tampered.push_back(proof.back());
+			assert(failsWith(d.root(), tampered));
+			if (proof.size() > 1)
+			{
+				tampered = proof;
+				tampered.pop_back();
+				assert(failsWith(d.root(), tampered));
+			}
+		}
+
+		// Accounts, by key type.
+		TrieDB<Address, BasicMap> accounts(&m);
+		accounts.init();
+		for (unsigned i = 0; i < 100; ++i)
+			accounts.insert(right160(sha3(toBigEndian(u256(i)))), rlpList(u256(i), u256(0)));
+		using AccountTrie = TrieDB<Address, BasicMap>;
+		Address a = right160(sha3(toBigEndian(u256(42))));
+		assert(AccountTrie::verifyProof(accounts.root(), a, accounts.prove(a)) == asString(rlpList(u256(42), u256(0))));
+		assert(AccountTrie::verifyProof(accounts.root(), Address(), accounts.prove(Address())).empty());
+
+		// And contract storage.
+		TrieDB<u256, BasicMap> storage(&m);
+		storage.init();
+		for (unsigned i = 0; i < 100; ++i)
+			storage.insert(u256(i * 7), rlp(u256(i)));
+		using StorageTrie = TrieDB<u256, BasicMap>;
+		assert(StorageTrie::verifyProof(storage.root(), u256(42 * 7), storage.prove(u256(42 * 7))) == asString(rlp(u256(42))));
+		assert(StorageTrie::verifyProof(storage.root(), u256(5), storage.prove(u256(5))).empty());
+	}
+	{
+		// Contract storage is keyed by the 32 big-endian bytes of each u256, so its root is hash256() of the same map,
+		// whatever the size of the keys and however they were changed.
+		BasicMap m;
+		TrieDB<u256, BasicMap> storage(&m);
+		storage.init();
+		u256Map mem;
+		assert(storage.root() == hash256(mem));
+		for (unsigned i = 0; i < 200; ++i)
+		{
+			u256 k = i % 2 ? u256(i) : u256(sha3(toBigEndian(u256(i))));
+			storage.insert(k, rlp(u256(i)));
+			mem[k] = i;
+		}
+		assert(storage.root() == hash256(mem));
+		for (unsigned i = 0; i < 200; i += 3)
+		{
+			u256 k = i % 2 ? u256(i) : u256(sha3(toBigEndian(u256(i))));
+			storage.remove(k);
+			mem.erase(k);
+		}
+		assert(storage.root() == hash256(mem));
+		unsigned count = 0;
+		for (auto const& i: storage)
+		{
+			assert(mem.count(i.first) && i.second.toString() == asString(rlp(mem[i.first])));
+			++count;
+		}
+		assert(count == mem.size());
+	}
+	{
+		// TrieDB's fixed-length lookups find just what the general ones do.
+		BasicMap m;
+		TrieDB<Address, BasicMap> t(&m);
+		t.init();
+		vector<Address> present;
+		vector<Address> others;
+		for (unsigned i = 0; i < 20000; ++i)
+			(i % 2 ? others : present).push_back(right160(sha3(toBigEndian(u256(i)))));
+		for (auto const& a: present)
+		{
+			t.insert(a, rlpList(u256(a[0]), u256(1)));
+			// near misses, parting at the first and last nibbles.
+			Address b = a;
+			b[19] ^= 1;
+			others.push_back(b);
+			b = a;
+			b[0] ^= 0x10;
+			others.push_back(b);
+		}
+		auto same = [&](Address const& _a) { return t.at(_a) == t.GenericTrieDB<BasicMap>::at(_a.ref()); };
+		for (auto const& a: present)
+			assert(same(a) && !t.at(a).empty());
+		for (auto const& a: others)
+			assert(same(a));
+		t.setDeferred(true);
+		t.insert(others[0], rlpList(u256(1)));
+		assert(t.at(others[0]) == asString(rlpList(u256(1))) && same(present[0]));
+		t.setDeferred(false);
+
+		unsigned const c_rounds = 10;
+		size_t n = 0;
+		auto start = chrono::steady_clock::now();
+		for (unsigned r = 0; r < c_rounds; ++r)
+			for (auto const& a: present)
+				n += t.GenericTrieDB<BasicMap>::at(a.ref()).size();
+		auto mid = chrono::steady_clock::now();
+		for (unsigned r = 0; r < c_rounds; ++r)
+			for (auto const& a: present)
+				n -= t.at(a).size();
+		auto end = chrono::steady_clock::now();
+		assert(!n);
+		cout << "Account lookups: " << chrono::duration_cast<chrono::nanoseconds>(mid - start).count() / (c_rounds * present.size()) << " ns by any key, " << chrono::duration_cast<chrono::nanoseconds>(end - mid).count() / (c_rounds * present.size()) << " ns by Address" << endl;
+	}
+	{
+		// Deferred changes give the same tries, readable before they're flushed, while storing far fewer nodes.
+		struct CountingMap: public BasicMap
+		{
+			void insert(h256 _h, bytesConstRef _v) { ++inserts; BasicMap::insert(_h, _v); }
+			unsigned inserts = 0;
+		};
+		mt19937_64 rng(42);
+		CountingMap me;
+		CountingMap md;
+		GenericTrieDB<CountingMap> eager(&me);
+		GenericTrieDB<CountingMap> deferred(&md);
+		eager.init();
+		deferred.init();
+		deferred.setDeferred(true);
+		StringMap s;
+		vector<string> keys;
+		for (int i = 0; i < 40; ++i)
+			keys.push_back(randomWord());
+		keys.push_back("do");
+		keys.push_back("dog");
+		for (int round = 0; round < 100; ++round)
+		{
+			for (unsigned n = 0; n < 25; ++n)
+			{
+				string k = keys[rng() % keys.size()];
+				if (rng() % 4)
+				{
+					string v = toString(rng() % 1000);
+					eager.insert(k, v);
+					deferred.insert(k, v);
+					s[k] = v;
+				}
+				else
+				{
+					eager.remove(k);
+					deferred.remove(k);
+					s.erase(k);
+				}
+				string q = keys[rng() % keys.size()];
+				assert(deferred.at(q) == (s.count(q) ? s[q] : string()));
+			}
+			// the root is known before the changes are flushed, and finding it stores nothing.
+			unsigned inserts = md.inserts;
+			assert(deferred.root() == hash256(s) && md.inserts == inserts);
+			deferred.flush();
+			if (round % 10 == 9)
+			{
+				GenericTrieDB<CountingMap> copy = deferred;
+				assert(copy.root() == hash256(s));
+			}
+			assert(deferred.root() == eager.root());
+			assert(deferred.root() == hash256(s));
+			for (auto const& i: deferred)
+				assert(s[i.first.toString()] == i.second.toString());
+		}
+		deferred.setDeferred(false);
+		assert(!deferred.isDeferred() && deferred.root() == hash256(s));
+		cout << "2500 changes: " << me.inserts << " nodes stored eagerly, " << md.inserts << " deferred" << endl;
+		assert(md.inserts * 4 < me.inserts);
+	}
+	{
+		// A deferred trie leaves the DB alone until it's flushed, and drops changes not flushed when destroyed.
+		BasicMap m;
+		GenericTrieDB<BasicMap> t(&m);
+		t.init();
+		t.insert(string("dog"), string("puppy"));
+		t.insert(string("doge"), string("coin"));
+		h256 old = t.root();
+		StringMap s;
+		s["doge"] = "coin";
+		s["horse"] = "stallion";
+		auto change = [&](GenericTrieDB<BasicMap>& _d)
+		{
+			_d.setDeferred(true);
+			_d.insert(string("horse"), string("stallion"));
+			_d.remove(string("dog"));
+			assert(_d.at(string("horse")) == "stallion" && _d.at(string("dog")).empty());
+			assert(_d.root() == hash256(s));
+			assert(!m.lookup(old).empty() && m.lookup(hash256(s)).empty());
+		};
+		{
+			GenericTrieDB<BasicMap> d(&m, old);
+			change(d);
+		}
+		assert(!m.lookup(old).empty() && m.lookup(hash256(s)).empty());
+		assert(GenericTrieDB<BasicMap>(&m, old).at(string("dog")) == "puppy");
+		{
+			GenericTrieDB<BasicMap> d(&m, old);
+			change(d);
+			d.flush();
+		}
+		assert(m.lookup(old).empty() && !m.lookup(hash256(s)).empty());
+		GenericTrieDB<BasicMap> after(&m, hash256(s));
+		assert(after.at(string("horse")) == "stallion" && after.at(string("doge")) == "coin" && after.at(string("dog")).empty());
+	}
+	{
+		// Benchmark: committing a block's worth of accounts into a populated state trie.
+		mt19937_64 rng(42);
+		BasicMap m1;
+		BasicMap m2;
+		TrieDB<Address, BasicMap> t1(&m1);
+		TrieDB<Address, BasicMap> t2(&m2);
+		t1.init();
+		t2.init();
+		vector<pair<Address, bytes>> accounts;
+		for (unsigned i = 0; i < 20000; ++i)
+			accounts.push_back(make_pair(right160(sha3(toBigEndian(u256(i)))), rlpList(u256(rng()), u256(i))));
+		t1.applyBatch(accounts);
+		t2.applyBatch(accounts);
+		assert(t1.root() == t2.root());
+		vector<pair<Address, bytes>> block;
+		for (unsigned i = 0; i < 1000; ++i)
+			block.push_back(make_pair(accounts[rng() % accounts.size()].first, rlpList(u256(rng()), u256(i))));
+		sort(block.begin(), block.end(), [](pair<Address, bytes> const& _a, pair<Address, bytes> const& _b) { return _a.first < _b.first; });
+		auto start = chrono::steady_clock::now();
+		for (auto const& i: block)
+			t1.insert(i.first, i.second);
+		auto mid = chrono::steady_clock::now();
+		t2.applyBatch(block);
+		auto end = chrono::steady_clock::now();
+		assert(t1.root() == t2.root());
+		cout << "1000 account updates: insert() " << chrono::duration_cast<chrono::microseconds>(mid - start).count() << " us, applyBatch() " << chrono::duration_cast<chrono::microseconds>(end - mid).count() << " us" << endl;
+	}
+	{
+		// Pinned top levels give the same reads, from memory rather than the node cache, and follow the root as it moves.
+		mt19937_64 rng(42);
+		BasicMap m;
+		TrieDB<Address, BasicMap> t(&m);
+		t.init();
+		vector<pair<Address, bytes>> accounts;
+		for (unsigned i = 0; i < 20000; ++i)
+			accounts.push_back(make_pair(right160(sha3(toBigEndian(u256(i)))), rlpList(u256(rng()), u256(i))));
+		t.applyBatch(accounts);
+		auto readAll = [&]()
+		{
+			m.nodeCache().resetCounters();
+			for (auto const& i: accounts)
+				assert(t.at(i.first) == asString(i.second));
+			return m.nodeCache().hits() + m.nodeCache().misses();
+		};
+		unsigned unpinned = readAll();
+		t.setPinnedLevels(3);
+		unsigned pinned = readAll();
+		// Three levels of a 20000-account trie: 1 + 16 + 256 branches, read in once and then for every account from memory.
+		assert(t.pinStats().loads == 273 && pinned == unpinned - 3 * accounts.size() + 273);
+		assert(t.pinStats().hits == 3 * accounts.size() && t.pinnedBytes() <= 4 * 1024 * 1024);
+
+		// A block's worth of changes: just the pinned nodes on their paths are read in anew.
+		for (unsigned i = 0; i < 100; ++i)
+		{
+			auto& a = accounts[rng() % accounts.size()];
+			a.second = rlpList(u256(rng()), u256(i));
+			t.insert(a.first, a.second);
+		}
+		t.resetPinStats();
+		unsigned after = readAll();
+		assert(after == pinned - 273 + t.pinStats().loads && t.pinStats().loads <= 1 + 16 + 100);
+		cout << "Pinned state trie levels: " << unpinned - pinned << " of " << unpinned << " node reads served from " << (t.pinnedBytes() >> 10) << " KiB; " << t.pinStats().loads << " nodes read in after 100 updates" << endl;
+
+		// Within a smaller budget, fewer are pinned, upper levels first.
+		t.setPinnedLevels(3, 64 * 1024);
+		readAll();
+		assert(t.pinnedBytes() <= 64 * 1024 && t.pinStats().hits);
+		t.setPinnedLevels(0);
+		assert(readAll() == unpinned);
+	}
+	{
+		// Once warmed up, insert() and remove() allocate nothing beyond what the map does to store the nodes they make.
+		mt19937_64 rng(42);
+		AllocationCountingMap m;
+		TrieDB<h256, AllocationCountingMap> t(&m);
+		t.init();
+		unsigned const c_keys = 2000;
+		vector<h256> keys;
+		vector<bytes> values;
+		for (unsigned i = 0; i < c_keys * 2; ++i)
+		{
+			keys.push_back(sha3(toBigEndian(u256(i))));
+			values.push_back(rlpList(u256(rng()), u256(i)));
+		}
+		// Value of each key, by index into values; -1 if absent.
+		vector<int> state(keys.size(), -1);
+		for (unsigned i = 0; i < c_keys; ++i)
+			t.insert(keys[i], values[state[i] = i]);
+		auto churn = [&](unsigned _n)
+		{
+			for (unsigned i = 0; i < _n; ++i)
+			{
+				unsigned k = rng() % keys.size();
+				if (state[k] >= 0 && i % 2)
+				{
+					t.remove(keys[k]);
+					state[k] = -1;
+				}
+				else
+					t.insert(keys[k], values[state[k] = rng() % values.size()]);
+			}
+		};
+		churn(2000);
+		size_t a = g_allocations;
+		size_t inMap = m.allocations();
+		churn(2000);
+		a = g_allocations - a - (m.allocations() - inMap);
+		StringMap s;
+		for (unsigned i = 0; i < keys.size(); ++i)
+			if (state[i] >= 0)
+				s[keys[i].ref().toString()] = asString(values[state[i]]);
+		assert(t.root() == hash256(s));
+		cout << "2000 inserts and removes: " << a << " allocations by the trie, " << m.allocations() - inMap << " by the map" << endl;
+		assert(a == 0);
+	}
+	{
+		// One thread inserts while others read snapshots at the roots it has published so far; each sees exactly the
+		// keys inserted before its root.
+		using Snapshot = TrieSnapshot<h256, ConcurrentNodeStore>;
+		ConcurrentNodeStore db;
+		TrieDB<h256, ConcurrentNodeStore> t(&db);
+		t.init();
+		unsigned const c_keys = 3000;
+		unsigned const c_perRoot = 100;
+		unsigned const c_readers = 3;
+		vector<h256> keys;
+		vector<bytes> values;
+		for (unsigned i = 0; i < c_keys; ++i)
+		{
+			keys.push_back(sha3(toBigEndian(u256(i))));
+			values.push_back(rlp(i));
+		}
+		mutex lock;
+		vector<h256> roots;		///< The root after each c_perRoot inserts.
+		atomic<bool> done(false);
+		atomic<unsigned> reads(0);
+		auto read = [&](unsigned _seed)
+		{
+			mt19937_64 rng(_seed);
+			for (bool last = false; !last;)
+			{
+				last = done;
+				h256 root;
+				unsigned n;
+				{
+					lock_guard<mutex> l(lock);
+					if (roots.empty())
+						continue;
+					n = rng() % roots.size();
+					root = roots[n];
+					n = (n + 1) * c_perRoot;
+				}
+				Snapshot s(&db, root);
+				for (unsigned i = 0; i < 50; ++i)
+				{
+					unsigned k = rng() % c_keys;
+					assert(s[keys[k]] == (k < n ? asString(values[k]) : string()));
+				}
+				reads += 50;
+				if (last)
+				{
+					// And a whole walk of the last, which may be of the final root.
+					unsigned count = 0;
+					for (auto const& i: s)
+					{
+						assert(s[i.first] == i.second.toString());
+						++count;
+					}
+					assert(count == n);
+				}
+			}
+		};
+		auto start = chrono::steady_clock::now();
+		vector<thread> readers;
+		for (unsigned i = 0; i < c_readers; ++i)
+			readers.push_back(thread(read, i));
+		for (unsigned i = 0; i < c_keys; ++i)
+		{
+			t.insert(keys[i], values[i]);
+			if ((i + 1) % c_perRoot == 0)
+			{
+				h256 r = t.root();
+				lock_guard<mutex> l(lock);
+				roots.push_back(r);
+			}
+		}
+		done = true;
+		for (auto& i: readers)
+			i.join();
+		auto end = chrono::steady_clock::now();
+		StringMap m;
+		for (unsigned i = 0; i < c_keys; ++i)
+			m[keys[i].ref().toString()] = asString(values[i]);
+		assert(t.root() == hash256(m));
+		assert(Snapshot(&db, roots.front()).at(keys[c_perRoot - 1]) == asString(values[c_perRoot - 1]));
+		cout << c_keys << " inserts alongside " << c_readers << " snapshot readers: " << reads << " reads, " << chrono::duration_cast<chrono::milliseconds>(end - start).count() << " ms" << endl;
+	}
+	{
+		// An arena hands out pieces that don't overlap, even with blocks asked to be smaller than its largest small piece,
+		// and gives back large pieces in any order.
+		Arena a(64);
+		vector<pair<byte*, size_t>> pieces;
+		for (size_t i = 0; i < 200; ++i)
+		{
+			size_t n = i % 4 == 3 ? 1500 + i : 1 + i * 5 % 1024;
+			pieces.push_back(make_pair((byte*)a.allocate(n), n));
+			memset(pieces.back().first, (byte)i, n);
+		}
+		for (size_t i = 0; i < pieces.size(); ++i)
+			assert(count(pieces[i].first, pieces[i].first + pieces[i].second, (byte)i) == (ptrdiff_t)pieces[i].second);
+		// large ones from the middle, the front and the back of those still held.
+		for (size_t i: {103, 3, 199, 7, 195, 51})
+		{
+			size_t used = a.used();
+			a.release(pieces[i].first, pieces[i].second);
+			assert(a.used() < used);
+		}
+		for (size_t i = 0; i < pieces.size(); ++i)
+			if (i % 4 != 3)
+				assert(count(pieces[i].first, pieces[i].first + pieces[i].second, (byte)i) == (ptrdiff_t)pieces[i].second);
+		a.rewind();
+		assert(a.used() == 0 && a.reserved() > 0);
+	}
+	{
+		// Benchmark: building and hashing a large MemTrie, whose nodes come from its arena.
+		unsigned const c_entries = 200000;
+		StringMap s;
+		for (unsigned i = 0; i < c_entries; ++i)
+			s[sha3(toBigEndian(u256(i))).ref().cropped(0, 20).toString()] = toString(i);
+		MemTrie t;
+		size_t a = g_allocations;
+		auto start = chrono::steady_clock::now();
+		for (auto const& i: s)
+			t.insert(i.first, i.second);
+		auto mid = chrono::steady_clock::now();
+		a = g_allocations - a;
+		h256 root = t.hash256();
+		auto end = chrono::steady_clock::now();
+		assert(root == hash256(s));
+		cout << c_entries << " MemTrie entries: build " << chrono::duration_cast<chrono::milliseconds>(mid - start).count() << " ms (" << a << " allocations, " << (t.memoryUsed() >> 20) << " MiB), hash " << chrono::duration_cast<chrono::milliseconds>(end - mid).count() << " ms" << endl;
+
+		// Only what changed since the last hash256() is encoded again.
+		unsigned const c_edits = 1000;
+		start = chrono::steady_clock::now();
+		for (unsigned i = 0; i < c_edits; ++i)
+		{
+			t.insert(s.begin()->first, toString(i));
+			t.hash256();
+		}
+		end = chrono::steady_clock::now();
+		t.insert(s.begin()->first, s.begin()->second);
+		assert(t.hash256() == root);
+		cout << "  edit and rehash: " << chrono::duration_cast<chrono::microseconds>(end - start).count() / c_edits << " us" << endl;
+
+		// Removed entries' memory goes back to the arena, to be reused when they return.
+		size_t built = t.memoryUsed();
+		StringMap removed;
+		unsigned n = 0;
+		for (auto it = s.begin(); it != s.end(); ++n)
+			if (n % 2)
+			{
+				t.remove(it->first);
+				removed.insert(*it);
+				it = s.erase(it);
+			}
+			else
+				++it;
+		assert(t.hash256() == hash256(s));
+		for (auto const& i: removed)
+			t.insert(i.first, i.second);
+		assert(t.hash256() == root);
+		assert(t.memoryUsed() <= built + built / 8);
+		t.clear();
+		assert(!t.hash256() && t.at(s.begin()->first).empty());
+	}
 	return 0;
 }
 
@@ -0,0 +1,121 @@
+/*
+	This file is part of cpp-ethereum.
+
+	cpp-ethereum is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	Foobar is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/** @file uint256.cpp
+ * @date 2014
+ * UInt256 test functions: differential against u256, and benchmarks.
+ */
+
+#include <chrono>
+#include <random>
+#include <UInt256.h>
+#include <Dagger.h>
+using namespace std;
+using namespace std::chrono;
+using namespace eth;
+
+template <class _T, class _F> static double nsPerOp(vector<_T> const& _v, _F const& _f)
+{
+	unsigned const c_rounds = 64;
+	_T sink = 0;
+	auto start = steady_clock::now();
+	for (unsigned r = 0; r < c_rounds; ++r)
+		for (unsigned i = 1; i < _v.size(); ++i)
+			sink ^= _f(_v[i - 1], _v[i]);
+	double ns = duration_cast<nanoseconds>(steady_clock::now() - start).count();
+	if (!sink)
+		cout << "";	// keep the work observable.
+	return ns / (c_rounds * (_v.size() - 1));
+}
+
+int uint256Test()
+{
+	mt19937_64 rng(42);
+	u256 const max = ~u256(0);
+
+	// Values with a mix of zero, full and random limbs.
+	u256s vals = { 0, 1, 2, 3, 0x7f, 0xff, ~(uint64_t)0, u256(1) << 64, (u256(1) << 128) - 1, u256(1) << 255, max, max - 1 };
+	for (unsigned i = 0; i < 400; ++i)
+	{
+		u256 v = 0;
+		for (unsigned l = 0; l < 4; ++l)
+		{
+			uint64_t x = rng();
+			v = (v << 64) | (x % 5 == 0 ? 0 : x % 5 == 1 ? ~(uint64_t)0 : x % 5 == 2 ? (x >> (x % 64)) : x);
+		}
+		vals.push_back(v);
+	}
+
+	for (auto const& a: vals)
+	{
+		UInt256 x(a);
+		assert((u256)x == a && UInt256((h256)a) == x && (h256)x == (h256)a);
+		assert((u256)~x == ~a && (u256)-x == (u256)(0 - a) && (bool)x == (bool)a);
+		assert((u256)(x + 1) == a + 1 && (u256)(UInt256(x) += 1) == a + 1 && (u256)++UInt256(x) == a + 1 && (u256)--UInt256(x) == a - 1);
+		unsigned n = rng() % 256;
+		assert((u256)(x << n) == a << n && (u256)(x >> n) == a >> n);
+		assert(!(x << (256 + n)) && !(x >> (256 + n)));
+		assert((uint64_t)x == (uint64_t)(a & ~(uint64_t)0));
+		if (a)
+			assert(x.msb() == boost::multiprecision::msb(a));
+
+		for (unsigned j = 0; j < 40; ++j)
+		{
+			u256 const& b = vals[rng() % vals.size()];
+			UInt256 y(b);
+			assert((u256)(x + y) == a + b);
+			assert((u256)(x - y) == a - b);
+			assert((u256)(x * y) == a * b);
+			assert((u256)(x & y) == (a & b) && (u256)(x | y) == (a | b) && (u256)(x ^ y) == (a ^ b));
+			assert((x == y) == (a == b) && (x != y) == (a != b));
+			assert((x < y) == (a < b) && (x <= y) == (a <= b) && (x > y) == (a > b) && (x >= y) == (a >= b));
+			if (b)
+				assert((u256)(x / y) == a / b && (u256)(x % y) == a % b);
+		}
+	}
+
+	bool threw = false;
+	try { UInt256(1) / UInt256(); } catch (std::overflow_error const&) { threw = true; }
+	assert(threw);
+
+	// Dagger's 256-bit bound agrees with the bigint formula, including where the difficulty divides 2^256.
+	for (unsigned i = 0; i < 2000; ++i)
+	{
+		h256 root = sha3(toBigEndian(u256(i)));
+		u256 d = i < 256 ? u256(1) << i : u256(rng() >> (rng() % 64)) + 1;
+		bool expected = (bigint)(u256)Dagger::eval(root, i) <= (bigint(1) << 256) / d;
+		assert(Dagger::verify(root, i, d) == expected);
+	}
+
+	// Benchmarks.
+	vector<u256> bv(vals.begin(), vals.end());
+	vector<UInt256> fv;
+	for (auto const& v: vals)
+		fv.push_back(UInt256(v));
+	auto report = [](char const* _op, double _u256, double _fixed)
+	{
+		cout << "u256 " << _op << ": " << _u256 << " ns, UInt256: " << _fixed << " ns" << endl;
+	};
+	report("add", nsPerOp(bv, [](u256 const& a, u256 const& b) { return a + b; }), nsPerOp(fv, [](UInt256 const& a, UInt256 const& b) { return a + b; }));
+	report("sub", nsPerOp(bv, [](u256 const& a, u256 const& b) { return a - b; }), nsPerOp(fv, [](UInt256 const& a, UInt256 const& b) { return a - b; }));
+	report("mul", nsPerOp(bv, [](u256 const& a, u256 const& b) { return a * b; }), nsPerOp(fv, [](UInt256 const& a, UInt256 const& b) { return a * b; }));
+	report("div", nsPerOp(bv, [](u256 const& a, u256 const& b) { return b ? a / b : a; }), nsPerOp(fv, [](UInt256 const& a, UInt256 const& b) { return b ? a / b : a; }));
+	report("mod", nsPerOp(bv, [](u256 const& a, u256 const& b) { return b ? a % b : a; }), nsPerOp(fv, [](UInt256 const& a, UInt256 const& b) { return b ? a % b : a; }));
+	report("shl", nsPerOp(bv, [](u256 const& a, u256 const& b) { return a << (unsigned)(b & 0xff); }), nsPerOp(fv, [](UInt256 const& a, UInt256 const& b) { return a << (unsigned)(b.limb(0) & 0xff); }));
+	report("cmp", nsPerOp(bv, [](u256 const& a, u256 const& b) { return u256(a < b); }), nsPerOp(fv, [](UInt256 const& a, UInt256 const& b) { return UInt256(a < b); }));
+	report("from h256", nsPerOp(bv, [](u256 const& a, u256 const&) { return (u256)(h256)a; }), nsPerOp(fv, [](UInt256 const& a, UInt256 const&) { return UInt256((h256)a); }));
+	return 0;
+}
@@ -0,0 +1,161 @@
+/*
+	This file is part of cpp-ethereum.
+
+	cpp-ethereum is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 2 of the License, or
+	(at your option) any later version.
+
+	Foobar is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Foobar.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/** @file workerPool.cpp
+ * @date 2014
+ * WorkerPool test functions: the pool itself, parallel trie roots against serial ones, and scaling.
+ */
+
+#include <chrono>
+#include <random>
+#include <WorkerPool.h>
+#include <TrieHash.h>
+#include <TrieDB.h>
+#include <MemTrie.h>
+using namespace std;
+using namespace std::chrono;
+using namespace eth;
+
+int workerPoolTest()
+{
+	// Every call is made exactly once, exceptions come back to the caller and nested jobs run serially.
+	for (unsigned threads: { 1, 2, 3, 8 })
+	{
+		WorkerPool pool(threads);
+		assert(pool.threads() == threads);
+		for (unsigned n: { 0, 1, 2, 16, 1000 })
+		{
+			vector<atomic<unsigned>> calls(n);
+			for (auto& c: calls)
+				c = 0;
+			pool.run(n, [&](unsigned i) { ++calls[i]; });
+			for (auto const& c: calls)
+				assert(c == 1);
+		}
+		bool threw = false;
+		try
+		{
+			pool.run(16, [](unsigned i) { if (i == 7) throw runtime_error("7"); });
+		}
+		catch (runtime_error const& _e)
+		{
+			threw = string(_e.what()) == "7";
+		}
+		assert(threw);
+		atomic<unsigned> inner(0);
+		pool.run(4, [&](unsigned) { pool.run(4, [&](unsigned) { ++inner; }); });
+		assert(inner == 16);
+	}
+
+	// Parallel roots are the serial roots, whatever the number of threads.
+	mt19937_64 rng(42);
+	StringMap s;
+	for (unsigned i = 0; i < 3000; ++i)
+		s[toBigEndianString(sha3(toBigEndian(u256(i))))] = toString(rng());
+	for (unsigned i = 0; i < 200; ++i)
+		s[toString(rng() % 100000)] = toString(i);	// and some short keys sharing prefixes.
+	MemTrie mt;
+	for (auto const& i: s)
+		mt.insert(i.first, i.second);
+	h256 root = hash256(s);
+	assert(mt.hash256() == root);
+
+	vector<pair<string, string>> changes;
+	for (unsigned i = 0; i < 500; ++i)
+	{
+		auto it = s.begin();
+		advance(it, rng() % s.size());
+		changes.push_back(make_pair(it->first, i % 5 ? toString(rng()) : string()));
+	}
+	sort(changes.begin(), changes.end());
+	vector<GenericTrieDB<BasicMap>::BatchItem> batch;
+	for (auto const& i: changes)
+		batch.push_back(make_pair(bytesConstRef(i.first), bytesConstRef(i.second)));
+	StringMap changed = s;
+	for (auto const& i: changes)
+		if (i.second.empty())
+			changed.erase(i.first);
+		else
+			changed[i.first] = i.second;
+	h256 changedRoot = hash256(changed);
+
+	BasicMap serialDB;
+	GenericTrieDB<BasicMap> serial(&serialDB);
+	serial.init();
+	for (auto const& i: s)
+		serial.insert(i.first, i.second);
+	serial.applyBatch(&batch);
+	assert(serial.root() == changedRoot);
+
+	for (unsigned threads: { 1, 2, 4, 8 })
+	{
+		WorkerPool pool(threads);
+		assert(hash256(s, &pool) == root);
+		// A fresh trie each time, as MemTrie keeps what it has hashed.
+		MemTrie pmt;
+		for (auto const& i: s)
+			pmt.insert(i.first, i.second);
+		assert(pmt.hash256(&pool) == root);
+		for (auto const& i: changes)
+			pmt.insert(i.first, i.second);
+		assert(pmt.hash256(&pool) == changedRoot);
+		BasicMap m;
+		GenericTrieDB<BasicMap> t(&m);
+		t.setWorkerPool(&pool);
+		t.init();
+		for (auto const& i: s)
+			t.insert(i.first, i.second);
+		assert(t.root() == root);
+		t.applyBatch(&batch);
+		assert(t.root() == changedRoot);
+		for (auto const& i: serialDB.get())
+			assert(m.lookup(i.first) == i.second);
+	}
+
+	// Benchmark: hashing a 50000-entry trie from scratch, and committing 2000 changes to it, over growing numbers of threads.
+	StringMap big;
+	for (unsigned i = 0; i < 50000; ++i)
+		big[toBigEndianString(sha3(toBigEndian(u256(i))))] = toString(rng());
+	vector<pair<string, string>> update;
+	for (unsigned i = 0; i < 2000; ++i)
+		update.push_back(make_pair(toBigEndianString(sha3(toBigEndian(u256(rng() % 50000)))), toString(rng())));
+	sort(update.begin(), update.end());
+	vector<GenericTrieDB<BasicMap>::BatchItem> updateBatch;
+	for (auto const& i: update)
+		updateBatch.push_back(make_pair(bytesConstRef(i.first), bytesConstRef(i.second)));
+	cout << "Parallel roots on " << WorkerPool::defaultThreads() << " hardware threads:" << endl;
+	for (unsigned threads = 1; threads <= max(4u, WorkerPool::defaultThreads()); threads *= 2)
+	{
+		WorkerPool pool(threads);
+		auto start = steady_clock::now();
+		hash256(big, &pool);
+		auto mid = steady_clock::now();
+		BasicMap m;
+		GenericTrieDB<BasicMap> t(&m);
+		t.setWorkerPool(&pool);
+		t.init();
+		t.setDeferred(true);
+		for (auto const& i: big)
+			t.insert(i.first, i.second);
+		t.flush();
+		t.setDeferred(false);
+		auto mid2 = steady_clock::now();
+		t.applyBatch(&updateBatch);
+		auto end = steady_clock::now();
+		cout << "  " << threads << " threads: hash256() " << duration_cast<microseconds>(mid - start).count() << " us, trie flush " << duration_cast<microseconds>(mid2 - mid).count() << " us (including inserts), 2000-change applyBatch() " << duration_cast<microseconds>(end - mid2).count() << " us" << endl;
+	}
+	return 0;
+}